@@ -0,0 +1,155 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KEYBOARD_HANDLER__BOUNDED_QUEUE_HPP_
+#define KEYBOARD_HANDLER__BOUNDED_QUEUE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/// \brief Lock-free bounded multi-producer multi-consumer queue.
+/// \details Implementation of the bounded MPMC queue by Dmitry Vyukov. Storage preallocated
+/// during construction, push and pop never allocate and never block. Each slot has sequence
+/// number which tells whether slot is free for the producer at position `pos`
+/// (sequence == pos) or ready for the consumer (sequence == pos + 1).
+/// \tparam T Type of the elements. Shall be default constructible and move assignable.
+template<typename T>
+class BoundedQueue
+{
+public:
+  /// \brief Constructor
+  /// \param capacity Maximum number of elements in queue. Will be rounded up to the power of two.
+  explicit BoundedQueue(size_t capacity)
+  {
+    size_t rounded_capacity = 2;
+    while (rounded_capacity < capacity) {
+      rounded_capacity <<= 1;
+    }
+    mask_ = rounded_capacity - 1;
+    slots_.reset(new Slot[rounded_capacity]);
+    for (size_t i = 0; i < rounded_capacity; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue & operator=(const BoundedQueue &) = delete;
+
+  /// \brief Push element to the end of the queue.
+  /// \return false if queue is full.
+  bool try_push(T value)
+  {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot * slot = nullptr;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = std::move(value);
+    // Sequentially consistent store to let producer and consumer use Dekker-style handshake
+    // for sleeping consumers.
+    slot->sequence.store(pos + 1);
+    return true;
+  }
+
+  /// \brief Pop element from the front of the queue.
+  /// \return false if queue is empty.
+  bool try_pop(T & value)
+  {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Slot * slot = nullptr;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    value = std::move(slot->value);
+    slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// \brief Check if queue has element ready for the consumer.
+  bool empty() const
+  {
+    size_t pos = dequeue_pos_.load();
+    return slots_[pos & mask_].sequence.load() != pos + 1;
+  }
+
+  /// \brief Approximate number of elements in queue. Exact if there are no concurrent calls.
+  size_t size() const
+  {
+    size_t enqueue_pos = enqueue_pos_.load();
+    size_t dequeue_pos = dequeue_pos_.load();
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+  }
+
+  /// \brief Number of elements which could be stored in the queue.
+  size_t capacity() const
+  {
+    return mask_ + 1;
+  }
+
+  /// \brief Number of elements pushed to the queue since construction.
+  size_t get_number_of_pushed_elements() const
+  {
+    return enqueue_pos_.load();
+  }
+
+  /// \brief Number of elements popped from the queue since construction.
+  size_t get_number_of_popped_elements() const
+  {
+    return dequeue_pos_.load();
+  }
+
+private:
+  struct Slot
+  {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  /// Padding to keep producer and consumer positions on separate cache lines without
+  /// over-aligning the queue, which would require aligned new in C++14.
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_ = 0;
+  char padding_0_[CACHE_LINE_SIZE];
+  std::atomic<size_t> enqueue_pos_{0};
+  char padding_1_[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> dequeue_pos_{0};
+};
+
+#endif  // KEYBOARD_HANDLER__BOUNDED_QUEUE_HPP_
@@ -0,0 +1,158 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KEYBOARD_HANDLER__CLOCK_HPP_
+#define KEYBOARD_HANDLER__CLOCK_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "keyboard_handler/error.hpp"
+
+/// \brief Source of the current time for the timers, input timeouts and event timestamps of the
+/// keyboard handler.
+/// \details Time points are steady clock time points to let them be compared with the time
+/// points passed by user, e.g. macro step offsets, regardless of the clock implementation.
+/// Durations of the callback calls reported by the watchdog and binding stats are always
+/// measured with the real steady clock.
+class Clock
+{
+public:
+  using time_point = std::chrono::steady_clock::time_point;
+  using duration = std::chrono::steady_clock::duration;
+  using advance_callback_t = std::function<void ()>;
+  using advance_callback_handle_t = uint64_t;
+
+  virtual ~Clock() = default;
+
+  /// \brief Get current time. Shall be monotonic and thread safe.
+  virtual time_point now() const = 0;
+
+  /// \brief Register callback called after time was advanced by other means than passing of the
+  /// real time.
+  /// \details Keyboard handler uses it to wake up its thread for the timers which became due.
+  /// Real time clocks never call it.
+  /// \return Handle for #remove_advance_callback.
+  virtual advance_callback_handle_t add_advance_callback(const advance_callback_t & callback)
+  {
+    (void)callback;
+    return 0;
+  }
+
+  /// \brief Unregister callback. Callback isn't running anymore when function returns.
+  virtual void remove_advance_callback(advance_callback_handle_t handle)
+  {
+    (void)handle;
+  }
+};
+
+/// \brief Clock backed by std::chrono::steady_clock. Used by default.
+class SteadyClock : public Clock
+{
+public:
+  time_point now() const override
+  {
+    return std::chrono::steady_clock::now();
+  }
+};
+
+/// \brief Manually advanced clock for deterministic tests and benchmarks.
+/// \details Time stands still until #advance or #set_time is called. Registered callbacks are
+/// called from the thread advancing the clock.
+class SimulatedClock : public Clock
+{
+public:
+  /// \brief Constructor
+  /// \param start Initial time.
+  explicit SimulatedClock(time_point start = time_point())
+  : now_ns_(to_ns(start)) {}
+
+  time_point now() const override
+  {
+    return time_point(std::chrono::nanoseconds(now_ns_.load(std::memory_order_acquire)));
+  }
+
+  /// \brief Move time forward and notify registered callbacks.
+  /// \throw std::invalid_argument if duration is negative.
+  void advance(duration delta)
+  {
+    if (delta < duration::zero()) {
+      KEYBOARD_HANDLER_THROW(std::invalid_argument("SimulatedClock can't go backward."));
+    }
+    now_ns_.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(delta).count(),
+      std::memory_order_acq_rel);
+    notify_advance();
+  }
+
+  /// \brief Set current time and notify registered callbacks.
+  /// \throw std::invalid_argument if time point is earlier than current time.
+  void set_time(time_point time)
+  {
+    int64_t time_ns = to_ns(time);
+    int64_t now_ns = now_ns_.load(std::memory_order_acquire);
+    do {
+      if (time_ns < now_ns) {
+        KEYBOARD_HANDLER_THROW(std::invalid_argument("SimulatedClock can't go backward."));
+      }
+    } while (!now_ns_.compare_exchange_weak(now_ns, time_ns, std::memory_order_acq_rel));
+    notify_advance();
+  }
+
+  advance_callback_handle_t add_advance_callback(const advance_callback_t & callback) override
+  {
+    std::lock_guard<std::mutex> lk(callbacks_mutex_);
+    callbacks_.emplace_back(++last_handle_, callback);
+    return last_handle_;
+  }
+
+  void remove_advance_callback(advance_callback_handle_t handle) override
+  {
+    std::lock_guard<std::mutex> lk(callbacks_mutex_);
+    callbacks_.erase(
+      std::remove_if(
+        callbacks_.begin(), callbacks_.end(),
+        [handle](const std::pair<advance_callback_handle_t, advance_callback_t> & callback) {
+          return callback.first == handle;
+        }), callbacks_.end());
+  }
+
+private:
+  static int64_t to_ns(time_point time)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+  }
+
+  void notify_advance()
+  {
+    // Under the mutex to let remove_advance_callback guarantee that callback isn't running
+    std::lock_guard<std::mutex> lk(callbacks_mutex_);
+    for (const auto & callback : callbacks_) {
+      callback.second();
+    }
+  }
+
+  std::atomic<int64_t> now_ns_;
+  std::mutex callbacks_mutex_;
+  std::vector<std::pair<advance_callback_handle_t, advance_callback_t>> callbacks_;
+  advance_callback_handle_t last_handle_ = 0;
+};
+
+#endif  // KEYBOARD_HANDLER__CLOCK_HPP_
@@ -0,0 +1,100 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KEYBOARD_HANDLER__ERROR_HPP_
+#define KEYBOARD_HANDLER__ERROR_HPP_
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <system_error>
+#include <utility>
+
+/// \brief 1 if code is compiled with exceptions, 0 if exceptions are disabled, e.g. with
+/// -fno-exceptions. See KEYBOARD_HANDLER_ENABLE_EXCEPTIONS CMake option.
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define KEYBOARD_HANDLER_HAS_EXCEPTIONS 1
+#else
+#define KEYBOARD_HANDLER_HAS_EXCEPTIONS 0
+#endif
+
+/// \brief Print description of the unrecoverable error and abort the process.
+/// \details Used instead of throwing in the builds without exceptions.
+[[noreturn]] inline void keyboard_handler_abort(const char * what) noexcept
+{
+  std::fprintf(stderr, "keyboard_handler: %s\n", what);
+  std::abort();
+}
+
+/// \brief Throw exception or abort with its message in the builds without exceptions.
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+#define KEYBOARD_HANDLER_THROW(exception) throw exception
+#else
+#define KEYBOARD_HANDLER_THROW(exception) keyboard_handler_abort((exception).what())
+#endif
+
+/// \brief Result of the factory functions which don't throw: created object or error code.
+/// \details Keyboard handlers own threads referring to them and can't be moved, so object is
+/// returned in the unique_ptr.
+template<typename T>
+class KeyboardHandlerResult
+{
+public:
+  /// \brief Successful result.
+  KeyboardHandlerResult(std::unique_ptr<T> value)  // NOLINT(runtime/explicit)
+  : value_(std::move(value)) {}
+
+  /// \brief Failed result.
+  KeyboardHandlerResult(std::error_code error)  // NOLINT(runtime/explicit)
+  : error_(error) {}
+
+  /// \brief Check if object was created.
+  bool has_value() const
+  {
+    return value_ != nullptr;
+  }
+
+  explicit operator bool() const
+  {
+    return has_value();
+  }
+
+  /// \brief Get created object. nullptr if creation failed.
+  std::unique_ptr<T> & value()
+  {
+    return value_;
+  }
+
+  T * operator->() const
+  {
+    return value_.get();
+  }
+
+  T & operator*() const
+  {
+    return *value_;
+  }
+
+  /// \brief Get error code. Empty if object was created.
+  const std::error_code & error() const
+  {
+    return error_;
+  }
+
+private:
+  std::unique_ptr<T> value_;
+  std::error_code error_;
+};
+
+#endif  // KEYBOARD_HANDLER__ERROR_HPP_
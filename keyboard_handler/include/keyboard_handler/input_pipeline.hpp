@@ -0,0 +1,126 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KEYBOARD_HANDLER__INPUT_PIPELINE_HPP_
+#define KEYBOARD_HANDLER__INPUT_PIPELINE_HPP_
+
+#include <type_traits>
+#include <utility>
+#include "keyboard_handler_base.hpp"
+
+/// \brief Compile time composed chain of input filters.
+/// \details Each stage is a callable with `bool (KeyCode &, KeyModifiers &)` signature. Stages
+/// are called in the order of template arguments. Stage could modify key code and key modifiers
+/// in place and shall return false to drop the key press, in this case the rest of the stages
+/// will not be called. Whole pipeline could be registered in the keyboard handler as a single
+/// filter via KeyboardHandlerBase::add_input_filter().
+template<typename ... Stages>
+class InputPipeline;
+
+/// \brief Empty pipeline which passes all key presses as is.
+template<>
+class InputPipeline<>
+{
+public:
+  bool operator()(KeyboardHandlerBase::KeyCode &, KeyboardHandlerBase::KeyModifiers &)
+  {
+    return true;
+  }
+};
+
+template<typename Stage, typename ... Rest>
+class InputPipeline<Stage, Rest...>
+{
+public:
+  InputPipeline(Stage stage, Rest... rest)
+  : stage_(std::move(stage)), rest_(std::move(rest)...) {}
+
+  bool operator()(
+    KeyboardHandlerBase::KeyCode & key_code,
+    KeyboardHandlerBase::KeyModifiers & key_modifiers)
+  {
+    return stage_(key_code, key_modifiers) && rest_(key_code, key_modifiers);
+  }
+
+private:
+  Stage stage_;
+  InputPipeline<Rest...> rest_;
+};
+
+/// \brief Create compile time composed pipeline from the list of stages.
+/// \param stages Callables with `bool (KeyCode &, KeyModifiers &)` signature.
+/// \return InputPipeline object which could be registered via
+/// KeyboardHandlerBase::add_input_filter().
+template<typename ... Stages>
+InputPipeline<std::decay_t<Stages>...> make_input_pipeline(Stages && ... stages)
+{
+  return InputPipeline<std::decay_t<Stages>...>(std::forward<Stages>(stages)...);
+}
+
+/// \brief Stage which replaces one key press combination with another.
+class KeyRemapStage
+{
+public:
+  KeyRemapStage(
+    KeyboardHandlerBase::KeyCode from_key_code,
+    KeyboardHandlerBase::KeyModifiers from_key_modifiers,
+    KeyboardHandlerBase::KeyCode to_key_code,
+    KeyboardHandlerBase::KeyModifiers to_key_modifiers)
+  : from_key_code_(from_key_code), from_key_modifiers_(from_key_modifiers),
+    to_key_code_(to_key_code), to_key_modifiers_(to_key_modifiers) {}
+
+  bool operator()(
+    KeyboardHandlerBase::KeyCode & key_code,
+    KeyboardHandlerBase::KeyModifiers & key_modifiers) const
+  {
+    if (key_code == from_key_code_ && key_modifiers == from_key_modifiers_) {
+      key_code = to_key_code_;
+      key_modifiers = to_key_modifiers_;
+    }
+    return true;
+  }
+
+private:
+  KeyboardHandlerBase::KeyCode from_key_code_;
+  KeyboardHandlerBase::KeyModifiers from_key_modifiers_;
+  KeyboardHandlerBase::KeyCode to_key_code_;
+  KeyboardHandlerBase::KeyModifiers to_key_modifiers_;
+};
+
+/// \brief Stage which drops all key presses while predicate returns true.
+/// \details Useful for suppressing key presses while modal dialog is open.
+template<typename Predicate>
+class SuppressStage
+{
+public:
+  explicit SuppressStage(Predicate predicate)
+  : predicate_(std::move(predicate)) {}
+
+  bool operator()(KeyboardHandlerBase::KeyCode &, KeyboardHandlerBase::KeyModifiers &)
+  {
+    return !predicate_();
+  }
+
+private:
+  Predicate predicate_;
+};
+
+/// \brief Create stage which drops all key presses while predicate returns true.
+template<typename Predicate>
+SuppressStage<std::decay_t<Predicate>> make_suppress_stage(Predicate && predicate)
+{
+  return SuppressStage<std::decay_t<Predicate>>(std::forward<Predicate>(predicate));
+}
+
+#endif  // KEYBOARD_HANDLER__INPUT_PIPELINE_HPP_
@@ -0,0 +1,426 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KEYBOARD_HANDLER__KEY_CHORD_HPP_
+#define KEYBOARD_HANDLER__KEY_CHORD_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include "keyboard_handler/error.hpp"
+#include "keyboard_handler_base.hpp"
+
+/// \brief Key press combination parsed from the text spec like "ctrl+shift+f5" or "alt+x".
+/// \details Spec is a list of modifiers "ctrl", "shift" and "alt" followed by the key name,
+/// separated with '+'. Names are case insensitive. Key names are the names of the KeyCode enum
+/// values, e.g. "cursor_up" or "number_1", printable characters, e.g. "1", "$" or "+", and the
+/// common aliases: "up", "down", "left", "right", "esc", "backspace", "delete", "del",
+/// "pageup", "pagedown". "control" is accepted as alias for "ctrl".
+/// Could be created at compile time with `"ctrl+x"_chord` literal or at runtime with
+/// parse_key_chord(), both share the same lookup tables.
+struct KeyChord
+{
+  constexpr KeyChord()
+  : key_code(KeyboardHandlerBase::KeyCode::UNKNOWN),
+    key_modifiers(KeyboardHandlerBase::KeyModifiers::NONE) {}
+
+  constexpr KeyChord(
+    KeyboardHandlerBase::KeyCode key_code, KeyboardHandlerBase::KeyModifiers key_modifiers)
+  : key_code(key_code), key_modifiers(key_modifiers) {}
+
+  /// \brief Get key code and key modifiers combined to the single value.
+  constexpr uint64_t value() const
+  {
+    return (static_cast<uint64_t>(key_code) << 32) | static_cast<uint64_t>(key_modifiers);
+  }
+
+  /// \brief Create key chord from the value returned by #value.
+  static constexpr KeyChord from_value(uint64_t value)
+  {
+    return KeyChord(
+      static_cast<KeyboardHandlerBase::KeyCode>(value >> 32),
+      static_cast<KeyboardHandlerBase::KeyModifiers>(value & 0xFFFFFFFF));
+  }
+
+  constexpr bool operator==(const KeyChord & other) const
+  {
+    return value() == other.value();
+  }
+
+  constexpr bool operator!=(const KeyChord & other) const
+  {
+    return value() != other.value();
+  }
+
+  KeyboardHandlerBase::KeyCode key_code;
+  KeyboardHandlerBase::KeyModifiers key_modifiers;
+};
+
+/// \brief Data type for mapping key name in the key chord spec to the KeyCode enum value.
+struct KeyChordName
+{
+  /// Lower case name.
+  const char * name;
+  KeyboardHandlerBase::KeyCode key_code;
+};
+
+/// \brief Lookup table for the key names accepted in the key chord spec.
+constexpr KeyChordName KEY_CHORD_NAMES[] {
+  {"!", KeyboardHandlerBase::KeyCode::EXCLAMATION_MARK},
+  {"exclamation_mark", KeyboardHandlerBase::KeyCode::EXCLAMATION_MARK},
+  {"\"", KeyboardHandlerBase::KeyCode::QUOTATION_MARK},
+  {"quotation_mark", KeyboardHandlerBase::KeyCode::QUOTATION_MARK},
+  {"#", KeyboardHandlerBase::KeyCode::HASHTAG_SIGN},
+  {"hashtag_sign", KeyboardHandlerBase::KeyCode::HASHTAG_SIGN},
+  {"$", KeyboardHandlerBase::KeyCode::DOLLAR_SIGN},
+  {"dollar_sign", KeyboardHandlerBase::KeyCode::DOLLAR_SIGN},
+  {"%", KeyboardHandlerBase::KeyCode::PERCENT_SIGN},
+  {"percent_sign", KeyboardHandlerBase::KeyCode::PERCENT_SIGN},
+  {"&", KeyboardHandlerBase::KeyCode::AMPERSAND},
+  {"ampersand", KeyboardHandlerBase::KeyCode::AMPERSAND},
+  {"'", KeyboardHandlerBase::KeyCode::APOSTROPHE},
+  {"apostrophe", KeyboardHandlerBase::KeyCode::APOSTROPHE},
+  {"(", KeyboardHandlerBase::KeyCode::OPENING_PARENTHESIS},
+  {"opening_parenthesis", KeyboardHandlerBase::KeyCode::OPENING_PARENTHESIS},
+  {")", KeyboardHandlerBase::KeyCode::CLOSING_PARENTHESIS},
+  {"closing_parenthesis", KeyboardHandlerBase::KeyCode::CLOSING_PARENTHESIS},
+  {"*", KeyboardHandlerBase::KeyCode::STAR},
+  {"star", KeyboardHandlerBase::KeyCode::STAR},
+  {"+", KeyboardHandlerBase::KeyCode::PLUS},
+  {"plus", KeyboardHandlerBase::KeyCode::PLUS},
+  {",", KeyboardHandlerBase::KeyCode::COMMA},
+  {"comma", KeyboardHandlerBase::KeyCode::COMMA},
+  {"-", KeyboardHandlerBase::KeyCode::MINUS},
+  {"minus", KeyboardHandlerBase::KeyCode::MINUS},
+  {".", KeyboardHandlerBase::KeyCode::DOT},
+  {"dot", KeyboardHandlerBase::KeyCode::DOT},
+  {"/", KeyboardHandlerBase::KeyCode::RIGHT_SLASH},
+  {"right_slash", KeyboardHandlerBase::KeyCode::RIGHT_SLASH},
+  {"0", KeyboardHandlerBase::KeyCode::NUMBER_0},
+  {"number_0", KeyboardHandlerBase::KeyCode::NUMBER_0},
+  {"1", KeyboardHandlerBase::KeyCode::NUMBER_1},
+  {"number_1", KeyboardHandlerBase::KeyCode::NUMBER_1},
+  {"2", KeyboardHandlerBase::KeyCode::NUMBER_2},
+  {"number_2", KeyboardHandlerBase::KeyCode::NUMBER_2},
+  {"3", KeyboardHandlerBase::KeyCode::NUMBER_3},
+  {"number_3", KeyboardHandlerBase::KeyCode::NUMBER_3},
+  {"4", KeyboardHandlerBase::KeyCode::NUMBER_4},
+  {"number_4", KeyboardHandlerBase::KeyCode::NUMBER_4},
+  {"5", KeyboardHandlerBase::KeyCode::NUMBER_5},
+  {"number_5", KeyboardHandlerBase::KeyCode::NUMBER_5},
+  {"6", KeyboardHandlerBase::KeyCode::NUMBER_6},
+  {"number_6", KeyboardHandlerBase::KeyCode::NUMBER_6},
+  {"7", KeyboardHandlerBase::KeyCode::NUMBER_7},
+  {"number_7", KeyboardHandlerBase::KeyCode::NUMBER_7},
+  {"8", KeyboardHandlerBase::KeyCode::NUMBER_8},
+  {"number_8", KeyboardHandlerBase::KeyCode::NUMBER_8},
+  {"9", KeyboardHandlerBase::KeyCode::NUMBER_9},
+  {"number_9", KeyboardHandlerBase::KeyCode::NUMBER_9},
+  {":", KeyboardHandlerBase::KeyCode::COLON},
+  {"colon", KeyboardHandlerBase::KeyCode::COLON},
+  {";", KeyboardHandlerBase::KeyCode::SEMICOLON},
+  {"semicolon", KeyboardHandlerBase::KeyCode::SEMICOLON},
+  {"<", KeyboardHandlerBase::KeyCode::LEFT_ANGLE_BRACKET},
+  {"left_angle_bracket", KeyboardHandlerBase::KeyCode::LEFT_ANGLE_BRACKET},
+  {"=", KeyboardHandlerBase::KeyCode::EQUAL_SIGN},
+  {"equal_sign", KeyboardHandlerBase::KeyCode::EQUAL_SIGN},
+  {">", KeyboardHandlerBase::KeyCode::RIGHT_ANGLE_BRACKET},
+  {"right_angle_bracket", KeyboardHandlerBase::KeyCode::RIGHT_ANGLE_BRACKET},
+  {"?", KeyboardHandlerBase::KeyCode::QUESTION_MARK},
+  {"question_mark", KeyboardHandlerBase::KeyCode::QUESTION_MARK},
+  {"@", KeyboardHandlerBase::KeyCode::AT},
+  {"at", KeyboardHandlerBase::KeyCode::AT},
+  {"[", KeyboardHandlerBase::KeyCode::LEFT_SQUARE_BRACKET},
+  {"left_square_bracket", KeyboardHandlerBase::KeyCode::LEFT_SQUARE_BRACKET},
+  {"\\", KeyboardHandlerBase::KeyCode::BACK_SLASH},
+  {"back_slash", KeyboardHandlerBase::KeyCode::BACK_SLASH},
+  {"]", KeyboardHandlerBase::KeyCode::RIGHT_SQUARE_BRACKET},
+  {"right_square_bracket", KeyboardHandlerBase::KeyCode::RIGHT_SQUARE_BRACKET},
+  {"^", KeyboardHandlerBase::KeyCode::CARET},
+  {"caret", KeyboardHandlerBase::KeyCode::CARET},
+  {"_", KeyboardHandlerBase::KeyCode::UNDERSCORE_SIGN},
+  {"underscore_sign", KeyboardHandlerBase::KeyCode::UNDERSCORE_SIGN},
+  {"`", KeyboardHandlerBase::KeyCode::GRAVE_ACCENT_SIGN},
+  {"grave_accent_sign", KeyboardHandlerBase::KeyCode::GRAVE_ACCENT_SIGN},
+  {"{", KeyboardHandlerBase::KeyCode::LEFT_CURLY_BRACKET},
+  {"left_curly_bracket", KeyboardHandlerBase::KeyCode::LEFT_CURLY_BRACKET},
+  {"|", KeyboardHandlerBase::KeyCode::VERTICAL_BAR},
+  {"vertical_bar", KeyboardHandlerBase::KeyCode::VERTICAL_BAR},
+  {"}", KeyboardHandlerBase::KeyCode::RIGHT_CURLY_BRACKET},
+  {"right_curly_bracket", KeyboardHandlerBase::KeyCode::RIGHT_CURLY_BRACKET},
+  {"~", KeyboardHandlerBase::KeyCode::TILDA},
+  {"tilda", KeyboardHandlerBase::KeyCode::TILDA},
+  {"a", KeyboardHandlerBase::KeyCode::A},
+  {"b", KeyboardHandlerBase::KeyCode::B},
+  {"c", KeyboardHandlerBase::KeyCode::C},
+  {"d", KeyboardHandlerBase::KeyCode::D},
+  {"e", KeyboardHandlerBase::KeyCode::E},
+  {"f", KeyboardHandlerBase::KeyCode::F},
+  {"g", KeyboardHandlerBase::KeyCode::G},
+  {"h", KeyboardHandlerBase::KeyCode::H},
+  {"i", KeyboardHandlerBase::KeyCode::I},
+  {"j", KeyboardHandlerBase::KeyCode::J},
+  {"k", KeyboardHandlerBase::KeyCode::K},
+  {"l", KeyboardHandlerBase::KeyCode::L},
+  {"m", KeyboardHandlerBase::KeyCode::M},
+  {"n", KeyboardHandlerBase::KeyCode::N},
+  {"o", KeyboardHandlerBase::KeyCode::O},
+  {"p", KeyboardHandlerBase::KeyCode::P},
+  {"q", KeyboardHandlerBase::KeyCode::Q},
+  {"r", KeyboardHandlerBase::KeyCode::R},
+  {"s", KeyboardHandlerBase::KeyCode::S},
+  {"t", KeyboardHandlerBase::KeyCode::T},
+  {"u", KeyboardHandlerBase::KeyCode::U},
+  {"v", KeyboardHandlerBase::KeyCode::V},
+  {"w", KeyboardHandlerBase::KeyCode::W},
+  {"x", KeyboardHandlerBase::KeyCode::X},
+  {"y", KeyboardHandlerBase::KeyCode::Y},
+  {"z", KeyboardHandlerBase::KeyCode::Z},
+  {"cursor_up", KeyboardHandlerBase::KeyCode::CURSOR_UP},
+  {"cursor_down", KeyboardHandlerBase::KeyCode::CURSOR_DOWN},
+  {"cursor_left", KeyboardHandlerBase::KeyCode::CURSOR_LEFT},
+  {"cursor_right", KeyboardHandlerBase::KeyCode::CURSOR_RIGHT},
+  {"escape", KeyboardHandlerBase::KeyCode::ESCAPE},
+  {"space", KeyboardHandlerBase::KeyCode::SPACE},
+  {"enter", KeyboardHandlerBase::KeyCode::ENTER},
+  {"back_space", KeyboardHandlerBase::KeyCode::BACK_SPACE},
+  {"delete_key", KeyboardHandlerBase::KeyCode::DELETE_KEY},
+  {"end", KeyboardHandlerBase::KeyCode::END},
+  {"pg_down", KeyboardHandlerBase::KeyCode::PG_DOWN},
+  {"pg_up", KeyboardHandlerBase::KeyCode::PG_UP},
+  {"home", KeyboardHandlerBase::KeyCode::HOME},
+  {"insert", KeyboardHandlerBase::KeyCode::INSERT},
+  {"up", KeyboardHandlerBase::KeyCode::CURSOR_UP},
+  {"down", KeyboardHandlerBase::KeyCode::CURSOR_DOWN},
+  {"left", KeyboardHandlerBase::KeyCode::CURSOR_LEFT},
+  {"right", KeyboardHandlerBase::KeyCode::CURSOR_RIGHT},
+  {"esc", KeyboardHandlerBase::KeyCode::ESCAPE},
+  {"backspace", KeyboardHandlerBase::KeyCode::BACK_SPACE},
+  {"delete", KeyboardHandlerBase::KeyCode::DELETE_KEY},
+  {"del", KeyboardHandlerBase::KeyCode::DELETE_KEY},
+  {"pagedown", KeyboardHandlerBase::KeyCode::PG_DOWN},
+  {"pageup", KeyboardHandlerBase::KeyCode::PG_UP},
+  {"f1", KeyboardHandlerBase::KeyCode::F1},
+  {"f2", KeyboardHandlerBase::KeyCode::F2},
+  {"f3", KeyboardHandlerBase::KeyCode::F3},
+  {"f4", KeyboardHandlerBase::KeyCode::F4},
+  {"f5", KeyboardHandlerBase::KeyCode::F5},
+  {"f6", KeyboardHandlerBase::KeyCode::F6},
+  {"f7", KeyboardHandlerBase::KeyCode::F7},
+  {"f8", KeyboardHandlerBase::KeyCode::F8},
+  {"f9", KeyboardHandlerBase::KeyCode::F9},
+  {"f10", KeyboardHandlerBase::KeyCode::F10},
+  {"f11", KeyboardHandlerBase::KeyCode::F11},
+  {"f12", KeyboardHandlerBase::KeyCode::F12},
+  {"tab", KeyboardHandlerBase::KeyCode::TAB},
+};
+
+/// \brief Length of KEY_CHORD_NAMES measured in number of elements.
+constexpr size_t KEY_CHORD_NAMES_LENGTH = sizeof(KEY_CHORD_NAMES) / sizeof(KEY_CHORD_NAMES[0]);
+
+/// \brief Open addressing hash index of KEY_CHORD_NAMES built at compile time.
+/// \details Slot holds index of the name in KEY_CHORD_NAMES plus one, or 0 if slot is empty.
+/// Number of slots is a power of two at least twice larger than number of names to keep
+/// probe sequences short.
+struct KeyChordNameIndex
+{
+  static constexpr size_t SLOTS = 512;
+  uint8_t slots[SLOTS];
+};
+
+static_assert(
+  KEY_CHORD_NAMES_LENGTH * 2 <= KeyChordNameIndex::SLOTS,
+  "Key chord name index is too small for the number of key names");
+
+constexpr char key_chord_to_lower(char c)
+{
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+/// \brief Case insensitive FNV-1a hash of the key name.
+constexpr uint32_t key_chord_name_hash(const char * name, size_t length)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<uint8_t>(key_chord_to_lower(name[i]));
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+constexpr size_t key_chord_str_length(const char * str)
+{
+  size_t length = 0;
+  while (str[length] != '\0') {
+    length++;
+  }
+  return length;
+}
+
+/// \brief Case insensitive comparison of the part of the spec with lower case name.
+constexpr bool key_chord_name_equals(const char * lower_name, const char * str, size_t length)
+{
+  for (size_t i = 0; i < length; i++) {
+    if (lower_name[i] == '\0' || lower_name[i] != key_chord_to_lower(str[i])) {
+      return false;
+    }
+  }
+  return lower_name[length] == '\0';
+}
+
+constexpr KeyChordNameIndex make_key_chord_name_index()
+{
+  KeyChordNameIndex index{};
+  for (size_t i = 0; i < KEY_CHORD_NAMES_LENGTH; i++) {
+    const char * name = KEY_CHORD_NAMES[i].name;
+    size_t slot = key_chord_name_hash(name, key_chord_str_length(name)) &
+      (KeyChordNameIndex::SLOTS - 1);
+    while (index.slots[slot] != 0) {
+      slot = (slot + 1) & (KeyChordNameIndex::SLOTS - 1);
+    }
+    index.slots[slot] = static_cast<uint8_t>(i + 1);
+  }
+  return index;
+}
+
+/// \brief Hash index of KEY_CHORD_NAMES.
+constexpr KeyChordNameIndex KEY_CHORD_NAME_INDEX = make_key_chord_name_index();
+
+/// \brief Find key code by the case insensitive key name.
+/// \return KeyCode::UNKNOWN if name isn't present in KEY_CHORD_NAMES.
+constexpr KeyboardHandlerBase::KeyCode find_key_chord_key_code(const char * name, size_t length)
+{
+  size_t slot = key_chord_name_hash(name, length) & (KeyChordNameIndex::SLOTS - 1);
+  while (KEY_CHORD_NAME_INDEX.slots[slot] != 0) {
+    const KeyChordName & entry = KEY_CHORD_NAMES[KEY_CHORD_NAME_INDEX.slots[slot] - 1];
+    if (key_chord_name_equals(entry.name, name, length)) {
+      return entry.key_code;
+    }
+    slot = (slot + 1) & (KeyChordNameIndex::SLOTS - 1);
+  }
+  return KeyboardHandlerBase::KeyCode::UNKNOWN;
+}
+
+/// \brief Find key modifier by the case insensitive modifier name.
+/// \return KeyModifiers::NONE if name isn't a modifier name.
+constexpr KeyboardHandlerBase::KeyModifiers find_key_chord_modifier(
+  const char * name, size_t length)
+{
+  using KeyModifiers = KeyboardHandlerBase::KeyModifiers;
+  return key_chord_name_equals("ctrl", name, length) ? KeyModifiers::CTRL :
+         key_chord_name_equals("control", name, length) ? KeyModifiers::CTRL :
+         key_chord_name_equals("shift", name, length) ? KeyModifiers::SHIFT :
+         key_chord_name_equals("alt", name, length) ? KeyModifiers::ALT :
+         KeyModifiers::NONE;
+}
+
+/// \brief Result of the key chord spec parsing.
+struct KeyChordParseResult
+{
+  KeyChord key_chord;
+  /// Description of the error or nullptr if spec is valid.
+  const char * error;
+};
+
+/// \brief Parse key chord spec without throwing.
+/// \param spec Key chord spec, doesn't need to be null terminated.
+/// \param length Length of the spec.
+constexpr KeyChordParseResult parse_key_chord_spec(const char * spec, size_t length)
+{
+  uint32_t key_modifiers = 0;
+  size_t begin = 0;
+  while (true) {
+    if (begin == length) {
+      return {KeyChord(), "Key chord spec doesn't contain key name"};
+    }
+    // Separator right at the beginning of the token is the '+' key itself, e.g. "ctrl++"
+    size_t end = begin + 1;
+    while (end < length && spec[end] != '+') {
+      end++;
+    }
+    if (end == length) {
+      break;
+    }
+    auto modifier = static_cast<uint32_t>(find_key_chord_modifier(spec + begin, end - begin));
+    if (modifier == 0) {
+      return {KeyChord(), "Unknown modifier in the key chord spec"};
+    }
+    if ((key_modifiers & modifier) != 0) {
+      return {KeyChord(), "Duplicate modifier in the key chord spec"};
+    }
+    key_modifiers |= modifier;
+    begin = end + 1;
+  }
+  auto key_code = find_key_chord_key_code(spec + begin, length - begin);
+  if (key_code == KeyboardHandlerBase::KeyCode::UNKNOWN) {
+    return {KeyChord(), "Unknown key name in the key chord spec"};
+  }
+  return {KeyChord(key_code, static_cast<KeyboardHandlerBase::KeyModifiers>(key_modifiers)),
+    nullptr};
+}
+
+/// \brief Parse key chord spec.
+/// \details Invalid spec fails to compile when evaluated at compile time.
+/// \throw std::invalid_argument if spec is invalid.
+constexpr KeyChord parse_key_chord(const char * spec, size_t length)
+{
+  KeyChordParseResult result = parse_key_chord_spec(spec, length);
+  if (result.error != nullptr) {
+    KEYBOARD_HANDLER_THROW(std::invalid_argument(result.error));
+  }
+  return result.key_chord;
+}
+
+/// \brief Parse key chord spec at runtime, e.g. from the configuration file.
+/// \throw std::invalid_argument with the spec in the message if spec is invalid.
+inline KeyChord parse_key_chord(const std::string & spec)
+{
+  KeyChordParseResult result = parse_key_chord_spec(spec.data(), spec.size());
+  if (result.error != nullptr) {
+    KEYBOARD_HANDLER_THROW(std::invalid_argument(std::string(result.error) + ": '" + spec + "'"));
+  }
+  return result.key_chord;
+}
+
+/// \brief Parse key chord spec at runtime without throwing.
+/// \param[out] key_chord Parsed key chord, not changed if spec is invalid.
+/// \return false if spec is invalid.
+inline bool try_parse_key_chord(const std::string & spec, KeyChord & key_chord) noexcept
+{
+  KeyChordParseResult result = parse_key_chord_spec(spec.data(), spec.size());
+  if (result.error != nullptr) {
+    return false;
+  }
+  key_chord = result.key_chord;
+  return true;
+}
+
+/// \brief Key chord literal, e.g. `"ctrl+shift+f5"_chord`.
+/// \details Invalid spec fails to compile when literal is used in constant expression, e.g. to
+/// initialize constexpr variable or as template argument. Use KEYBOARD_HANDLER_KEY_CHORD to
+/// force compile time check in any context.
+constexpr KeyChord operator""_chord(const char * spec, size_t length)
+{
+  return parse_key_chord(spec, length);
+}
+
+/// \brief Key chord parsed from the string literal at compile time in any context.
+/// Invalid spec fails to compile.
+#define KEYBOARD_HANDLER_KEY_CHORD(spec) \
+  (KeyChord::from_value( \
+    std::integral_constant<uint64_t, parse_key_chord(spec, sizeof(spec) - 1).value()>::value))
+
+#endif  // KEYBOARD_HANDLER__KEY_CHORD_HPP_
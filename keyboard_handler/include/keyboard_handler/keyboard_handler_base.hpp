@@ -15,14 +15,24 @@
 #ifndef KEYBOARD_HANDLER__KEYBOARD_HANDLER_BASE_HPP_
 #define KEYBOARD_HANDLER__KEYBOARD_HANDLER_BASE_HPP_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <memory>
 #include <unordered_map>
 #include <mutex>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "keyboard_handler/bounded_queue.hpp"
+#include "keyboard_handler/clock.hpp"
+#include "keyboard_handler/error.hpp"
+#include "keyboard_handler/log_sink.hpp"
+#include "keyboard_handler/timer_wheel.hpp"
 #include "keyboard_handler/visibility_control.hpp"
 
-// #define PRINT_DEBUG_INFO
-
 class KeyboardHandlerBase
 {
 public:
@@ -40,15 +50,126 @@ public:
     CTRL  = 1 << 2
   };
 
+  /// \brief Type of the key event.
+  /// \details Terminals with legacy encoding report only key presses, auto repeat is reported as
+  /// a sequence of key presses. Repeat and release are reported only by the terminals with
+  /// enabled kitty keyboard protocol and by KeyboardHandlerEvdevImpl. Values of the PRESS, REPEAT
+  /// and RELEASE match event types of the kitty keyboard protocol.
+  enum class KeyEventType : uint32_t
+  {
+    PRESS = 1,
+    REPEAT = 2,
+    RELEASE = 3,
+    /// Key is held longer than the long press threshold. Reported once per press by
+    /// KeyboardHandlerEvdevImpl.
+    LONG_PRESS = 4
+  };
+
   /// \brief Type for callback functions
   using callback_t = std::function<void (KeyCode, KeyModifiers)>;
   using callback_handle_t = uint64_t;
 
+  /// \brief Type for callback functions receiving all types of the key events.
+  using key_event_callback_t = std::function<void (KeyCode, KeyModifiers, KeyEventType)>;
+
+  /// \brief Type for callback functions which could consume the key press.
+  /// \details Returns true to consume the key press, i.e. to skip remaining callbacks with the
+  /// same or lower priority.
+  using consuming_callback_t = std::function<bool (KeyCode, KeyModifiers)>;
+
+  /// \brief Type for input filter functions
+  /// \details Input filter is called once for each key press before the key press will be
+  /// dispatched to the registered callbacks. Filter could modify key code and key modifiers in
+  /// place and shall return false to drop the key press.
+  using input_filter_t = std::function<bool (KeyCode &, KeyModifiers &)>;
+
+  /// \brief Key press stored in the event queue.
+  struct KeyEvent
+  {
+    KeyCode key_code;
+    KeyModifiers key_modifiers;
+    /// Time point when key press was received by the keyboard handler, read from its clock.
+    std::chrono::steady_clock::time_point timestamp;
+    KeyEventType event_type;
+  };
+
   /// \brief Callback handle returning from add_key_press_callback and using as an argument for
   /// the delete_key_press_callback
   KEYBOARD_HANDLER_PUBLIC
   static constexpr callback_handle_t invalid_handle = 0;
 
+  /// \brief Statistics of the single worker shard of the sharded dispatch.
+  struct DispatchShardStats
+  {
+    /// Number of key presses waiting in the shard's queue.
+    size_t queue_depth;
+    /// Maximum number of key presses observed in the shard's queue.
+    size_t max_queue_depth;
+    /// Number of key presses dispatched to the callbacks by the shard.
+    uint64_t number_of_dispatched_key_presses;
+    /// Number of times keyboard handler's thread waited for space in the full shard's queue.
+    uint64_t number_of_stalls;
+  };
+
+  /// \brief Report about the callback which exceeded its deadline.
+  struct SlowCallbackInfo
+  {
+    /// Handle of the slow callback.
+    callback_handle_t handle;
+    KeyCode key_code;
+    KeyModifiers key_modifiers;
+    /// Time elapsed since the start of the callback call when overrun was detected.
+    std::chrono::nanoseconds elapsed;
+    /// Deadline which was exceeded.
+    std::chrono::nanoseconds deadline;
+  };
+
+  /// \brief Accumulated cost of the single callback.
+  struct BindingStats
+  {
+    callback_handle_t handle;
+    KeyCode key_code;
+    KeyModifiers key_modifiers;
+    uint64_t number_of_calls;
+    /// CPU time consumed by the dispatching thread during the callback calls.
+    std::chrono::nanoseconds total_cpu_time;
+    std::chrono::nanoseconds max_cpu_time;
+    std::chrono::nanoseconds total_wall_time;
+    std::chrono::nanoseconds max_wall_time;
+  };
+
+  /// \brief Settings of the binding which is called while key is held.
+  struct HoldSettings
+  {
+    /// \brief Constructor with default settings: single call after 1 s hold.
+    /// \details Defined out of the class to let settings be used as a default argument in the
+    /// enclosing class.
+    KEYBOARD_HANDLER_PUBLIC
+    HoldSettings();
+
+    /// Duration of the hold before the first call.
+    std::chrono::milliseconds hold_duration{1000};
+    /// Interval between the following calls while key is held. Zero means single call.
+    std::chrono::milliseconds repeat_interval{0};
+    /// Each interval is the previous one multiplied by this factor, values below 1 accelerate
+    /// calls.
+    double repeat_acceleration = 1.0;
+    /// Lower bound for the accelerated interval.
+    std::chrono::milliseconds min_repeat_interval{1};
+    /// Key is considered released if neither press nor repeat arrived within timeout. Intended
+    /// for input sources which don't report release, e.g. terminal in legacy encoding reports
+    /// auto repeat as presses. Zero disables timeout.
+    std::chrono::milliseconds release_timeout{0};
+  };
+
+  /// \brief Type for the function which receives reports about slow callbacks.
+  /// \details Called from the watchdog thread while slow callback is still running. Shall not
+  /// block and shall not add or delete key press callbacks.
+  using slow_callback_handler_t = std::function<void (const SlowCallbackInfo &)>;
+
+  KEYBOARD_HANDLER_PUBLIC
+  virtual ~KeyboardHandlerBase();
+
   /// \brief Adding callable object as a handler for specified key press combination.
   /// \param callback Callable which will be called when key_code will be recognized.
   /// \param key_code Value from enum which corresponds to some predefined key press combination.
@@ -63,18 +184,418 @@ public:
     KeyboardHandlerBase::KeyCode key_code,
     KeyboardHandlerBase::KeyModifiers key_modifiers = KeyboardHandlerBase::KeyModifiers::NONE);
 
+  /// \brief Adding callable object bound to the lifetime of the owner as a handler for specified
+  /// key press combination.
+  /// \details Callback will be skipped once owner expired and will be lazily removed from the
+  /// keyboard handler callback's list. Owner is kept alive during the callback call.
+  /// \param owner Weak pointer to the object which owns callback.
+  /// \param callback Callable which will be called when key_code will be recognized.
+  /// \param key_code Value from enum which corresponds to some predefined key press combination.
+  /// \param key_modifiers Value from enum which corresponds to the key modifiers pressed along
+  /// side with key.
+  /// \return Return Newly created callback handle if callback was successfully added to the
+  /// keyboard handler, returns invalid_handle if callback is nullptr, owner already expired or
+  /// keyboard handler wasn't successfully initialized.
+  KEYBOARD_HANDLER_PUBLIC
+  callback_handle_t add_key_press_callback(
+    const std::weak_ptr<void> & owner,
+    const callback_t & callback,
+    KeyboardHandlerBase::KeyCode key_code,
+    KeyboardHandlerBase::KeyModifiers key_modifiers = KeyboardHandlerBase::KeyModifiers::NONE);
+
+  /// \brief Adding owner's member function as a handler for specified key press combination.
+  /// \details Owner is held by weak pointer. Callback will be skipped once owner expired and will
+  /// be lazily removed from the keyboard handler callback's list.
+  /// \param owner Shared pointer to the object which member function will be called.
+  /// \param method Pointer to the owner's member function.
+  /// \param key_code Value from enum which corresponds to some predefined key press combination.
+  /// \param key_modifiers Value from enum which corresponds to the key modifiers pressed along
+  /// side with key.
+  /// \return Return Newly created callback handle or invalid_handle in case of failure.
+  template<typename OwnerT>
+  callback_handle_t add_key_press_callback(
+    const std::shared_ptr<OwnerT> & owner,
+    void (OwnerT::* method)(KeyCode, KeyModifiers),
+    KeyboardHandlerBase::KeyCode key_code,
+    KeyboardHandlerBase::KeyModifiers key_modifiers = KeyboardHandlerBase::KeyModifiers::NONE)
+  {
+    if (owner == nullptr || method == nullptr) {
+      return invalid_handle;
+    }
+    // Raw pointer is safe here since owner will be locked by dispatcher during the callback call.
+    OwnerT * owner_raw_ptr = owner.get();
+    auto callback = [owner_raw_ptr, method](KeyCode key_code, KeyModifiers key_modifiers) {
+        (owner_raw_ptr->*method)(key_code, key_modifiers);
+      };
+    return add_key_press_callback(std::weak_ptr<void>(owner), callback, key_code, key_modifiers);
+  }
+
+  /// \brief Adding callable object as a handler for all types of the key events of the specified
+  /// key press combination, e.g. press, repeat and release.
+  /// \details Callbacks added with #add_key_press_callback are called for press and repeat
+  /// events only.
+  /// \param callback Callable which will be called for each key event.
+  /// \param key_code Value from enum which corresponds to some predefined key press combination.
+  /// \param key_modifiers Value from enum which corresponds to the key modifiers pressed along
+  /// side with key.
+  /// \return Return Newly created callback handle if callback was successfully added to the
+  /// keyboard handler, returns invalid_handle if callback is nullptr or keyboard handler wasn't
+  /// successfully initialized.
+  KEYBOARD_HANDLER_PUBLIC
+  callback_handle_t add_key_event_callback(
+    const key_event_callback_t & callback,
+    KeyboardHandlerBase::KeyCode key_code,
+    KeyboardHandlerBase::KeyModifiers key_modifiers = KeyboardHandlerBase::KeyModifiers::NONE);
+
+  /// \brief Adding callable object which could consume the key press as a handler for specified
+  /// key press combination.
+  /// \details Callbacks are called in order of their priority set by #set_callback_priority.
+  /// Once callback returns true the key press is consumed and remaining callbacks aren't called.
+  /// Called for press and repeat events, same as callbacks added with #add_key_press_callback.
+  /// \param callback Callable which will be called when key_code will be recognized.
+  /// \param key_code Value from enum which corresponds to some predefined key press combination.
+  /// \param key_modifiers Value from enum which corresponds to the key modifiers pressed along
+  /// side with key.
+  /// \return Return Newly created callback handle if callback was successfully added to the
+  /// keyboard handler, returns invalid_handle if callback is nullptr or keyboard handler wasn't
+  /// successfully initialized.
+  KEYBOARD_HANDLER_PUBLIC
+  callback_handle_t add_consuming_key_press_callback(
+    const consuming_callback_t & callback,
+    KeyboardHandlerBase::KeyCode key_code,
+    KeyboardHandlerBase::KeyModifiers key_modifiers = KeyboardHandlerBase::KeyModifiers::NONE);
+
+  /// \brief Set priority of the callback among the callbacks for the same key press combination.
+  /// \details Callbacks with higher priority are called first, callbacks with equal priority are
+  /// called in order of registration. Order is computed here rather than on each key press.
+  /// Default priority is 0.
+  /// \param handle Callback's handle returned from #add_key_press_callback
+  /// \param priority Priority of the callback, could be negative.
+  /// \return false if there is no callback with specified handle.
+  KEYBOARD_HANDLER_PUBLIC
+  bool set_callback_priority(callback_handle_t handle, int priority);
+
+  /// \brief Adding callable object as a handler for the hold of the specified key press
+  /// combination.
+  /// \details Callback is called when key is held for HoldSettings::hold_duration and then
+  /// periodically with accelerating rate until release if HoldSettings::repeat_interval is set.
+  /// Hold starts with press and ends with release, hence input source shall report release, e.g.
+  /// terminal with kitty keyboard protocol or KeyboardHandlerEvdevImpl, or
+  /// HoldSettings::release_timeout shall be set. Calls are scheduled on the timer wheel of the
+  /// keyboard handler and made from the keyboard handler's thread.
+  /// \param callback Callable which will be called while key is held.
+  /// \param settings Hold duration and repeat rate.
+  /// \param key_code Value from enum which corresponds to some predefined key press combination.
+  /// \param key_modifiers Value from enum which corresponds to the key modifiers pressed along
+  /// side with key.
+  /// \return Return Newly created callback handle if callback was successfully added to the
+  /// keyboard handler, returns invalid_handle if callback is nullptr, hold duration is negative or
+  /// keyboard handler wasn't successfully initialized.
+  KEYBOARD_HANDLER_PUBLIC
+  callback_handle_t add_key_hold_callback(
+    const callback_t & callback,
+    const HoldSettings & settings,
+    KeyboardHandlerBase::KeyCode key_code,
+    KeyboardHandlerBase::KeyModifiers key_modifiers = KeyboardHandlerBase::KeyModifiers::NONE);
+
   /// \brief Delete callback from keyboard handler callback's list
+  /// \details With sharded dispatch waits for the calls of the callback in progress on the
+  /// worker threads, except the call from which it's deleted, so callback isn't running anymore
+  /// when function returns. Blocks for as long as such a call runs, warning is logged if it
+  /// takes longer than a second. Shall not be called while holding a lock which the callback
+  /// could wait for, including from the destructor of ScopedKeyBinding.
   /// \param handle Callback's handle returned from #add_key_press_callback
   KEYBOARD_HANDLER_PUBLIC
   void delete_key_press_callback(const callback_handle_t & handle) noexcept;
 
+  /// \brief Adding input filter to the end of the pre-dispatch pipeline.
+  /// \details Filters are applied in the order of registration. Compile time composed pipeline
+  /// could be created with `make_input_pipeline()` from input_pipeline.hpp and registered as a
+  /// single filter.
+  /// \param filter Callable which will be called for each key press before dispatching it to
+  /// the callbacks.
+  /// \return Return Newly created handle if filter was successfully added to the keyboard
+  /// handler, returns invalid_handle if filter is nullptr or keyboard handler wasn't successfully
+  /// initialized.
+  KEYBOARD_HANDLER_PUBLIC
+  callback_handle_t add_input_filter(const input_filter_t & filter);
+
+  /// \brief Delete input filter from the pre-dispatch pipeline
+  /// \param handle Filter's handle returned from #add_input_filter
+  KEYBOARD_HANDLER_PUBLIC
+  void delete_input_filter(const callback_handle_t & handle) noexcept;
+
+  /// \brief Set table of the bindings known at compile time.
+  /// \details Table is consulted for each key press and repeat passed through the input filters
+  /// before the callbacks added at runtime, which are still called. Table is called from the
+  /// keyboard handler's thread without callbacks mutex even with sharded dispatch and isn't
+  /// covered by the slow callback watchdog and binding stats. Replaces previously set table
+  /// starting from the next key press, previous table is released by the keyboard handler's
+  /// thread.
+  /// \param static_bindings Table created with make_static_bindings() from
+  /// static_bindings.hpp or any callable with `bool (KeyCode, KeyModifiers)` signature returning
+  /// true if key press was handled.
+  /// \return false if keyboard handler wasn't successfully initialized.
+  template<typename StaticBindingsT>
+  bool set_static_bindings(StaticBindingsT static_bindings)
+  {
+    auto bindings = std::make_shared<StaticBindingsT>(std::move(static_bindings));
+    // Single indirect call per key press, table lookup is inlined into the trampoline
+    static_dispatch_fn_t dispatch_fn = [](void * bindings, KeyCode key_code,
+        KeyModifiers key_modifiers) -> bool {
+        return (*static_cast<StaticBindingsT *>(bindings))(key_code, key_modifiers);
+      };
+    return set_static_dispatcher(std::move(bindings), dispatch_fn);
+  }
+
+  /// \brief Remove table of the bindings set by #set_static_bindings.
+  /// \details Table isn't called for the following key presses. It's released by the keyboard
+  /// handler's thread on the next key press or on destruction of the keyboard handler.
+  KEYBOARD_HANDLER_PUBLIC
+  void clear_static_bindings();
+
+  /// \brief Enable pull-based delivery of the key presses.
+  /// \details After this call each key press passed through the input filters will be pushed to
+  /// the lock-free bounded queue in addition to calling the registered callbacks. Key presses
+  /// could be taken from the queue with #try_pop_event, #wait_pop_event and #pop_events from any
+  /// thread. When queue is full new key presses are dropped and counted. Queue could be enabled
+  /// only once per keyboard handler instance and can't be resized afterwards. Queued key press
+  /// doesn't count as handled, so with PassthroughMode::UNHANDLED it's still forwarded to the
+  /// passthrough pipe unless some callback handled it.
+  /// \param capacity Maximum number of events in the queue. Will be rounded up to the power of two.
+  /// \return true if queue was successfully enabled, false if queue was already enabled or
+  /// keyboard handler wasn't successfully initialized.
+  KEYBOARD_HANDLER_PUBLIC
+  bool enable_event_queue(size_t capacity = 256);
+
+  /// \brief Take the oldest key press from the event queue without blocking.
+  /// \param[out] event Key press taken from the queue. Untouched if queue is empty.
+  /// \return true if event was taken, false if queue is empty or wasn't enabled.
+  KEYBOARD_HANDLER_PUBLIC
+  bool try_pop_event(KeyEvent & event) noexcept;
+
+  /// \brief Take the oldest key press from the event queue waiting for it up to the timeout.
+  /// \param[out] event Key press taken from the queue. Untouched if no event arrived.
+  /// \param timeout Maximum time to wait for the key press.
+  /// \return true if event was taken, false on timeout or if queue wasn't enabled.
+  KEYBOARD_HANDLER_PUBLIC
+  bool wait_pop_event(KeyEvent & event, std::chrono::nanoseconds timeout);
+
+  /// \brief Take up to max_events oldest key presses from the event queue without blocking.
+  /// \param[out] events Pointer to the caller's buffer with space for at least max_events.
+  /// \param max_events Size of the caller's buffer.
+  /// \return Number of events written to the buffer.
+  KEYBOARD_HANDLER_PUBLIC
+  size_t pop_events(KeyEvent * events, size_t max_events) noexcept;
+
+  /// \brief Get number of key presses dropped because event queue was full.
+  KEYBOARD_HANDLER_PUBLIC
+  uint64_t get_number_of_dropped_events() const;
+
+  /// \brief Dispatch key presses to the callbacks from the pool of worker threads.
+  /// \details Each key press combination is hashed to one of the worker shards. Key presses for
+  /// the same combination are dispatched in order by the same worker, callbacks for different
+  /// combinations could run in parallel. Keyboard handler's thread still runs input filters and
+  /// fills event queue and hands key press over to the worker via the lock-free queue. When
+  /// shard's queue is full keyboard handler's thread waits for space. Workers read callbacks
+  /// from the immutable snapshot of the dispatch lists republished on each change of callbacks,
+  /// so they call callbacks without internal mutex and without copying them. Callbacks could be
+  /// deleted concurrently with the call, #delete_key_press_callback waits for it to return.
+  /// Sharded dispatch could be enabled only once and stays enabled until destruction.
+  /// \param number_of_shards Number of worker threads.
+  /// \param queue_capacity Capacity of each shard's queue. Rounded up to the power of two.
+  /// \return true if sharded dispatch was enabled, false if it was already enabled,
+  /// number_of_shards is 0 or keyboard handler wasn't successfully initialized.
+  KEYBOARD_HANDLER_PUBLIC
+  bool enable_sharded_dispatch(size_t number_of_shards, size_t queue_capacity = 256);
+
+  /// \brief Get index of the worker shard which dispatches specified key press combination.
+  /// \return Shard index or 0 if sharded dispatch isn't enabled.
+  KEYBOARD_HANDLER_PUBLIC
+  size_t get_dispatch_shard(KeyCode key_code, KeyModifiers key_modifiers) const;
+
+  /// \brief Get statistics of the worker shards.
+  /// \return Statistics for each shard or empty vector if sharded dispatch isn't enabled.
+  KEYBOARD_HANDLER_PUBLIC
+  std::vector<DispatchShardStats> get_dispatch_shard_stats() const;
+
+  /// \brief Set deadline for all callbacks which don't have their own deadline.
+  /// \details Deadlines are monitored by the watchdog thread which is started on the first call
+  /// with non zero deadline. Dispatching thread publishes start time of each callback call, the
+  /// watchdog periodically checks it and reports callback which runs longer than its deadline
+  /// once per call, even if callback never returns. Overrun is logged with LogSeverity::WARN,
+  /// counted and passed to the handler set by #set_slow_callback_handler. Watchdog period is a
+  /// quarter of the shortest deadline, but not less than 1 ms and not more than 100 ms.
+  /// \param deadline Maximum duration of the callback call. Zero disables default deadline.
+  KEYBOARD_HANDLER_PUBLIC
+  void set_default_callback_deadline(std::chrono::nanoseconds deadline);
+
+  /// \brief Set deadline for the single callback overriding the default deadline.
+  /// \param handle Callback's handle returned from #add_key_press_callback
+  /// \param deadline Maximum duration of the callback call. Zero falls back to the default one.
+  /// \return false if there is no callback with specified handle.
+  KEYBOARD_HANDLER_PUBLIC
+  bool set_callback_deadline(callback_handle_t handle, std::chrono::nanoseconds deadline);
+
+  /// \brief Set function which will receive reports about callbacks exceeding their deadlines.
+  /// \param handler Report handler. nullptr leaves only log message and counters.
+  KEYBOARD_HANDLER_PUBLIC
+  void set_slow_callback_handler(const slow_callback_handler_t & handler);
+
+  /// \brief Get number of callback calls which exceeded their deadlines.
+  KEYBOARD_HANDLER_PUBLIC
+  uint64_t get_number_of_slow_callbacks() const;
+
+  /// \brief Get number of calls of the specified callback which exceeded its deadline.
+  /// \param handle Callback's handle returned from #add_key_press_callback
+  KEYBOARD_HANDLER_PUBLIC
+  uint64_t get_number_of_slow_callbacks(callback_handle_t handle) const;
+
+  /// \brief Enable or disable measuring of the callbacks' cost.
+  /// \details When enabled each callback call is measured with thread CPU time clock and steady
+  /// clock, number of calls, total and maximum durations are accumulated in the per-callback
+  /// counters. Disabled by default since it adds four clock reads to each callback call.
+  /// Accumulated values are kept when measuring is disabled.
+  KEYBOARD_HANDLER_PUBLIC
+  void enable_binding_stats(bool enable = true);
+
+  /// \brief Get snapshot of the accumulated cost of the registered callbacks.
+  /// \return Statistics of the callbacks sorted by total CPU time in descending order. Empty if
+  /// measuring was never enabled.
+  KEYBOARD_HANDLER_PUBLIC
+  std::vector<BindingStats> get_binding_stats() const;
+
+  /// \brief Set destination for diagnostic messages of all keyboard handler instances.
+  /// \details By default messages are written synchronously to the std::cerr. Use AsyncLogSink
+  /// to avoid stalling the reader thread on writes to the terminal.
+  /// \param sink New log sink. nullptr disables logging.
+  KEYBOARD_HANDLER_PUBLIC
+  static void set_log_sink(std::shared_ptr<LogSink> sink);
+
+  /// \brief Get current destination for diagnostic messages.
+  KEYBOARD_HANDLER_PUBLIC
+  static std::shared_ptr<LogSink> get_log_sink();
+
+  /// \brief Set minimum severity of the diagnostic messages which will be passed to the log sink.
+  /// \details LogSeverity::DEBUG enables tracing of each key press. Default is LogSeverity::INFO.
+  KEYBOARD_HANDLER_PUBLIC
+  static void set_log_severity(LogSeverity severity);
+
+  /// \brief Get minimum severity of the diagnostic messages which will be passed to the log sink.
+  KEYBOARD_HANDLER_PUBLIC
+  static LogSeverity get_log_severity();
+
+  /// \brief Get error which stopped the keyboard handler's thread.
+  /// \details Errors of the reader thread are reported without exceptions, description of the
+  /// error is logged with LogSeverity::ERR.
+  /// \return errno of the failed system call or empty error code while thread is running or if
+  /// it stopped without error.
+  KEYBOARD_HANDLER_PUBLIC
+  std::error_code get_reader_error() const;
+
 protected:
+  /// \brief Constructor
+  /// \param clock Source of the current time for the timers, input timeouts and event
+  /// timestamps. nullptr means SteadyClock.
+  KEYBOARD_HANDLER_PUBLIC
+  explicit KeyboardHandlerBase(std::shared_ptr<Clock> clock = nullptr);
+
+  /// \brief Check if messages with specified severity will be passed to the log sink.
+  /// \details Shall be used to avoid formatting of the messages which will be discarded.
+  static bool is_log_enabled(LogSeverity severity);
+
+  /// \brief Pass message to the current log sink.
+  static void log(LogSeverity severity, const std::string & message);
+
+  /// \brief Throw exception corresponding to the error of the initialization.
+  /// \details std::invalid_argument for std::errc::invalid_argument, std::runtime_error
+  /// otherwise. Aborts in the builds without exceptions.
+  [[noreturn]] KEYBOARD_HANDLER_PUBLIC
+  static void throw_init_error(const std::error_code & error, const std::string & message);
+
+  /// \brief Record error which stops the keyboard handler's thread and log its description.
+  /// \details Only the first error is kept. Shall be called from the keyboard handler's thread.
+  /// \param error_number errno of the failed system call.
+  void set_reader_error(int error_number, const std::string & message);
+
+  /// Per-callback counters of the binding stats.
+  struct BindingStatsSlot;
+
+  /// Calls of the callback in progress on the dispatch shards.
+  struct CallTracker;
+
   struct callback_data
   {
-    callback_handle_t handle;
+    callback_handle_t handle = invalid_handle;
     callback_t callback;
+    /// Set instead of callback for callbacks receiving all types of the key events.
+    key_event_callback_t event_callback;
+    std::weak_ptr<void> owner;
+    bool has_owner = false;
+    /// Deadline for the callback call. Zero means default deadline.
+    std::chrono::nanoseconds deadline{0};
+    /// Shared with the copies made by the dispatch shards. nullptr until binding stats enabled.
+    std::shared_ptr<BindingStatsSlot> stats;
+    /// Set instead of callback for callbacks which could consume the key press.
+    consuming_callback_t consuming_callback;
+    int priority = 0;
+    /// Shared with the copies in the dispatch snapshots. Set by #insert_callback.
+    std::shared_ptr<CallTracker> tracker;
+  };
+
+  struct input_filter_data
+  {
+    callback_handle_t handle;
+    input_filter_t filter;
   };
 
+  /// \brief Dispatch remaining key presses and stop workers of the sharded dispatch.
+  /// \details Shall be called by the derived class destructor after its thread was stopped, since
+  /// callbacks could refer to the derived class.
+  void stop_sharded_dispatch();
+
+  /// \brief Pass key press through the input filters and call corresponding callbacks.
+  /// \param key_code Key code recognized by the implementation specific input parser.
+  /// \param key_modifiers Key modifiers recognized by the implementation specific input parser.
+  /// \param event_type Type of the key event recognized by the input parser.
+  /// \return true if key press was consumed i.e. dropped by one of the input filters or handled
+  /// by at least one callback, otherwise false. Key press pushed to the event queue isn't
+  /// considered as consumed.
+  bool dispatch_key_press(
+    KeyCode key_code, KeyModifiers key_modifiers,
+    KeyEventType event_type = KeyEventType::PRESS);
+
+  /// \brief Schedule function call from the keyboard handler's thread.
+  /// \details Shared by all timing features. Could be called from any thread.
+  /// \return Timer identifier for #cancel_timer.
+  TimerWheel::timer_id_t schedule_timer(
+    Clock::time_point deadline, TimerWheel::callback_t callback);
+
+  /// \brief Cancel scheduled function call.
+  /// \return false if function was already called or timer doesn't exist.
+  bool cancel_timer(TimerWheel::timer_id_t timer_id);
+
+  /// \brief Call scheduled functions which are due.
+  /// \details Shall be called by the derived class from its thread on each iteration and not
+  /// later than #get_next_timer_deadline.
+  void process_timers();
+
+  /// \brief Get time point until which derived class could wait for input without processing
+  /// timers.
+  /// \return Time point or time_point::max() if no timers scheduled.
+  Clock::time_point get_next_timer_deadline() const;
+
+  /// \brief Called when scheduled timer became the earliest one to let derived class wake up its
+  /// thread waiting for input.
+  virtual void on_timer_scheduled() {}
+
+  /// \brief Check if callback shall be called for the key event of the specified type.
+  static bool is_callback_for_event(const callback_data & data, KeyEventType event_type)
+  {
+    return data.event_callback != nullptr || event_type == KeyEventType::PRESS ||
+           event_type == KeyEventType::REPEAT;
+  }
+
   struct KeyAndModifiers
   {
     KeyCode key_code;
@@ -103,12 +624,247 @@ protected:
     }
   };
 
+  /// Never nullptr. Declared before the timer wheel which starts at the clock's current time.
+  const std::shared_ptr<Clock> clock_;
   bool is_init_succeed_ = false;
-  std::mutex callbacks_mutex_;
+  /// errno of the error which stopped the keyboard handler's thread, 0 if none.
+  std::atomic<int> reader_errno_{0};
+  mutable std::mutex callbacks_mutex_;
   std::unordered_multimap<KeyAndModifiers, callback_data, key_and_modifiers_hash_fn> callbacks_;
+  /// Callbacks of each key press combination in order of calling. Points to the elements of the
+  /// callbacks_, which are never moved by the unordered container.
+  std::unordered_map<KeyAndModifiers, std::vector<callback_data *>, key_and_modifiers_hash_fn>
+  dispatch_lists_;
+  std::vector<input_filter_data> input_filters_;
 
 private:
   static callback_handle_t get_new_handle();
+
+  /// \brief Remove callbacks of the key press combination with expired owners. Shall be called
+  /// with locked callbacks_mutex_.
+  /// \param[out] erased Removed callbacks to be destroyed without callbacks_mutex_.
+  void prune_expired_callbacks(
+    const KeyAndModifiers & key_and_modifiers, std::vector<callback_data> & erased);
+
+  using static_dispatch_fn_t = bool (*)(void *, KeyCode, KeyModifiers);
+
+  /// \brief Take the table set by #set_static_bindings for the keyboard handler's thread.
+  void sync_static_bindings();
+
+  /// \brief Number of callbacks registered for the key code with any modifiers.
+  /// \return nullptr if key code is out of range of the KeyCode enum.
+  std::atomic<uint32_t> * get_callbacks_per_key_code(KeyCode key_code) const;
+
+  /// \brief Type erased part of the #set_static_bindings.
+  KEYBOARD_HANDLER_PUBLIC
+  bool set_static_dispatcher(
+    std::shared_ptr<void> static_bindings, static_dispatch_fn_t static_dispatch_fn);
+
+  /// \brief Register callback and put it to the dispatch list of its key press combination.
+  /// Shall be called with locked callbacks_mutex_.
+  /// \return Handle of the new callback.
+  callback_handle_t insert_callback(const KeyAndModifiers & key_and_modifiers, callback_data data);
+
+  /// \brief Remove callback from the dispatch list and unregister it. Shall be called with locked
+  /// callbacks_mutex_.
+  /// \return Removed callback, which shall be destroyed without callbacks_mutex_ since it could
+  /// own arbitrary objects.
+  callback_data erase_callback(
+    std::unordered_multimap<KeyAndModifiers, callback_data, key_and_modifiers_hash_fn>::iterator
+    it);
+
+  /// \brief Sort dispatch list by priority keeping registration order for equal priorities.
+  static void sort_dispatch_list(std::vector<callback_data *> & dispatch_list);
+
+  struct DispatchShard;
+
+  /// Immutable copy of the dispatch_lists_ read by the dispatch shards.
+  struct DispatchSnapshot;
+
+  /// \brief Publish new snapshot with the current dispatch list of the key press combination.
+  /// \details Does nothing until sharded dispatch is enabled. Shall be called with locked
+  /// callbacks_mutex_ after the list or one of its callbacks changed.
+  void publish_dispatch_list(const KeyAndModifiers & key_and_modifiers);
+
+  /// \brief Publish new snapshot with all dispatch lists. Shall be called with locked
+  /// callbacks_mutex_.
+  void publish_all_dispatch_lists();
+
+  /// \brief Callback call in progress on one of the dispatching threads, watched by the
+  /// watchdog.
+  /// \details Written only by the dispatching thread as a sequence lock. Low bits of call_id are
+  /// the state of the slot: call_id becomes WATCHDOG_SLOT_WRITING before fields are written and
+  /// WATCHDOG_SLOT_RUNNING once they are written and stay untouched until the callback returns.
+  /// Watchdog reads fields between two loads of call_id and discards them if call_id changed.
+  struct WatchdogSlot
+  {
+    /// State in the low bits and number of the call in the rest of them.
+    std::atomic<uint64_t> call_id{0};
+    std::atomic<callback_handle_t> handle{invalid_handle};
+    std::atomic<uint32_t> key_code{0};
+    std::atomic<uint32_t> key_modifiers{0};
+    std::atomic<int64_t> start_time_ns{0};
+    std::atomic<int64_t> deadline_ns{0};
+    /// Last reported call_id. Watchdog thread only.
+    uint64_t reported_call_id = 0;
+  };
+
+  /// \brief Call the callback if its owner is alive.
+  /// \param slot Slot of the dispatching thread where call is published for the watchdog.
+  /// \param[out] is_consumed Set to true if callback consumed the key press.
+  /// \param[out] owner Owner locked for the call. Caller shall release it without
+  /// callbacks_mutex_, since callback could drop the other references to it and its destructor
+  /// could delete callbacks, e.g. with ScopedKeyBinding.
+  /// \return false if callback wasn't called because its owner expired.
+  bool invoke_callback(
+    const callback_data & data, KeyCode key_code, KeyModifiers key_modifiers,
+    KeyEventType event_type, WatchdogSlot & slot, bool & is_consumed,
+    std::shared_ptr<void> & owner);
+
+  /// \brief Create data of the new callback without callback function.
+  /// \details Creates counters of the callback if binding stats are enabled.
+  callback_data make_callback_data() const;
+
+  /// \brief Call callback with the arguments matching its type.
+  /// \return true if callback consumed the key press.
+  static bool call_callback(
+    const callback_data & data, KeyCode key_code, KeyModifiers key_modifiers,
+    KeyEventType event_type);
+
+  /// \brief Start watchdog thread if needed and shorten its period for the new deadline.
+  void update_watchdog(std::chrono::nanoseconds deadline);
+
+  /// \brief Main loop of the watchdog thread.
+  void run_watchdog();
+
+  /// \brief Report callback published in the slot if it exceeded its deadline.
+  void check_watchdog_slot(WatchdogSlot & slot);
+
+  /// \brief Stop watchdog thread.
+  void stop_watchdog();
+
+  /// State of the hold binding shared between its key event callback and scheduled calls.
+  struct HoldState;
+
+  /// \brief Scheduled call of the hold binding. Schedules the next call if binding repeats.
+  void on_hold_timer(const std::weak_ptr<HoldState> & weak_state);
+
+  /// \brief End hold and cancel its scheduled calls. Shall be called with locked state mutex.
+  void release_hold(HoldState & state);
+
+  /// \brief Main loop of the sharded dispatch worker.
+  void run_dispatch_shard(DispatchShard & shard);
+
+  /// \brief Hand key press over to the shard's worker waiting for space in its queue if needed.
+  void push_to_dispatch_shard(const KeyAndModifiers & key_and_modifiers, KeyEventType event_type);
+
+  /// \brief Push key press to the event queue and wake up waiting consumers.
+  /// \return false if event queue isn't enabled.
+  bool push_event(KeyCode key_code, KeyModifiers key_modifiers, KeyEventType event_type);
+
+  /// Owners locked by the callbacks called under callbacks_mutex_, released after unlocking it.
+  /// Keyboard handler's thread only.
+  std::vector<std::shared_ptr<void>> locked_owners_;
+
+  std::unique_ptr<BoundedQueue<KeyEvent>> event_queue_;
+  /// Non owning pointer to the event_queue_ for lock-free access from the consumers.
+  std::atomic<BoundedQueue<KeyEvent> *> event_queue_ptr_{nullptr};
+  std::atomic<uint64_t> dropped_events_{0};
+  std::atomic<size_t> event_waiters_{0};
+  std::mutex event_mutex_;
+  std::condition_variable event_cv_;
+
+  /// shared_ptr since DispatchShard is incomplete here.
+  std::vector<std::shared_ptr<DispatchShard>> dispatch_shards_;
+  /// Published after dispatch_shards_ were created for lock-free access to them.
+  std::atomic<size_t> number_of_dispatch_shards_{0};
+  /// Guarded by callbacks_mutex_. Shards take it under the mutex only when generation changed.
+  std::shared_ptr<const DispatchSnapshot> dispatch_snapshot_;
+  std::atomic<uint64_t> dispatch_snapshot_generation_{0};
+
+  /// Slot for the callbacks called from the keyboard handler's thread.
+  WatchdogSlot watchdog_slot_;
+  std::atomic_bool is_watchdog_enabled_{false};
+  std::atomic<int64_t> default_deadline_ns_{0};
+  std::atomic<uint64_t> number_of_slow_callbacks_{0};
+  mutable std::mutex watchdog_mutex_;
+  std::condition_variable watchdog_cv_;
+  std::thread watchdog_thread_;
+  bool watchdog_exit_ = false;
+  std::chrono::nanoseconds watchdog_period_{std::chrono::milliseconds(100)};
+  slow_callback_handler_t slow_callback_handler_;
+  std::unordered_map<callback_handle_t, uint64_t> slow_callbacks_per_handle_;
+
+  std::atomic_bool is_binding_stats_enabled_{false};
+
+  /// Set by #set_static_bindings, guarded by callbacks_mutex_.
+  std::shared_ptr<void> static_bindings_;
+  static_dispatch_fn_t static_dispatch_fn_ = nullptr;
+  std::atomic_bool static_bindings_changed_{false};
+  /// Copy of the static_bindings_ used by the keyboard handler's thread without
+  /// callbacks_mutex_. Keyboard handler's thread only.
+  std::shared_ptr<void> active_static_bindings_;
+  static_dispatch_fn_t active_static_dispatch_fn_ = nullptr;
+
+  /// Number of callbacks per key code updated under callbacks_mutex_, lets dispatch skip the
+  /// mutex and lookup of the key presses which have no callbacks.
+  std::unique_ptr<std::atomic<uint32_t>[]> callbacks_per_key_code_;
+  std::atomic<size_t> number_of_input_filters_{0};
+
+  mutable std::mutex timers_mutex_;
+  TimerWheel timer_wheel_;
+  /// Size of the timer_wheel_ updated under timers_mutex_, lets keyboard handler's thread skip
+  /// the mutex while no timers scheduled.
+  std::atomic<size_t> number_of_timers_{0};
+  /// Callbacks of the expired timers. Keyboard handler's thread only.
+  std::vector<TimerWheel::callback_t> expired_timers_;
+};
+
+/// \brief RAII handle for the key press callback registered in keyboard handler.
+/// \details Deletes callback from the keyboard handler on destruction, which blocks while the
+/// callback runs on a dispatch shard, see KeyboardHandlerBase::delete_key_press_callback.
+/// Keyboard handler shall outlive the ScopedKeyBinding object.
+class ScopedKeyBinding
+{
+public:
+  ScopedKeyBinding() = default;
+
+  /// \brief Take ownership of the callback handle.
+  /// \param keyboard_handler Keyboard handler in which callback was registered.
+  /// \param handle Callback's handle returned from add_key_press_callback.
+  KEYBOARD_HANDLER_PUBLIC
+  ScopedKeyBinding(
+    KeyboardHandlerBase & keyboard_handler,
+    KeyboardHandlerBase::callback_handle_t handle) noexcept;
+
+  KEYBOARD_HANDLER_PUBLIC
+  ScopedKeyBinding(ScopedKeyBinding && other) noexcept;
+
+  KEYBOARD_HANDLER_PUBLIC
+  ScopedKeyBinding & operator=(ScopedKeyBinding && other) noexcept;
+
+  ScopedKeyBinding(const ScopedKeyBinding &) = delete;
+  ScopedKeyBinding & operator=(const ScopedKeyBinding &) = delete;
+
+  KEYBOARD_HANDLER_PUBLIC
+  ~ScopedKeyBinding();
+
+  /// \brief Delete owned callback from the keyboard handler.
+  KEYBOARD_HANDLER_PUBLIC
+  void reset() noexcept;
+
+  /// \brief Release ownership of the callback handle without deleting callback.
+  /// \return Callback handle or invalid_handle if nothing was owned.
+  KEYBOARD_HANDLER_PUBLIC
+  KeyboardHandlerBase::callback_handle_t release() noexcept;
+
+  /// \brief Get owned callback handle.
+  KEYBOARD_HANDLER_PUBLIC
+  KeyboardHandlerBase::callback_handle_t get() const noexcept;
+
+private:
+  KeyboardHandlerBase * keyboard_handler_ = nullptr;
+  KeyboardHandlerBase::callback_handle_t handle_ = KeyboardHandlerBase::invalid_handle;
 };
 
 enum class KeyboardHandlerBase::KeyCode: uint32_t
@@ -208,6 +964,8 @@ enum class KeyboardHandlerBase::KeyCode: uint32_t
   F10,
   F11,
   F12,
+  /// Distinguishable from CTRL + I only with kitty keyboard protocol enabled.
+  TAB,
   END_OF_KEY_CODE_ENUM
 };
 
@@ -336,6 +1094,7 @@ static const KeyCodeToStrMap ENUM_KEY_TO_STR_MAP[] {
   {KeyboardHandlerBase::KeyCode::F10, "F10"},
   {KeyboardHandlerBase::KeyCode::F11, "F11"},
   {KeyboardHandlerBase::KeyCode::F12, "F12"},
+  {KeyboardHandlerBase::KeyCode::TAB, "TAB"},
 };
 
 /// \brief Translate KeyCode enum value to it's string representation.
@@ -0,0 +1,209 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KEYBOARD_HANDLER__KEYBOARD_HANDLER_EVDEV_IMPL_HPP_
+#define KEYBOARD_HANDLER__KEYBOARD_HANDLER_EVDEV_IMPL_HPP_
+
+#ifdef __linux__
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "keyboard_handler/error.hpp"
+#include "keyboard_handler/visibility_control.hpp"
+#include "keyboard_handler_base.hpp"
+
+/// \brief Linux input subsystem (evdev) implementation of keyboard handler class.
+/// \details Reads `struct input_event` records from the input device, e.g.
+/// `/dev/input/event3`, or from the file or named pipe with recorded events. Doesn't depend on
+/// the terminal and works without controlling terminal, e.g. with USB keypad on a headless
+/// machine. Key codes are translated with US keyboard layout. Modifiers are tracked from the
+/// press and release of the SHIFT, CTRL and ALT keys. Reports PRESS, REPEAT and RELEASE events
+/// and LONG_PRESS when key is held longer than EvdevSettings::long_press_threshold. Callbacks
+/// added with #add_key_press_callback are called for press and repeat, callbacks added with
+/// #add_key_event_callback receive all event types.
+/// \note Design and implementation limitations:
+/// Key code for the shifted digits and punctuation is reported without SHIFT modifier, e.g.
+/// SHIFT + 1 is reported as EXCLAMATION_MARK, same as in the terminal.
+/// CAPS LOCK and NUM LOCK states are not tracked, keypad keys are always reported as digits.
+/// Reading from the input device requires read permission for it, usually membership in the
+/// `input` group.
+class KeyboardHandlerEvdevImpl : public KeyboardHandlerBase
+{
+public:
+  /// \brief Settings of the evdev keyboard handler.
+  struct EvdevSettings
+  {
+    /// \brief Constructor with default settings: 500 ms long press threshold, no grab.
+    /// \details Defined out of the class to let settings be used as a default argument in the
+    /// enclosing class.
+    KEYBOARD_HANDLER_PUBLIC
+    EvdevSettings();
+
+    /// Duration of the key hold after which LONG_PRESS is reported. Zero disables long press
+    /// detection.
+    std::chrono::milliseconds long_press_threshold{500};
+    /// Grab input device with EVIOCGRAB to prevent delivering its events to the other readers,
+    /// e.g. to the virtual console.
+    bool grab_device = false;
+  };
+
+  /// \brief Constructor
+  /// \param device_path Path to the input device or to the file or named pipe with recorded
+  /// `struct input_event` records. Reading stops at the end of the file or when the last writer
+  /// closes named pipe.
+  /// \param settings Long press detection and device grab settings.
+  /// \throw std::runtime_error if device couldn't be opened or grabbed. Aborts in the builds
+  /// without exceptions, use #create there.
+  KEYBOARD_HANDLER_PUBLIC
+  explicit KeyboardHandlerEvdevImpl(
+    const std::string & device_path, const EvdevSettings & settings = EvdevSettings());
+
+  /// \brief Create keyboard handler without throwing exceptions.
+  /// \details Intended for the builds without exceptions where constructor aborts on error, see
+  /// KEYBOARD_HANDLER_ENABLE_EXCEPTIONS CMake option. Description of the error is logged with
+  /// LogSeverity::ERR.
+  /// \param device_path Path to the input device or to the file or named pipe with recorded
+  /// `struct input_event` records.
+  /// \param settings Long press detection and device grab settings.
+  /// \return Keyboard handler or errno of the failed open() or ioctl().
+  KEYBOARD_HANDLER_PUBLIC
+  static KeyboardHandlerResult<KeyboardHandlerEvdevImpl> create(
+    const std::string & device_path, const EvdevSettings & settings = EvdevSettings());
+
+  /// \brief Destructor
+  KEYBOARD_HANDLER_PUBLIC
+  virtual ~KeyboardHandlerEvdevImpl();
+
+  /// \brief Translates evdev key code to the key code and key modifiers enum values.
+  /// \param scancode Key code from the `code` field of the EV_KEY input event, e.g. KEY_A.
+  /// \param key_modifiers Modifiers pressed at the moment of key press.
+  /// \return tuple key code and code modifiers mask. Key code is KeyCode::UNKNOWN if scancode
+  /// isn't present in the inner look up table.
+  KEYBOARD_HANDLER_PUBLIC
+  std::tuple<KeyCode, KeyModifiers> scancode_to_enums(
+    uint16_t scancode, KeyModifiers key_modifiers) const;
+
+  /// \brief Get modifiers which are currently held on the input device.
+  KEYBOARD_HANDLER_PUBLIC
+  KeyModifiers get_held_key_modifiers() const;
+
+protected:
+  /// \brief Constructor reporting errors with error code instead of exceptions.
+  /// \param[out] error errno of the failed open() or ioctl(). Empty on success.
+  /// \details Other parameters are the same as for the public constructor. Object shall be
+  /// destroyed right away if error is set.
+  KEYBOARD_HANDLER_PUBLIC
+  KeyboardHandlerEvdevImpl(
+    std::error_code & error, const std::string & device_path,
+    const EvdevSettings & settings = EvdevSettings());
+
+  /// \brief Data type for mapping evdev key code to the KeyCode enum values.
+  struct KeyMap
+  {
+    uint16_t scancode;
+    KeyCode inner_code;
+    /// Key code reported with SHIFT held. If differs from inner_code, reported without SHIFT
+    /// modifier.
+    KeyCode shifted_code;
+  };
+
+  /// \brief Default statically defined lookup table for US keyboard layout.
+  static const KeyMap DEFAULT_STATIC_KEY_MAP[];
+
+  /// \brief Length of DEFAULT_STATIC_KEY_MAP measured in number of elements.
+  static const size_t STATIC_KEY_MAP_LENGTH;
+
+private:
+  /// \brief Key which was pressed and not released yet.
+  struct HeldKey
+  {
+    uint16_t scancode;
+    /// Key code and modifiers at the moment of press. Repeat, long press and release are
+    /// reported with them even if modifiers were released earlier than the key.
+    KeyCode key_code;
+    KeyModifiers key_modifiers;
+    /// Timestamp of the press from the input event in microseconds.
+    int64_t event_time_us;
+    /// Long press scheduled on the timer wheel by the time when press was read out.
+    TimerWheel::timer_id_t long_press_timer_id;
+    bool is_long_press_reported;
+  };
+
+  /// \brief Open input device and start reader thread.
+  /// \param[out] error_message Description of the error.
+  /// \return Error code. Empty on success.
+  std::error_code init(const std::string & device_path, std::string & error_message);
+
+  /// \brief Read and dispatch input events until exit is requested, input ends or reading fails.
+  void read_loop();
+
+  /// \brief Decode single input event and dispatch it.
+  void process_event(uint16_t type, uint16_t code, int32_t value, int64_t event_time_us);
+
+  /// \brief Dispatch LONG_PRESS for the keys held longer than long press threshold by timestamps
+  /// of the input events.
+  /// \details Makes detection independent from the speed of reading recorded events. Timers
+  /// scheduled on press detect long press when device doesn't send any further events.
+  /// \param event_time_us Timestamp of the last read out input event.
+  void process_long_presses(int64_t event_time_us);
+
+  /// \brief Dispatch LONG_PRESS for the held key if it wasn't reported yet.
+  void report_long_press(HeldKey & held_key);
+
+  /// \brief Release held key and cancel its long press timer.
+  void erase_held_key(std::vector<HeldKey>::iterator held_key_it);
+
+  /// \brief Re-read key state from the device after kernel dropped events and release keys
+  /// which are not held anymore.
+  void resync_key_state();
+
+  /// \brief Bitmask of the modifier keys, left and right keys are tracked separately.
+  enum ModifierKey : uint32_t
+  {
+    LEFT_SHIFT = 1,
+    RIGHT_SHIFT = 1 << 1,
+    LEFT_CTRL = 1 << 2,
+    RIGHT_CTRL = 1 << 3,
+    LEFT_ALT = 1 << 4,
+    RIGHT_ALT = 1 << 5
+  };
+
+  /// \brief Get modifier key bit for the specified scancode or 0 if it isn't a modifier key.
+  static uint32_t get_modifier_key(uint16_t scancode);
+
+  /// \brief Translate bitmask of the held modifier keys to the KeyModifiers.
+  static KeyModifiers to_key_modifiers(uint32_t modifier_keys);
+
+  EvdevSettings settings_;
+  int fd_ = -1;
+  std::thread key_handler_thread_;
+  std::atomic_bool exit_{false};
+  std::exception_ptr thread_exception_ptr{nullptr};
+  std::unordered_map<uint16_t, KeyMap> key_codes_map_;
+  /// Bitmask of ModifierKey.
+  std::atomic<uint32_t> modifier_keys_{0};
+  /// Reader thread only.
+  std::vector<HeldKey> held_keys_;
+  /// Set after SYN_DROPPED until the next SYN_REPORT. Reader thread only.
+  bool is_dropping_events_ = false;
+};
+
+#endif  // #ifdef __linux__
+#endif  // KEYBOARD_HANDLER__KEYBOARD_HANDLER_EVDEV_IMPL_HPP_
@@ -17,12 +17,19 @@
 
 #ifndef _WIN32
 #include <termios.h>
+#include <unistd.h>
 #include <string>
 #include <unordered_map>
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <tuple>
 #include <stdexcept>
+#include <system_error>
+#include <vector>
+#include "keyboard_handler/error.hpp"
 #include "keyboard_handler/visibility_control.hpp"
 #include "keyboard_handler_base.hpp"
 
@@ -32,6 +39,8 @@
 /// Can't correctly detect CTRL, ALT, SHIFT modifiers with F1..F12 and other control keys.
 /// Instead of CTRL + SHIFT + key will be detected only CTRL + key.
 /// Some keys might be incorrectly detected with multiple key modifiers pressed at the same time.
+/// Most of these limitations don't apply in terminals supporting kitty keyboard protocol, see
+/// enable_kitty_keyboard_protocol().
 class KeyboardHandlerUnixImpl : public KeyboardHandlerBase
 {
 public:
@@ -39,21 +48,230 @@ public:
   using tcgetattrFunction = std::function<int (int, struct termios *)>;
   using tcsetattrFunction = std::function<int (int, int, const struct termios *)>;
   using readFunction = std::function<ssize_t(int, void *, size_t)>;
+  using tcgetpgrpFunction = std::function<pid_t(int)>;
   using signal_handler_type = void (*)(int);
 
+  /// \brief Type for callback function receiving raw sequence of characters which wasn't
+  /// recognized by input parser.
+  /// \details Pointer to the data valid only during the callback call.
+  using unknown_sequence_callback_t = std::function<void (
+        const char * data, size_t length, std::chrono::steady_clock::time_point timestamp)>;
+
+  /// \brief Modes for sharing standard input with application.
+  enum class PassthroughMode : uint32_t
+  {
+    /// All input consumed by keyboard handler. Default mode.
+    OFF = 0,
+    /// Input which wasn't recognized or consumed by any of the callbacks forwarded to the
+    /// passthrough pipe. Key presses pushed to the event queue are forwarded as well.
+    UNHANDLED,
+    /// All input forwarded to the passthrough pipe as is without dispatching to the callbacks.
+    /// Echo is enabled in terminal while in this mode.
+    ALL
+  };
+
+  /// \brief Single step of the key macro.
+  struct MacroStep
+  {
+    KeyCode key_code;
+    KeyModifiers key_modifiers;
+    /// Delay before dispatching this step counted from the previous step.
+    std::chrono::milliseconds delay{0};
+  };
+
+  /// \brief Handle returning from add_macro and using as an argument for macro playback.
+  using macro_handle_t = uint64_t;
+
+  /// \brief Maximum number of macros which could be played back at the same time.
+  static constexpr size_t MAX_PLAYING_MACROS = 64;
+
+  /// \brief Flags of the kitty keyboard protocol progressive enhancement.
+  /// \details See https://sw.kovidgoyal.net/kitty/keyboard-protocol/
+  static constexpr uint32_t KITTY_DISAMBIGUATE_ESCAPE_CODES = 1;
+  static constexpr uint32_t KITTY_REPORT_EVENT_TYPES = 2;
+  static constexpr uint32_t KITTY_REPORT_ALTERNATE_KEYS = 4;
+  static constexpr uint32_t KITTY_REPORT_ALL_KEYS_AS_ESCAPE_CODES = 8;
+
+  /// \brief Mechanisms for waiting on input in the reader thread.
+  enum class ReaderBackend : uint32_t
+  {
+    /// Blocking read() which returns after 100 ms without input. Default.
+    BLOCKING_READ = 0,
+    /// poll() for readiness with 100 ms timeout followed by read() of available input.
+    POLL,
+    /// Non blocking read() in a loop without waiting for input. Lowest latency at the cost of
+    /// the fully loaded CPU core. Intended for the reader thread pinned to an isolated core, see
+    /// BusyPollSettings.
+    BUSY_POLL
+  };
+
+  /// \brief Settings of the ReaderBackend::BUSY_POLL.
+  struct BusyPollSettings
+  {
+    /// \brief Constructor with default settings: no pinning, pause hint, no backoff.
+    /// \details Defined out of the class to let settings be used as a default argument in the
+    /// enclosing class.
+    KEYBOARD_HANDLER_PUBLIC
+    BusyPollSettings();
+
+    /// Index of the CPU to pin the reader thread to. Negative value disables pinning.
+    int cpu = -1;
+    /// Execute CPU pause instruction between empty polls to save power and let sibling hyper
+    /// thread run.
+    bool use_pause_hint = true;
+    /// Number of empty polls after which reader starts to sleep between polls.
+    uint32_t polls_before_backoff = 10000;
+    /// Maximum sleep between empty polls. Sleep doubles from 1 us up to this value and is reset
+    /// by the next input. Zero disables backoff.
+    std::chrono::microseconds max_backoff{0};
+  };
+
+  /// \brief State of the terminal capability probe.
+  enum class TerminalProbeState : uint32_t
+  {
+    /// Probe was never requested.
+    NOT_STARTED = 0,
+    /// Queries are sent or about to be sent, replies are awaited.
+    PENDING,
+    /// Terminal replied to the primary device attributes query, which is the last one.
+    COMPLETED,
+    /// Terminal didn't reply in time, e.g. isn't a terminal or doesn't support the queries.
+    TIMED_OUT,
+    /// Queries couldn't be written to the terminal.
+    FAILED
+  };
+
+  /// \brief Capabilities reported by the terminal in replies to the probe queries.
+  struct TerminalCapabilities
+  {
+    TerminalProbeState state = TerminalProbeState::NOT_STARTED;
+    /// Terminal replied to the kitty keyboard protocol query `CSI ? u`.
+    bool supports_kitty_keyboard_protocol = false;
+    /// Active kitty keyboard protocol flags at the time of the probe or -1 if not supported.
+    int32_t kitty_keyboard_flags = -1;
+    /// Parameters of the primary device attributes reply `CSI ? 62 ; 22 c`: conformance level
+    /// followed by the supported extensions.
+    std::vector<uint32_t> device_attributes;
+    /// Name and version from the XTVERSION reply, e.g. "XTerm(388)". Empty if not reported.
+    std::string terminal_version;
+  };
+
+  /// \brief Callback called from the reader thread once terminal capability probe is over.
+  using terminal_probe_callback_t = std::function<void (const TerminalCapabilities &)>;
+
+  /// \brief Settings of the terminal capability probe.
+  struct TerminalProbeSettings
+  {
+    /// \brief Constructor with default settings: 500 ms timeout, no upgrade, no callback.
+    KEYBOARD_HANDLER_PUBLIC
+    TerminalProbeSettings();
+
+    /// Time to wait for the replies since the queries are sent.
+    std::chrono::milliseconds timeout{500};
+    /// Flags to enable with #enable_kitty_keyboard_protocol once terminal reports protocol
+    /// support. Zero keeps legacy encoding.
+    uint32_t kitty_keyboard_flags = 0;
+    /// Called when probe is completed, timed out or failed. Could be empty.
+    terminal_probe_callback_t callback;
+  };
+
+  /// \brief Reaction to the input flood detected by the reader thread.
+  enum class FloodMode : uint32_t
+  {
+    /// Flood is only detected and counted, all key events are dispatched.
+    OFF = 0,
+    /// Key events are dropped while input is a flood.
+    DROP,
+    /// Repeated key events of the same key press combination and event type are dispatched once
+    /// per flood window while input is a flood, e.g. from the stuck key.
+    COALESCE
+  };
+
+  /// \brief Limits of the work done by the reader thread per iteration and flood detection.
+  /// \details Budget is checked between chunks of input, so iteration could exceed it by one
+  /// chunk of at most READ_BUFFER_LENGTH bytes.
+  struct FloodProtectionSettings
+  {
+    /// \brief Constructor with default settings: 1024 bytes and 256 key events per iteration,
+    /// flood detection disabled.
+    KEYBOARD_HANDLER_PUBLIC
+    FloodProtectionSettings();
+
+    /// Maximum number of bytes of real and injected input decoded in one iteration of the reader
+    /// loop. Iteration which exhausted budget leaves the rest of the injected input for the next
+    /// iterations, but still reads stdin once, so continuous injection doesn't starve real input.
+    /// Zero means no limit.
+    size_t max_bytes_per_iteration = 1024;
+    /// Maximum number of key events decoded and injected in one iteration. Zero means no limit.
+    size_t max_events_per_iteration = 256;
+    /// Number of key events decoded from the input within flood_window after which input is
+    /// considered a flood. Flood ends after the window with no more events than threshold.
+    /// Key presses injected with #inject_key are not counted. Zero disables flood detection.
+    size_t flood_threshold = 0;
+    std::chrono::milliseconds flood_window{100};
+    FloodMode flood_mode = FloodMode::OFF;
+  };
+
+  /// \brief Counters of the flood protection.
+  struct FloodStats
+  {
+    /// Number of iterations of the reader loop which exhausted their budget.
+    uint64_t number_of_budget_yields = 0;
+    /// Number of detected floods.
+    uint64_t number_of_floods = 0;
+    uint64_t number_of_dropped_events = 0;
+    uint64_t number_of_coalesced_events = 0;
+    /// Input is considered a flood at the moment.
+    bool is_flooding = false;
+  };
+
   /// \brief Default constructor
   KEYBOARD_HANDLER_PUBLIC
   KeyboardHandlerUnixImpl();
 
   /// \brief Constructor with option to not install signal handler for SIGINT
   /// \param install_signal_handler if true signal handler for SIGINT will be installed,
-  /// otherwise not.
+  /// otherwise not. Also SIGTTIN will be ignored and handler for SIGCONT will be installed to
+  /// be able to detect when process moved to the background and back to the foreground.
   /// \note In case if install_signal_handler is false caller code should call static
   /// KeyboardHandlerUnixImpl::restore_buffer_mode_for_stdin() in case of process termination
   /// caused by signal arrival.
   KEYBOARD_HANDLER_PUBLIC
   explicit KeyboardHandlerUnixImpl(bool install_signal_handler);
 
+  /// \brief Constructor with option to select the mechanism for waiting on input.
+  /// \param install_signal_handler if true signal handlers will be installed, otherwise not.
+  /// \param reader_backend Mechanism for waiting on input in the reader thread.
+  KEYBOARD_HANDLER_PUBLIC
+  KeyboardHandlerUnixImpl(bool install_signal_handler, ReaderBackend reader_backend);
+
+  /// \brief Constructor for the ReaderBackend::BUSY_POLL.
+  /// \param install_signal_handler if true signal handlers will be installed, otherwise not.
+  /// \param busy_poll_settings CPU pinning and backoff of the busy polling reader thread.
+  KEYBOARD_HANDLER_PUBLIC
+  KeyboardHandlerUnixImpl(
+    bool install_signal_handler, const BusyPollSettings & busy_poll_settings);
+
+  /// \brief Create keyboard handler without throwing exceptions.
+  /// \details Intended for the builds without exceptions where constructors abort on error, see
+  /// KEYBOARD_HANDLER_ENABLE_EXCEPTIONS CMake option. Description of the error is logged with
+  /// LogSeverity::ERR.
+  /// \param install_signal_handler if true signal handlers will be installed, otherwise not.
+  /// \param reader_backend Mechanism for waiting on input in the reader thread.
+  /// \return Keyboard handler or errno of the failed system call.
+  KEYBOARD_HANDLER_PUBLIC
+  static KeyboardHandlerResult<KeyboardHandlerUnixImpl> create(
+    bool install_signal_handler = true,
+    ReaderBackend reader_backend = ReaderBackend::BLOCKING_READ);
+
+  /// \brief Create keyboard handler with ReaderBackend::BUSY_POLL without throwing exceptions.
+  /// \param install_signal_handler if true signal handlers will be installed, otherwise not.
+  /// \param busy_poll_settings CPU pinning and backoff of the busy polling reader thread.
+  /// \return Keyboard handler or errno of the failed system call.
+  KEYBOARD_HANDLER_PUBLIC
+  static KeyboardHandlerResult<KeyboardHandlerUnixImpl> create(
+    bool install_signal_handler, const BusyPollSettings & busy_poll_settings);
+
   /// \brief destructor
   KEYBOARD_HANDLER_PUBLIC
   virtual ~KeyboardHandlerUnixImpl();
@@ -72,6 +290,168 @@ public:
   KEYBOARD_HANDLER_PUBLIC
   static signal_handler_type get_old_sigint_handler();
 
+  /// \brief Set mode for sharing standard input with application.
+  /// \details Switching between modes doesn't recreate reader thread. Input forwarded to the
+  /// passthrough pipe could be read from the file descriptor returned by #get_passthrough_fd.
+  /// Pipe is non blocking on the writer side, input which doesn't fit into the pipe buffer will
+  /// be discarded.
+  /// \param mode New passthrough mode.
+  /// \return true if mode was successfully changed, otherwise false.
+  KEYBOARD_HANDLER_PUBLIC
+  bool set_passthrough_mode(PassthroughMode mode);
+
+  /// \brief Get current mode for sharing standard input with application.
+  KEYBOARD_HANDLER_PUBLIC
+  PassthroughMode get_passthrough_mode() const;
+
+  /// \brief Set fallback callback for sequences of characters which wasn't recognized by input
+  /// parser.
+  /// \details When fallback callback is set, unrecognized sequences will not be dispatched to the
+  /// callbacks registered for KeyCode::UNKNOWN.
+  /// \param callback Callable which will be called with raw undecoded sequence of characters.
+  /// nullptr resets fallback callback.
+  KEYBOARD_HANDLER_PUBLIC
+  void set_unknown_sequence_callback(const unknown_sequence_callback_t & callback);
+
+  /// \brief Set per-iteration budget of the reader thread and flood detection.
+  /// \details Applied by the reader thread at the beginning of its next iteration, flood
+  /// detector restarts with the new settings.
+  /// \return false if flood detection is enabled with non-positive flood window.
+  KEYBOARD_HANDLER_PUBLIC
+  bool set_flood_protection(const FloodProtectionSettings & settings);
+
+  /// \brief Get per-iteration budget of the reader thread and flood detection settings.
+  KEYBOARD_HANDLER_PUBLIC
+  FloodProtectionSettings get_flood_protection() const;
+
+  /// \brief Get counters of the flood protection.
+  KEYBOARD_HANDLER_PUBLIC
+  FloodStats get_flood_stats() const;
+
+  /// \brief Get file descriptor for reading input forwarded by keyboard handler.
+  /// \return Read end of the passthrough pipe or -1 if passthrough mode was never enabled.
+  KEYBOARD_HANDLER_PUBLIC
+  int get_passthrough_fd() const;
+
+  /// \brief Inject synthetic key press into the dispatch pipeline.
+  /// \details Key press is queued and dispatched from the keyboard handler's thread through the
+  /// input filters, event queue and callbacks in order with the real input and other injected
+  /// key presses. Could be called from any thread, including from the callbacks. Reader thread
+  /// checks queue before each read from stdin, with ReaderBackend::POLL it's woken up
+  /// immediately, otherwise injected key press could wait up to 100 ms for the pending read.
+  /// \param key_code Key code to inject.
+  /// \param key_modifiers Key modifiers to inject along side with key code.
+  /// \return true if key press was queued, false if queue is full or keyboard handler wasn't
+  /// successfully initialized.
+  KEYBOARD_HANDLER_PUBLIC
+  bool inject_key(KeyCode key_code, KeyModifiers key_modifiers = KeyModifiers::NONE);
+
+  /// \brief Inject raw sequence of characters as if it was read from stdin.
+  /// \details Bytes are decoded by the same input parser as real input and passed through the
+  /// passthrough and unknown sequence handling. Same ordering guarantees as for #inject_key.
+  /// Sequence longer than single read from stdin is split into chunks in the same way as read()
+  /// would split it.
+  /// \param data Pointer to the sequence of characters. Copied before return.
+  /// \param length Length of the sequence in bytes.
+  /// \return Number of injected bytes. Less than length if queue became full.
+  KEYBOARD_HANDLER_PUBLIC
+  size_t inject_bytes(const char * data, size_t length);
+
+  /// \brief Compile sequence of key presses into the macro.
+  /// \details Steps are compiled once into flat arrays of key codes, key modifiers and time
+  /// offsets from the start of the playback. Playback dispatches key presses directly through the
+  /// input filters, event queue and callbacks without re-running input parser.
+  /// \param steps Sequence of key presses with optional delays.
+  /// \return Newly created macro handle or invalid_handle if steps are empty or keyboard handler
+  /// wasn't successfully initialized.
+  KEYBOARD_HANDLER_PUBLIC
+  macro_handle_t add_macro(const std::vector<MacroStep> & steps);
+
+  /// \brief Delete macro and cancel all its playbacks.
+  /// \param handle Macro's handle returned from #add_macro
+  KEYBOARD_HANDLER_PUBLIC
+  void delete_macro(macro_handle_t handle);
+
+  /// \brief Start playback of the macro from the keyboard handler's thread.
+  /// \details Could be called from any thread, including from the callbacks. Steps without delay
+  /// are dispatched right away on the next iteration of the reader thread. Delays have 100 ms
+  /// resolution with ReaderBackend::BLOCKING_READ since steps are checked between reads,
+  /// ReaderBackend::POLL wakes up exactly for the next step.
+  /// \param handle Macro's handle returned from #add_macro
+  /// \return true if playback was started, false if macro doesn't exist or MAX_PLAYING_MACROS
+  /// are already playing.
+  KEYBOARD_HANDLER_PUBLIC
+  bool play_macro(macro_handle_t handle);
+
+  /// \brief Register macro playback as a handler for specified key press combination.
+  /// \return Callback handle which could be used for delete_key_press_callback or
+  /// invalid_handle in case of failure.
+  KEYBOARD_HANDLER_PUBLIC
+  callback_handle_t add_macro_binding(
+    macro_handle_t handle, KeyCode key_code, KeyModifiers key_modifiers = KeyModifiers::NONE);
+
+  /// \brief Cancel all ongoing playbacks of the macro. Steps which were not dispatched yet will
+  /// be skipped.
+  /// \param handle Macro's handle returned from #add_macro
+  KEYBOARD_HANDLER_PUBLIC
+  void cancel_macro(macro_handle_t handle);
+
+  /// \brief Cancel all ongoing macro playbacks.
+  KEYBOARD_HANDLER_PUBLIC
+  void cancel_all_macros();
+
+  /// \brief Get number of ongoing macro playbacks.
+  KEYBOARD_HANDLER_PUBLIC
+  size_t get_number_of_playing_macros() const;
+
+  /// \brief Enable kitty keyboard protocol in the terminal.
+  /// \details Pushes requested flags to the terminal's stack of keyboard modes with
+  /// `CSI > flags u` and queries active flags with `CSI ? u`. Terminals without protocol support
+  /// ignore both requests and keep legacy encoding. Input is decoded by the streaming parser which
+  /// splits it into separate sequences, decodes `CSI ... u` reports and modifiers and event types
+  /// of the functional keys, e.g. `CSI 1;5:3 A`. With KITTY_REPORT_EVENT_TYPES callbacks added
+  /// with #add_key_event_callback receive repeat and release events. TAB is distinguishable from
+  /// CTRL + I and ESCAPE from the start of the escape sequence. Previous keyboard mode is restored
+  /// with `CSI < u` by #disable_kitty_keyboard_protocol and on exit.
+  /// \param flags Bitmask of the KITTY_* flags.
+  /// \return false if flags is 0, keyboard handler wasn't successfully initialized or request
+  /// couldn't be written to the terminal.
+  KEYBOARD_HANDLER_PUBLIC
+  bool enable_kitty_keyboard_protocol(
+    uint32_t flags = KITTY_DISAMBIGUATE_ESCAPE_CODES | KITTY_REPORT_EVENT_TYPES);
+
+  /// \brief Restore keyboard mode which was active before #enable_kitty_keyboard_protocol.
+  /// \return false if kitty keyboard protocol wasn't enabled.
+  KEYBOARD_HANDLER_PUBLIC
+  bool disable_kitty_keyboard_protocol();
+
+  /// \brief Get kitty keyboard protocol flags reported by the terminal.
+  /// \return Active flags from the terminal's reply to the query or -1 if terminal hasn't
+  /// replied, e.g. because it doesn't support the protocol.
+  KEYBOARD_HANDLER_PUBLIC
+  int32_t get_kitty_keyboard_flags() const;
+
+  /// \brief Query terminal capabilities without blocking.
+  /// \details Reader thread sends kitty keyboard protocol query `CSI ? u`, XTVERSION query
+  /// `CSI > 0 q` and primary device attributes query `CSI c` to the terminal, which is in raw
+  /// mode already, and returns to reading input. Replies are decoded by the streaming parser
+  /// between key presses typed meanwhile, which are dispatched as usual. Every terminal replies
+  /// to the device attributes query and replies arrive in order of queries, so its reply
+  /// completes the probe. Probe times out if it doesn't arrive before deadline. Once terminal
+  /// reports kitty keyboard protocol support decoder is upgraded to the requested flags.
+  /// \return false if keyboard handler wasn't successfully initialized, probe is pending
+  /// already or timeout isn't positive.
+  KEYBOARD_HANDLER_PUBLIC
+  bool probe_terminal_capabilities(const TerminalProbeSettings & settings);
+
+  /// \brief Get capabilities reported by the terminal so far and state of the probe.
+  KEYBOARD_HANDLER_PUBLIC
+  TerminalCapabilities get_terminal_capabilities() const;
+
+  /// \brief Get mechanism used for waiting on input in the reader thread.
+  KEYBOARD_HANDLER_PUBLIC
+  ReaderBackend get_reader_backend() const;
+
 protected:
   /// \brief Constructor with references to the system functions. Required for unit tests.
   /// \param read_fn Reference to the system read(int, void *, size_t) function
@@ -79,13 +459,42 @@ protected:
   /// \param tcgetattr_fn Reference to the system tcgetattr(int, struct termios *) function
   /// \param tcsetattr_fn Reference to the system tcsetattr(int, int, const struct termios *)
   /// function
+  /// \param install_signal_handler if true signal handlers will be installed, otherwise not.
+  /// \param tcgetpgrp_fn Reference to the system tcgetpgrp(int) function
+  /// \param reader_backend Mechanism for waiting on input in the reader thread.
+  /// \param busy_poll_settings Settings used with ReaderBackend::BUSY_POLL.
+  /// \param clock Source of the current time for macros, hold bindings, input timeouts and event
+  /// timestamps, e.g. SimulatedClock. nullptr means SteadyClock. Reader thread is woken up each
+  /// time the clock is advanced.
+  KEYBOARD_HANDLER_PUBLIC
+  KeyboardHandlerUnixImpl(
+    const readFunction & read_fn,
+    const isattyFunction & isatty_fn,
+    const tcgetattrFunction & tcgetattr_fn,
+    const tcsetattrFunction & tcsetattr_fn,
+    bool install_signal_handler = true,
+    const tcgetpgrpFunction & tcgetpgrp_fn = tcgetpgrp,
+    ReaderBackend reader_backend = ReaderBackend::BLOCKING_READ,
+    const BusyPollSettings & busy_poll_settings = BusyPollSettings(),
+    std::shared_ptr<Clock> clock = nullptr);
+
+  /// \brief Constructor reporting errors with error code instead of exceptions.
+  /// \param[out] error std::errc::invalid_argument if one of the functions is empty, errno of
+  /// the failed system call otherwise. Empty on success.
+  /// \details Other parameters are the same as for the constructor above. Object shall be
+  /// destroyed right away if error is set.
   KEYBOARD_HANDLER_PUBLIC
   KeyboardHandlerUnixImpl(
+    std::error_code & error,
     const readFunction & read_fn,
     const isattyFunction & isatty_fn,
     const tcgetattrFunction & tcgetattr_fn,
     const tcsetattrFunction & tcsetattr_fn,
-    bool install_signal_handler = true);
+    bool install_signal_handler = true,
+    const tcgetpgrpFunction & tcgetpgrp_fn = tcgetpgrp,
+    ReaderBackend reader_backend = ReaderBackend::BLOCKING_READ,
+    const BusyPollSettings & busy_poll_settings = BusyPollSettings(),
+    std::shared_ptr<Clock> clock = nullptr);
 
   /// \brief Input parser
   /// \param buff null terminated buffer read out from std::in after key press
@@ -108,19 +517,274 @@ protected:
   /// \brief Length of DEFAULT_STATIC_KEY_MAP  measured in number of elements.
   static const size_t STATIC_KEY_MAP_LENGTH;
 
+  /// \brief Write control sequence to the terminal.
+  /// \return false if sequence couldn't be written.
+  KEYBOARD_HANDLER_PUBLIC
+  virtual bool write_to_terminal(const char * data, size_t length);
+
 private:
+  /// \brief Size of the buffer for single read from stdin including null terminator.
+  static constexpr size_t READ_BUFFER_LENGTH = 10;
+
+  /// \brief Maximum number of injected key presses and sequences waiting for the reader thread.
+  static constexpr size_t INJECTED_INPUT_CAPACITY = 1024;
+
+  /// \brief Maximum length of the incomplete sequence kept by the streaming parser.
+  static constexpr size_t MAX_PENDING_INPUT_LENGTH = 64;
+
+  /// \brief Number of iterations of ReaderBackend::BUSY_POLL between checks of the foreground
+  /// process group.
+  static constexpr uint32_t BUSY_POLL_FOREGROUND_CHECK_PERIOD = 1000;
+
+  /// \brief Key press or raw sequence of characters injected via #inject_key or #inject_bytes.
+  struct InjectedInput
+  {
+    KeyCode key_code;
+    KeyModifiers key_modifiers;
+    /// Number of raw bytes to decode. 0 for the already decoded key press.
+    uint8_t length;
+    char bytes[READ_BUFFER_LENGTH];
+  };
+
+  /// \brief Macro compiled into flat arrays. Step i is dispatched at offsets[i] from the start
+  /// of the playback.
+  struct CompiledMacro
+  {
+    std::vector<KeyCode> key_codes;
+    std::vector<KeyModifiers> key_modifiers;
+    std::vector<std::chrono::nanoseconds> offsets;
+  };
+
+  struct MacroPlayback
+  {
+    uint64_t playback_id;
+    macro_handle_t handle;
+    const CompiledMacro * macro;
+    std::chrono::steady_clock::time_point start_time;
+    size_t next_step;
+    /// Timer of the next step on the timer wheel.
+    TimerWheel::timer_id_t timer_id;
+  };
+
+  /// \brief Set up terminal, signal handlers and reader backend and start reader thread.
+  /// \param[out] error_message Description of the error.
+  /// \return Error code. Empty on success or if stdin is not a terminal.
+  std::error_code init(
+    const readFunction & read_fn,
+    const isattyFunction & isatty_fn,
+    const tcgetattrFunction & tcgetattr_fn,
+    const tcsetattrFunction & tcsetattr_fn,
+    bool install_signal_handler,
+    std::string & error_message);
+
+  /// \brief Read and dispatch input until exit is requested or reading fails.
+  void read_loop(const readFunction & read_fn);
+
   static void on_signal(int signal_number);
 
+  static void on_sigcont(int signal_number);
+
+  /// \brief Restore signal handlers which were replaced by #init if it installed them.
+  void restore_signal_handlers();
+
+  /// \brief Check if exit was requested by destructor or by SIGINT received since this instance
+  /// was initialized.
+  bool is_exit_requested() const;
+
+  /// \brief Check if process group is in the foreground of the controlling terminal.
+  /// \return true if process is in the foreground or if it couldn't be determined.
+  bool is_in_foreground() const;
+
+  /// \brief Check if the reader loop shall check foreground process group on this iteration.
+  /// \details ReaderBackend::BUSY_POLL checks it only once per
+  /// BUSY_POLL_FOREGROUND_CHECK_PERIOD iterations to not make system calls on each poll.
+  bool is_foreground_check_due();
+
+  /// \brief Sleep until process will be moved to the foreground or exit requested.
+  /// \details Processes timers and injected input while waiting.
+  void wait_for_foreground();
+
+  /// \brief Get terminal settings which shall be applied in specified passthrough mode.
+  struct termios get_term_settings(PassthroughMode mode) const;
+
+  /// \brief Decode sequence of characters read out from stdin and dispatch it.
+  void process_input(const char * buff, ssize_t read_bytes);
+
+  /// \brief Decode sequence of characters as a single key press in legacy encoding.
+  void process_legacy_input(const char * buff, ssize_t read_bytes);
+
+  /// \brief Dispatch decoded key event or pass its raw sequence to the fallbacks if it wasn't
+  /// recognized or consumed.
+  void process_key_event(
+    KeyCode key_code, KeyModifiers key_modifiers, KeyEventType event_type,
+    const char * buff, ssize_t read_bytes);
+
+  /// \brief Streaming parser for the input with enabled kitty keyboard protocol.
+  /// \details Appends input to the pending input and decodes all complete sequences in it.
+  void process_kitty_input(const char * buff, ssize_t read_bytes);
+
+  /// \brief Parser for the legacy input while terminal probe is pending.
+  /// \details Takes out replies to the probe and passes the bytes between them to the legacy
+  /// parser unchanged. Incomplete reply is kept in the pending input.
+  void process_probe_input(const char * buff, ssize_t read_bytes);
+
+  /// \brief Decode and dispatch single sequence from the pending input.
+  /// \param pos Position of the sequence in the pending input.
+  /// \return Length of the decoded sequence or 0 if sequence is incomplete.
+  size_t process_kitty_sequence(size_t pos);
+
+  /// \brief Decode and dispatch complete control sequence `CSI params final_byte`.
+  void process_csi_sequence(const char * seq, size_t length);
+
+  /// \brief Decode device control string `DCS ... ST`, e.g. XTVERSION reply.
+  void process_dcs_sequence(const char * seq, size_t length);
+
+  /// \brief Send terminal probe queries once requested and time out the pending probe.
+  void process_terminal_probe();
+
+  /// \brief Finish pending probe, upgrade decoder and notify callback.
+  void finish_terminal_probe(TerminalProbeState state);
+
+  /// \brief Decode incomplete sequence which waits for the rest of it longer than timeout in
+  /// legacy encoding, e.g. ESC key press from the terminal without kitty keyboard protocol.
+  void flush_pending_input();
+
+  /// \brief Restore keyboard mode which was active before kitty keyboard protocol was enabled.
+  /// \details Async signal safe.
+  static void pop_kitty_keyboard_mode();
+
+  void forward_to_passthrough(const char * buff, ssize_t read_bytes);
+
+  /// \brief Wait for the next chunk of input with selected reader backend.
+  /// \param read_fn Reference to the read function.
+  /// \param buff Buffer for the read bytes.
+  /// \param buff_len Size of the buff. One byte is reserved for the null terminator.
+  /// \return Number of read bytes, 0 on timeout or -1 with errno set on error.
+  ssize_t read_input(const readFunction & read_fn, char * buff, size_t buff_len);
+
+  /// \brief Reset budget of the iteration and apply new flood protection settings.
+  void begin_reader_iteration();
+
+  /// \brief Copy flood protection settings changed by #set_flood_protection and restart flood
+  /// detector.
+  void apply_flood_settings();
+
+  /// \brief Check if iteration of the reader loop used up its budget.
+  bool is_iteration_budget_exhausted() const;
+
+  /// \brief Count key event decoded from the input in the flood detector.
+  /// \return false if key event shall be dropped or coalesced.
+  bool admit_key_event(KeyCode key_code, KeyModifiers key_modifiers, KeyEventType event_type);
+
+  /// \brief Start new flood window if current one is over and end flood if it was quiet.
+  void update_flood_window(Clock::time_point now);
+
+  /// \brief Decode and dispatch injected input queued before this call.
+  void process_injected_input();
+
+  /// \brief Dispatch steps of the macro playback which are due and schedule the next step.
+  void process_macro_playback(uint64_t playback_id);
+
+  /// \brief Schedule the next step of the macro playback. Shall be called with locked
+  /// macros_mutex_.
+  void schedule_macro_step(MacroPlayback & playback);
+
+  /// \brief Cancel playbacks of the macro or all playbacks if handle is invalid_handle. Shall be
+  /// called with locked macros_mutex_.
+  void cancel_macro_playbacks(macro_handle_t handle);
+
+  /// \brief Wake up reader thread to shorten its wait for the new earliest timer.
+  void on_timer_scheduled() override;
+
+  /// \brief Interrupt waiting on input in the reader thread if backend supports it.
+  void wake_up_reader();
+
+  /// \brief Pin calling thread to the CPU from busy_poll_settings_ if requested.
+  void pin_reader_thread() const;
+
+  /// \brief Pause between empty polls of ReaderBackend::BUSY_POLL.
+  void busy_poll_backoff();
+
   static struct termios old_term_settings_;
   static tcsetattrFunction tcsetattr_fn_;
   static signal_handler_type old_sigint_handler_;
+  static signal_handler_type old_sigttin_handler_;
+  static signal_handler_type old_sigcont_handler_;
+  static std::atomic_bool sigcont_received_;
   bool install_signal_handler_ = false;
+  tcgetpgrpFunction tcgetpgrp_fn_;
 
   std::thread key_handler_thread_;
-  static std::atomic_bool exit_;
+  std::atomic_bool exit_{false};
+  /// Incremented by SIGINT handler, each instance exits once it changes after initialization.
+  static std::atomic<uint32_t> sigint_generation_;
+  uint32_t sigint_generation_at_init_ = 0;
   const int stdin_fd_;
   std::unordered_map<std::string, KeyCode> key_codes_map_;
   std::exception_ptr thread_exception_ptr{nullptr};
+  struct termios raw_term_settings_ = {};
+  /// Set by init() when started in the background, raw mode is applied by the reader thread.
+  bool is_raw_mode_deferred_ = false;
+  std::mutex passthrough_mutex_;
+  std::atomic<PassthroughMode> passthrough_mode_{PassthroughMode::OFF};
+  int passthrough_pipe_fds_[2] = {-1, -1};
+  std::atomic_bool has_unknown_sequence_callback_{false};
+  unknown_sequence_callback_t unknown_sequence_callback_;
+  ReaderBackend reader_backend_ = ReaderBackend::BLOCKING_READ;
+  BoundedQueue<InjectedInput> injected_input_{INJECTED_INPUT_CAPACITY};
+  /// Pipe for waking up reader thread waiting in poll(). Used only with ReaderBackend::POLL.
+  int wake_up_pipe_fds_[2] = {-1, -1};
+  Clock::advance_callback_handle_t clock_advance_callback_handle_ = 0;
+  std::atomic<uint32_t> kitty_keyboard_flags_{0};
+  std::atomic<int32_t> reported_kitty_keyboard_flags_{-1};
+  /// Set while kitty keyboard mode is pushed to the terminal's stack.
+  static std::atomic_bool kitty_keyboard_mode_pushed_;
+  std::atomic<TerminalProbeState> terminal_probe_state_{TerminalProbeState::NOT_STARTED};
+  /// Set by #probe_terminal_capabilities until reader thread sends the queries.
+  std::atomic_bool terminal_probe_requested_{false};
+  mutable std::mutex terminal_probe_mutex_;
+  TerminalProbeSettings terminal_probe_settings_;
+  TerminalCapabilities terminal_capabilities_;
+  /// Deadline of the pending probe. Reader thread only.
+  Clock::time_point terminal_probe_deadline_;
+  /// Incomplete sequence waiting for the rest of it. Reader thread only.
+  std::string pending_input_;
+  std::chrono::steady_clock::time_point pending_input_time_;
+  BusyPollSettings busy_poll_settings_;
+  /// Number of empty polls since the last input. Reader thread only.
+  uint32_t number_of_empty_polls_ = 0;
+  std::chrono::microseconds busy_poll_sleep_{0};
+  /// Number of iterations since the last check of the foreground process group. Reader thread
+  /// only.
+  uint32_t polls_since_foreground_check_ = 0;
+
+  mutable std::mutex flood_mutex_;
+  FloodProtectionSettings flood_settings_;
+  std::atomic_bool flood_settings_changed_{false};
+  /// Copy of the flood_settings_ used by the reader thread. Reader thread only.
+  FloodProtectionSettings active_flood_settings_;
+  /// Budget used by the current iteration of the reader loop. Reader thread only.
+  size_t iteration_bytes_ = 0;
+  size_t iteration_events_ = 0;
+  /// State of the flood detector. Reader thread only.
+  Clock::time_point flood_window_start_;
+  size_t flood_window_events_ = 0;
+  bool has_last_admitted_key_event_ = false;
+  KeyAndModifiers last_admitted_key_{KeyCode::UNKNOWN, KeyModifiers::NONE};
+  KeyEventType last_admitted_event_type_ = KeyEventType::PRESS;
+  std::atomic_bool is_flooding_{false};
+  std::atomic<uint64_t> number_of_budget_yields_{0};
+  std::atomic<uint64_t> number_of_floods_{0};
+  std::atomic<uint64_t> number_of_dropped_events_{0};
+  std::atomic<uint64_t> number_of_coalesced_events_{0};
+
+  mutable std::mutex macros_mutex_;
+  macro_handle_t last_macro_handle_ = 0;
+  std::unordered_map<macro_handle_t, CompiledMacro> macros_;
+  std::vector<MacroPlayback> macro_playbacks_;
+  uint64_t last_playback_id_ = 0;
+  /// Steps collected under macros_mutex_ and dispatched after it's released. Reader thread only.
+  std::vector<KeyAndModifiers> due_macro_steps_;
 };
 
 #endif  // #ifndef _WIN32
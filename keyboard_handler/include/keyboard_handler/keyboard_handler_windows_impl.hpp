@@ -19,7 +19,10 @@
 #include <thread>
 #include <unordered_map>
 #include <stdexcept>
+#include <string>
+#include <system_error>
 #include <tuple>
+#include "keyboard_handler/error.hpp"
 #include "keyboard_handler/visibility_control.hpp"
 #include "keyboard_handler_base.hpp"
 
@@ -76,6 +79,13 @@ public:
   KEYBOARD_HANDLER_PUBLIC
   KeyboardHandlerWindowsImpl();
 
+  /// \brief Create keyboard handler without throwing exceptions.
+  /// \details Intended for the builds without exceptions where constructors abort on error, see
+  /// KEYBOARD_HANDLER_ENABLE_EXCEPTIONS CMake option.
+  /// \return Keyboard handler or error code.
+  KEYBOARD_HANDLER_PUBLIC
+  static KeyboardHandlerResult<KeyboardHandlerWindowsImpl> create();
+
   /// \brief Destructor
   KEYBOARD_HANDLER_PUBLIC
   virtual ~KeyboardHandlerWindowsImpl();
@@ -108,6 +118,16 @@ protected:
     const kbhitFunction & kbhit_fn,
     const getchFunction & getch_fn);
 
+  /// \brief Constructor reporting errors with error code instead of exceptions.
+  /// \param[out] error std::errc::invalid_argument if one of the functions is empty. Empty on
+  /// success.
+  KEYBOARD_HANDLER_PUBLIC
+  KeyboardHandlerWindowsImpl(
+    std::error_code & error,
+    const isattyFunction & isatty_fn,
+    const kbhitFunction & kbhit_fn,
+    const getchFunction & getch_fn);
+
   /// \brief Specialized hash function for `unordered_map` with WinKeyCode keys
   struct win_key_code_hash_fn
   {
@@ -134,6 +154,15 @@ protected:
   static const size_t STATIC_KEY_MAP_LENGTH;
 
 private:
+  /// \brief Check system functions and start reader thread.
+  /// \param[out] error_message Description of the error.
+  /// \return Error code. Empty on success or if stdin is not a terminal.
+  std::error_code init(
+    const isattyFunction & isatty_fn,
+    const kbhitFunction & kbhit_fn,
+    const getchFunction & getch_fn,
+    std::string & error_message);
+
   std::thread key_handler_thread_;
   std::atomic_bool exit_;
   std::unordered_map<WinKeyCode, KeyCode, win_key_code_hash_fn> key_codes_map_;
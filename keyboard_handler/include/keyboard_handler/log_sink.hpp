@@ -0,0 +1,131 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KEYBOARD_HANDLER__LOG_SINK_HPP_
+#define KEYBOARD_HANDLER__LOG_SINK_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "keyboard_handler/bounded_queue.hpp"
+#include "keyboard_handler/visibility_control.hpp"
+
+/// \brief Severity levels for diagnostic messages of keyboard handler.
+enum class LogSeverity : uint8_t
+{
+  DEBUG = 0,
+  INFO,
+  WARN,
+  ERR
+};
+
+/// \brief Interface for the destination of diagnostic messages of keyboard handler.
+/// \details Could be called concurrently from the keyboard handler's reader thread and from the
+/// caller's threads.
+class LogSink
+{
+public:
+  KEYBOARD_HANDLER_PUBLIC
+  virtual ~LogSink() = default;
+
+  /// \brief Write message to the sink.
+  /// \param severity Severity of the message.
+  /// \param message Pointer to the message without trailing new line. Not null terminated.
+  /// Valid only during the call.
+  /// \param length Length of the message in bytes.
+  virtual void log(LogSeverity severity, const char * message, size_t length) noexcept = 0;
+};
+
+/// \brief Synchronous sink writing each message as a separate line to the output stream.
+/// \details Default sink writing to the std::cerr.
+class StreamLogSink : public LogSink
+{
+public:
+  KEYBOARD_HANDLER_PUBLIC
+  explicit StreamLogSink(std::ostream & stream = std::cerr);
+
+  KEYBOARD_HANDLER_PUBLIC
+  void log(LogSeverity severity, const char * message, size_t length) noexcept override;
+
+private:
+  void write(const char * message, size_t length);
+
+  std::mutex stream_mutex_;
+  std::ostream & stream_;
+};
+
+/// \brief Asynchronous sink which passes messages to the output sink from the background thread.
+/// \details Messages are copied to the preallocated lock-free ring buffer, caller never waits for
+/// the output. If ring buffer is full, message will be dropped and counted. Messages longer than
+/// MAX_MESSAGE_LENGTH will be truncated.
+class AsyncLogSink : public LogSink
+{
+public:
+  /// \brief Maximum length of the single message in bytes.
+  static constexpr size_t MAX_MESSAGE_LENGTH = 246;
+
+  /// \brief Constructor
+  /// \param output_sink Sink which will be called from the background thread.
+  /// \param capacity Number of messages in ring buffer. Will be rounded up to the power of two.
+  KEYBOARD_HANDLER_PUBLIC
+  explicit AsyncLogSink(
+    std::shared_ptr<LogSink> output_sink = std::make_shared<StreamLogSink>(),
+    size_t capacity = 1024);
+
+  /// \brief Destructor. Writes all pending messages to the output sink.
+  KEYBOARD_HANDLER_PUBLIC
+  ~AsyncLogSink() override;
+
+  AsyncLogSink(const AsyncLogSink &) = delete;
+  AsyncLogSink & operator=(const AsyncLogSink &) = delete;
+
+  KEYBOARD_HANDLER_PUBLIC
+  void log(LogSeverity severity, const char * message, size_t length) noexcept override;
+
+  /// \brief Block until all messages logged before this call will be written to the output sink.
+  KEYBOARD_HANDLER_PUBLIC
+  void flush();
+
+  /// \brief Get number of messages dropped because ring buffer was full.
+  KEYBOARD_HANDLER_PUBLIC
+  uint64_t get_number_of_dropped_messages() const;
+
+private:
+  struct Message
+  {
+    LogSeverity severity;
+    uint8_t length;
+    char text[MAX_MESSAGE_LENGTH];
+  };
+
+  /// \brief Pop next message from ring buffer and write it to the output sink.
+  /// \return false if ring buffer is empty.
+  bool write_next_message();
+
+  std::shared_ptr<LogSink> output_sink_;
+  BoundedQueue<Message> messages_;
+  std::atomic<size_t> written_messages_{0};
+  std::atomic<uint64_t> dropped_messages_{0};
+  std::atomic_bool writer_sleeping_{false};
+  std::atomic_bool exit_{false};
+  std::mutex writer_mutex_;
+  std::condition_variable writer_cv_;
+  std::thread writer_thread_;
+};
+
+#endif  // KEYBOARD_HANDLER__LOG_SINK_HPP_
@@ -0,0 +1,152 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KEYBOARD_HANDLER__STATIC_BINDINGS_HPP_
+#define KEYBOARD_HANDLER__STATIC_BINDINGS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include "keyboard_handler_base.hpp"
+
+/// \brief Combine key code and key modifiers to the single value for comparison.
+constexpr uint64_t make_static_binding_key(
+  KeyboardHandlerBase::KeyCode key_code, KeyboardHandlerBase::KeyModifiers key_modifiers)
+{
+  return (static_cast<uint64_t>(key_code) << 32) | static_cast<uint64_t>(key_modifiers);
+}
+
+/// \brief Handler bound to the key press combination known at compile time.
+/// \details Handler is a callable with `void (KeyCode, KeyModifiers)` signature.
+template<KeyboardHandlerBase::KeyCode KeyCodeV, KeyboardHandlerBase::KeyModifiers KeyModifiersV,
+  typename Handler>
+class StaticBinding
+{
+public:
+  static constexpr uint64_t key = make_static_binding_key(KeyCodeV, KeyModifiersV);
+
+  explicit StaticBinding(Handler handler)
+  : handler_(std::move(handler)) {}
+
+  void operator()()
+  {
+    handler_(KeyCodeV, KeyModifiersV);
+  }
+
+private:
+  Handler handler_;
+};
+
+/// \brief Check if key is bound by one of the bindings.
+template<typename ... Bindings>
+constexpr bool is_static_binding_key_bound(uint64_t key)
+{
+  // Trailing element for the empty list of bindings
+  const uint64_t keys[] = {Bindings::key ..., 0};
+  for (size_t i = 0; i < sizeof...(Bindings); i++) {
+    if (keys[i] == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// \brief Compile time composed table of the key bindings.
+/// \details Lookup is a chain of comparisons with the constants known at compile time, which is
+/// inlined and turned by the compiler to a jump table or binary search like a `switch`, without
+/// hashing and `std::function` calls. Binding the same key press combination twice fails to
+/// compile. Table could be registered in the keyboard handler with
+/// KeyboardHandlerBase::set_static_bindings() alongside the bindings added at runtime. Keyboard
+/// handler calls it through a single function pointer without callbacks mutex and skips the
+/// lookup of the runtime callbacks for key codes which have none.
+template<typename ... Bindings>
+class StaticBindingTable;
+
+/// \brief Empty table which doesn't handle any key press.
+template<>
+class StaticBindingTable<>
+{
+public:
+  static constexpr size_t size = 0;
+
+  bool operator()(KeyboardHandlerBase::KeyCode, KeyboardHandlerBase::KeyModifiers)
+  {
+    return false;
+  }
+
+  bool dispatch(uint64_t)
+  {
+    return false;
+  }
+};
+
+template<typename Binding, typename ... Rest>
+class StaticBindingTable<Binding, Rest...>
+{
+  static_assert(
+    !is_static_binding_key_bound<Rest...>(Binding::key),
+    "Key press combination is bound more than once in the static binding table");
+
+public:
+  static constexpr size_t size = 1 + sizeof...(Rest);
+
+  StaticBindingTable(Binding binding, Rest... rest)
+  : binding_(std::move(binding)), rest_(std::move(rest)...) {}
+
+  /// \brief Call handler bound to the key press combination.
+  /// \return false if key press combination isn't bound.
+  bool operator()(
+    KeyboardHandlerBase::KeyCode key_code, KeyboardHandlerBase::KeyModifiers key_modifiers)
+  {
+    return dispatch(make_static_binding_key(key_code, key_modifiers));
+  }
+
+  bool dispatch(uint64_t key)
+  {
+    if (key == Binding::key) {
+      binding_();
+      return true;
+    }
+    return rest_.dispatch(key);
+  }
+
+private:
+  Binding binding_;
+  StaticBindingTable<Rest...> rest_;
+};
+
+/// \brief Bind handler to the key press combination known at compile time.
+/// \param handler Callable with `void (KeyCode, KeyModifiers)` signature.
+template<KeyboardHandlerBase::KeyCode KeyCodeV,
+  KeyboardHandlerBase::KeyModifiers KeyModifiersV = KeyboardHandlerBase::KeyModifiers::NONE,
+  typename Handler>
+StaticBinding<KeyCodeV, KeyModifiersV, std::decay_t<Handler>> make_static_binding(
+  Handler && handler)
+{
+  return StaticBinding<KeyCodeV, KeyModifiersV, std::decay_t<Handler>>(
+    std::forward<Handler>(handler));
+}
+
+/// \brief Create compile time composed table from the list of bindings.
+/// \param bindings Bindings created with make_static_binding().
+/// \return StaticBindingTable object which could be registered via
+/// KeyboardHandlerBase::set_static_bindings().
+template<typename ... Bindings>
+StaticBindingTable<std::decay_t<Bindings>...> make_static_bindings(Bindings && ... bindings)
+{
+  return StaticBindingTable<std::decay_t<Bindings>...>(std::forward<Bindings>(bindings)...);
+}
+
+#endif  // KEYBOARD_HANDLER__STATIC_BINDINGS_HPP_
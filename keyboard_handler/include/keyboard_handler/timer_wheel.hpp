@@ -0,0 +1,328 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KEYBOARD_HANDLER__TIMER_WHEEL_HPP_
+#define KEYBOARD_HANDLER__TIMER_WHEEL_HPP_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/// \brief Hierarchical timer wheel.
+/// \details Timers are kept in LEVELS wheels of SLOTS slots each. Slot of the level L covers
+/// SLOTS^L ticks, timers from the slot of the upper level are moved to the lower level when the
+/// lowest level wraps around to it. Schedule and cancel are O(1), advancing is O(1) per elapsed
+/// tick plus O(1) per fired or moved timer. Timers which are due later than the range of the
+/// wheel are moved between levels until they fit. Timers never fire earlier than their deadline.
+/// Timers with the same deadline fire in order of scheduling.
+/// Not thread safe, owner shall serialize access.
+class TimerWheel
+{
+public:
+  using clock = std::chrono::steady_clock;
+  using callback_t = std::function<void ()>;
+  /// \brief Identifier of the scheduled timer. 0 is never used as identifier.
+  using timer_id_t = uint64_t;
+
+  static constexpr timer_id_t invalid_timer_id = 0;
+  static constexpr size_t LEVELS = 4;
+  static constexpr size_t SLOT_BITS = 6;
+  static constexpr size_t SLOTS = 1 << SLOT_BITS;
+
+  /// \brief Constructor
+  /// \param tick Resolution of the wheel.
+  /// \param start Time point corresponding to the tick 0.
+  explicit TimerWheel(
+    std::chrono::nanoseconds tick = std::chrono::milliseconds(1),
+    clock::time_point start = clock::now())
+  : tick_ns_(std::max<int64_t>(1, tick.count())), start_(start)
+  {
+    // Copy to not odr-use NIL, which has no out of class definition in header only class
+    heads_.fill(uint32_t{NIL});
+    tails_.fill(uint32_t{NIL});
+  }
+
+  /// \brief Schedule callback to be called by #advance at or after deadline.
+  /// \return Identifier for #cancel.
+  timer_id_t schedule(clock::time_point deadline, callback_t callback)
+  {
+    uint32_t index = 0;
+    if (free_head_ != NIL) {
+      index = free_head_;
+      free_head_ = nodes_[index].next;
+    } else {
+      index = static_cast<uint32_t>(nodes_.size());
+      nodes_.emplace_back();
+    }
+    Node & node = nodes_[index];
+    node.deadline_ns = std::max<int64_t>(0, to_ns(deadline));
+    node.callback = std::move(callback);
+    node.generation++;
+    place(index);
+    size_++;
+    return (static_cast<timer_id_t>(node.generation) << 32) | (index + 1);
+  }
+
+  /// \brief Cancel scheduled timer.
+  /// \return false if timer already fired, was cancelled or never existed.
+  bool cancel(timer_id_t timer_id)
+  {
+    uint32_t index = static_cast<uint32_t>(timer_id & 0xFFFFFFFF) - 1;
+    uint32_t generation = static_cast<uint32_t>(timer_id >> 32);
+    if (timer_id == invalid_timer_id || index >= nodes_.size() ||
+      nodes_[index].generation != generation || nodes_[index].slot == NIL)
+    {
+      return false;
+    }
+    unlink(index);
+    release(index);
+    size_--;
+    return true;
+  }
+
+  /// \brief Move timers which are due at the specified time point out of the wheel.
+  /// \details Callbacks are not called here to let caller call them without holding the lock
+  /// which protects the wheel, callbacks could schedule and cancel timers.
+  /// \param now Current time.
+  /// \param[out] expired Callbacks of the expired timers are appended in order of their ticks.
+  /// \return Number of expired timers.
+  size_t advance(clock::time_point now, std::vector<callback_t> & expired)
+  {
+    int64_t now_ns = to_ns(now);
+    if (now_ns < 0) {
+      return 0;
+    }
+    const size_t number_of_expired = expired.size();
+    fire(PENDING_SLOT, now_ns, expired);
+    const int64_t target = now_ns / tick_ns_;
+    while (current_tick_ < target) {
+      if (size_ == level_sizes_[LEVELS]) {
+        // Nothing to cascade or fire in the wheel
+        current_tick_ = target;
+        break;
+      }
+      if (level_sizes_[0] == 0) {
+        // Skip to the next wrap around of the lowest level where upper levels cascade
+        int64_t next_wrap = (current_tick_ | static_cast<int64_t>(SLOTS - 1)) + 1;
+        current_tick_ = std::min(next_wrap, target) - 1;
+      }
+      int64_t tick = current_tick_ + 1;
+      cascade(tick);
+      current_tick_ = tick;
+      // Only timers of the last tick could be not due yet, they are moved to the pending slot
+      fire(static_cast<size_t>(tick) & (SLOTS - 1), now_ns, expired);
+    }
+    return expired.size() - number_of_expired;
+  }
+
+  /// \brief Get time point of the next timer or of the next move of the timers between levels.
+  /// \details Waiting until returned time point and calling #advance never misses a timer.
+  /// \return Time point or time_point::max() if there are no timers.
+  clock::time_point get_next_deadline() const
+  {
+    if (size_ == 0) {
+      return clock::time_point::max();
+    }
+    int64_t next_ns = INT64_MAX;
+    for (uint32_t i = heads_[PENDING_SLOT]; i != NIL; i = nodes_[i].next) {
+      next_ns = std::min(next_ns, nodes_[i].deadline_ns);
+    }
+    for (size_t k = 1; k <= SLOTS && next_ns == INT64_MAX; k++) {
+      size_t slot = static_cast<size_t>(current_tick_ + static_cast<int64_t>(k)) & (SLOTS - 1);
+      for (uint32_t i = heads_[slot]; i != NIL; i = nodes_[i].next) {
+        next_ns = std::min(next_ns, nodes_[i].deadline_ns);
+      }
+    }
+    for (size_t level = 1; level < LEVELS; level++) {
+      if (level_sizes_[level] == 0) {
+        continue;
+      }
+      const size_t shift = level * SLOT_BITS;
+      int64_t position = current_tick_ >> shift;
+      for (size_t k = 1; k <= SLOTS; k++) {
+        size_t slot = static_cast<size_t>(position + static_cast<int64_t>(k)) & (SLOTS - 1);
+        if (heads_[level * SLOTS + slot] != NIL) {
+          next_ns = std::min(next_ns, ((position + static_cast<int64_t>(k)) << shift) * tick_ns_);
+          break;
+        }
+      }
+    }
+    return start_ + std::chrono::nanoseconds(next_ns);
+  }
+
+  /// \brief Get number of scheduled timers.
+  size_t size() const
+  {
+    return size_;
+  }
+
+private:
+  static constexpr uint32_t NIL = UINT32_MAX;
+  /// Slot for the timers which are due within the current tick. Checked on each advance.
+  static constexpr size_t PENDING_SLOT = LEVELS * SLOTS;
+
+  struct Node
+  {
+    int64_t deadline_ns = 0;
+    callback_t callback;
+    uint32_t prev = NIL;
+    uint32_t next = NIL;
+    /// Index of the slot in heads_ or NIL if node is free.
+    uint32_t slot = NIL;
+    /// Incremented on each reuse of the node to invalidate identifiers of the fired timers.
+    uint32_t generation = 0;
+  };
+
+  int64_t to_ns(clock::time_point time_point) const
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time_point - start_).count();
+  }
+
+  /// \brief Put node to the slot corresponding to its deadline relative to the current tick.
+  /// \details Uses the lowest level which slot for the deadline is cascaded or fired within the
+  /// next SLOTS slots of that level.
+  void place(uint32_t index)
+  {
+    Node & node = nodes_[index];
+    int64_t expiry_tick = node.deadline_ns / tick_ns_;
+    if (expiry_tick <= current_tick_) {
+      append(index, PENDING_SLOT);
+      return;
+    }
+    size_t level = 0;
+    while (level < LEVELS - 1 &&
+      (expiry_tick >> (level * SLOT_BITS)) - (current_tick_ >> (level * SLOT_BITS)) >
+      static_cast<int64_t>(SLOTS))
+    {
+      level++;
+    }
+    const size_t shift = level * SLOT_BITS;
+    int64_t position = expiry_tick >> shift;
+    if (position - (current_tick_ >> shift) > static_cast<int64_t>(SLOTS)) {
+      // Beyond the range of the wheel. Park in the farthest slot, deadline is re-checked when
+      // timer cascades from it.
+      position = (current_tick_ >> shift) + static_cast<int64_t>(SLOTS);
+    }
+    append(index, level * SLOTS + (static_cast<size_t>(position) & (SLOTS - 1)));
+  }
+
+  void append(uint32_t index, size_t slot)
+  {
+    Node & node = nodes_[index];
+    node.slot = static_cast<uint32_t>(slot);
+    node.next = NIL;
+    node.prev = tails_[slot];
+    if (tails_[slot] != NIL) {
+      nodes_[tails_[slot]].next = index;
+    } else {
+      heads_[slot] = index;
+    }
+    tails_[slot] = index;
+    level_sizes_[slot / SLOTS]++;
+  }
+
+  void unlink(uint32_t index)
+  {
+    Node & node = nodes_[index];
+    if (node.prev != NIL) {
+      nodes_[node.prev].next = node.next;
+    } else {
+      heads_[node.slot] = node.next;
+    }
+    if (node.next != NIL) {
+      nodes_[node.next].prev = node.prev;
+    } else {
+      tails_[node.slot] = node.prev;
+    }
+    level_sizes_[node.slot / SLOTS]--;
+    node.slot = NIL;
+  }
+
+  void release(uint32_t index)
+  {
+    Node & node = nodes_[index];
+    node.callback = nullptr;
+    node.prev = NIL;
+    node.next = free_head_;
+    free_head_ = index;
+  }
+
+  /// \brief Move timers of the upper levels which slots start at the tick to the lower levels.
+  void cascade(int64_t tick)
+  {
+    // Upper levels first to let their timers fall through to the lowest level in one pass
+    for (size_t level = LEVELS - 1; level > 0; level--) {
+      const size_t shift = level * SLOT_BITS;
+      if ((tick & ((int64_t{1} << shift) - 1)) != 0) {
+        continue;
+      }
+      size_t slot = level * SLOTS + (static_cast<size_t>(tick >> shift) & (SLOTS - 1));
+      // Detach whole slot since timers beyond the range of the wheel return to the same slot
+      uint32_t index = heads_[slot];
+      heads_[slot] = NIL;
+      tails_[slot] = NIL;
+      // Relative to the tick being processed to put timers of this tick to the lowest level
+      const int64_t current_tick = current_tick_;
+      current_tick_ = tick - 1;
+      while (index != NIL) {
+        uint32_t next = nodes_[index].next;
+        level_sizes_[level]--;
+        place(index);
+        index = next;
+      }
+      current_tick_ = current_tick;
+    }
+  }
+
+  /// \brief Move due timers of the slot to the expired, others to the pending slot.
+  void fire(size_t slot, int64_t now_ns, std::vector<callback_t> & expired)
+  {
+    // Detach whole slot since not due timers of the pending slot return to it
+    uint32_t index = heads_[slot];
+    heads_[slot] = NIL;
+    tails_[slot] = NIL;
+    while (index != NIL) {
+      uint32_t next = nodes_[index].next;
+      level_sizes_[slot / SLOTS]--;
+      nodes_[index].slot = NIL;
+      if (nodes_[index].deadline_ns <= now_ns) {
+        expired.push_back(std::move(nodes_[index].callback));
+        release(index);
+        size_--;
+      } else {
+        append(index, PENDING_SLOT);
+      }
+      index = next;
+    }
+  }
+
+  const int64_t tick_ns_;
+  const clock::time_point start_;
+  /// Last fully processed tick.
+  int64_t current_tick_ = -1;
+  size_t size_ = 0;
+  /// Number of timers in each level and in the pending slot.
+  std::array<size_t, LEVELS + 1> level_sizes_{};
+  std::array<uint32_t, LEVELS * SLOTS + 1> heads_;
+  std::array<uint32_t, LEVELS * SLOTS + 1> tails_;
+  std::vector<Node> nodes_;
+  uint32_t free_head_ = NIL;
+};
+
+#endif  // KEYBOARD_HANDLER__TIMER_WHEEL_HPP_
@@ -0,0 +1,127 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef __linux__
+#include <linux/input-event-codes.h>
+#include "keyboard_handler/keyboard_handler_evdev_impl.hpp"
+
+/// Evdev key codes correspond to the physical keys and don't depend on the keyboard layout
+/// selected in the desktop environment. Translation below follows US keyboard layout.
+/// See https://www.kernel.org/doc/html/latest/input/event-codes.html
+
+//* *INDENT-OFF* */
+const KeyboardHandlerEvdevImpl::KeyMap KeyboardHandlerEvdevImpl::DEFAULT_STATIC_KEY_MAP[] = {
+  {KEY_ESC,        KeyCode::ESCAPE,               KeyCode::ESCAPE},
+  {KEY_1,          KeyCode::NUMBER_1,             KeyCode::EXCLAMATION_MARK},
+  {KEY_2,          KeyCode::NUMBER_2,             KeyCode::AT},
+  {KEY_3,          KeyCode::NUMBER_3,             KeyCode::HASHTAG_SIGN},
+  {KEY_4,          KeyCode::NUMBER_4,             KeyCode::DOLLAR_SIGN},
+  {KEY_5,          KeyCode::NUMBER_5,             KeyCode::PERCENT_SIGN},
+  {KEY_6,          KeyCode::NUMBER_6,             KeyCode::CARET},
+  {KEY_7,          KeyCode::NUMBER_7,             KeyCode::AMPERSAND},
+  {KEY_8,          KeyCode::NUMBER_8,             KeyCode::STAR},
+  {KEY_9,          KeyCode::NUMBER_9,             KeyCode::OPENING_PARENTHESIS},
+  {KEY_0,          KeyCode::NUMBER_0,             KeyCode::CLOSING_PARENTHESIS},
+  {KEY_MINUS,      KeyCode::MINUS,                KeyCode::UNDERSCORE_SIGN},
+  {KEY_EQUAL,      KeyCode::EQUAL_SIGN,           KeyCode::PLUS},
+  {KEY_BACKSPACE,  KeyCode::BACK_SPACE,           KeyCode::BACK_SPACE},
+  {KEY_TAB,        KeyCode::TAB,                  KeyCode::TAB},
+  {KEY_Q,          KeyCode::Q,                    KeyCode::Q},
+  {KEY_W,          KeyCode::W,                    KeyCode::W},
+  {KEY_E,          KeyCode::E,                    KeyCode::E},
+  {KEY_R,          KeyCode::R,                    KeyCode::R},
+  {KEY_T,          KeyCode::T,                    KeyCode::T},
+  {KEY_Y,          KeyCode::Y,                    KeyCode::Y},
+  {KEY_U,          KeyCode::U,                    KeyCode::U},
+  {KEY_I,          KeyCode::I,                    KeyCode::I},
+  {KEY_O,          KeyCode::O,                    KeyCode::O},
+  {KEY_P,          KeyCode::P,                    KeyCode::P},
+  {KEY_LEFTBRACE,  KeyCode::LEFT_SQUARE_BRACKET,  KeyCode::LEFT_CURLY_BRACKET},
+  {KEY_RIGHTBRACE, KeyCode::RIGHT_SQUARE_BRACKET, KeyCode::RIGHT_CURLY_BRACKET},
+  {KEY_ENTER,      KeyCode::ENTER,                KeyCode::ENTER},
+  {KEY_A,          KeyCode::A,                    KeyCode::A},
+  {KEY_S,          KeyCode::S,                    KeyCode::S},
+  {KEY_D,          KeyCode::D,                    KeyCode::D},
+  {KEY_F,          KeyCode::F,                    KeyCode::F},
+  {KEY_G,          KeyCode::G,                    KeyCode::G},
+  {KEY_H,          KeyCode::H,                    KeyCode::H},
+  {KEY_J,          KeyCode::J,                    KeyCode::J},
+  {KEY_K,          KeyCode::K,                    KeyCode::K},
+  {KEY_L,          KeyCode::L,                    KeyCode::L},
+  {KEY_SEMICOLON,  KeyCode::SEMICOLON,            KeyCode::COLON},
+  {KEY_APOSTROPHE, KeyCode::APOSTROPHE,           KeyCode::QUOTATION_MARK},
+  {KEY_GRAVE,      KeyCode::GRAVE_ACCENT_SIGN,    KeyCode::TILDA},
+  {KEY_BACKSLASH,  KeyCode::BACK_SLASH,           KeyCode::VERTICAL_BAR},
+  {KEY_Z,          KeyCode::Z,                    KeyCode::Z},
+  {KEY_X,          KeyCode::X,                    KeyCode::X},
+  {KEY_C,          KeyCode::C,                    KeyCode::C},
+  {KEY_V,          KeyCode::V,                    KeyCode::V},
+  {KEY_B,          KeyCode::B,                    KeyCode::B},
+  {KEY_N,          KeyCode::N,                    KeyCode::N},
+  {KEY_M,          KeyCode::M,                    KeyCode::M},
+  {KEY_COMMA,      KeyCode::COMMA,                KeyCode::LEFT_ANGLE_BRACKET},
+  {KEY_DOT,        KeyCode::DOT,                  KeyCode::RIGHT_ANGLE_BRACKET},
+  {KEY_SLASH,      KeyCode::RIGHT_SLASH,          KeyCode::QUESTION_MARK},
+  {KEY_SPACE,      KeyCode::SPACE,                KeyCode::SPACE},
+
+  {KEY_F1,         KeyCode::F1,                   KeyCode::F1},
+  {KEY_F2,         KeyCode::F2,                   KeyCode::F2},
+  {KEY_F3,         KeyCode::F3,                   KeyCode::F3},
+  {KEY_F4,         KeyCode::F4,                   KeyCode::F4},
+  {KEY_F5,         KeyCode::F5,                   KeyCode::F5},
+  {KEY_F6,         KeyCode::F6,                   KeyCode::F6},
+  {KEY_F7,         KeyCode::F7,                   KeyCode::F7},
+  {KEY_F8,         KeyCode::F8,                   KeyCode::F8},
+  {KEY_F9,         KeyCode::F9,                   KeyCode::F9},
+  {KEY_F10,        KeyCode::F10,                  KeyCode::F10},
+  {KEY_F11,        KeyCode::F11,                  KeyCode::F11},
+  {KEY_F12,        KeyCode::F12,                  KeyCode::F12},
+
+  {KEY_UP,         KeyCode::CURSOR_UP,            KeyCode::CURSOR_UP},
+  {KEY_DOWN,       KeyCode::CURSOR_DOWN,          KeyCode::CURSOR_DOWN},
+  {KEY_LEFT,       KeyCode::CURSOR_LEFT,          KeyCode::CURSOR_LEFT},
+  {KEY_RIGHT,      KeyCode::CURSOR_RIGHT,         KeyCode::CURSOR_RIGHT},
+  {KEY_HOME,       KeyCode::HOME,                 KeyCode::HOME},
+  {KEY_END,        KeyCode::END,                  KeyCode::END},
+  {KEY_PAGEUP,     KeyCode::PG_UP,                KeyCode::PG_UP},
+  {KEY_PAGEDOWN,   KeyCode::PG_DOWN,              KeyCode::PG_DOWN},
+  {KEY_INSERT,     KeyCode::INSERT,               KeyCode::INSERT},
+  {KEY_DELETE,     KeyCode::DELETE_KEY,           KeyCode::DELETE_KEY},
+
+  // Keypad
+  {KEY_KP0,        KeyCode::NUMBER_0,             KeyCode::NUMBER_0},
+  {KEY_KP1,        KeyCode::NUMBER_1,             KeyCode::NUMBER_1},
+  {KEY_KP2,        KeyCode::NUMBER_2,             KeyCode::NUMBER_2},
+  {KEY_KP3,        KeyCode::NUMBER_3,             KeyCode::NUMBER_3},
+  {KEY_KP4,        KeyCode::NUMBER_4,             KeyCode::NUMBER_4},
+  {KEY_KP5,        KeyCode::NUMBER_5,             KeyCode::NUMBER_5},
+  {KEY_KP6,        KeyCode::NUMBER_6,             KeyCode::NUMBER_6},
+  {KEY_KP7,        KeyCode::NUMBER_7,             KeyCode::NUMBER_7},
+  {KEY_KP8,        KeyCode::NUMBER_8,             KeyCode::NUMBER_8},
+  {KEY_KP9,        KeyCode::NUMBER_9,             KeyCode::NUMBER_9},
+  {KEY_KPDOT,      KeyCode::DOT,                  KeyCode::DOT},
+  {KEY_KPPLUS,     KeyCode::PLUS,                 KeyCode::PLUS},
+  {KEY_KPMINUS,    KeyCode::MINUS,                KeyCode::MINUS},
+  {KEY_KPASTERISK, KeyCode::STAR,                 KeyCode::STAR},
+  {KEY_KPSLASH,    KeyCode::RIGHT_SLASH,          KeyCode::RIGHT_SLASH},
+  {KEY_KPEQUAL,    KeyCode::EQUAL_SIGN,           KeyCode::EQUAL_SIGN},
+  {KEY_KPENTER,    KeyCode::ENTER,                KeyCode::ENTER},
+};
+/* *INDENT-ON* */
+
+const size_t KeyboardHandlerEvdevImpl::STATIC_KEY_MAP_LENGTH =
+  sizeof(KeyboardHandlerEvdevImpl::DEFAULT_STATIC_KEY_MAP) /
+  sizeof(KeyboardHandlerEvdevImpl::KeyMap);
+
+#endif  // #ifdef __linux__
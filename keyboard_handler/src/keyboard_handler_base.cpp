@@ -12,14 +12,219 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
 #include "keyboard_handler/keyboard_handler_base.hpp"
+#include "tracepoints.hpp"
 
 KEYBOARD_HANDLER_PUBLIC
 constexpr KeyboardHandlerBase::callback_handle_t KeyboardHandlerBase::invalid_handle;
 
+struct KeyboardHandlerBase::DispatchShard
+{
+  explicit DispatchShard(size_t queue_capacity)
+  : queue(queue_capacity) {}
+
+  struct DispatchedKeyEvent
+  {
+    KeyAndModifiers key_and_modifiers;
+    KeyEventType event_type;
+  };
+
+  BoundedQueue<DispatchedKeyEvent> queue;
+  /// Last taken snapshot of the dispatch lists and its generation. Worker thread only.
+  std::shared_ptr<const DispatchSnapshot> snapshot;
+  uint64_t snapshot_generation = 0;
+  std::atomic<size_t> max_queue_depth{0};
+  std::atomic<uint64_t> number_of_dispatched_key_presses{0};
+  std::atomic<uint64_t> number_of_stalls{0};
+  WatchdogSlot watchdog_slot;
+  std::atomic_bool worker_sleeping{false};
+  std::atomic_bool exit{false};
+  std::mutex worker_mutex;
+  std::condition_variable worker_cv;
+  std::thread worker_thread;
+};
+
+struct KeyboardHandlerBase::DispatchSnapshot
+{
+  using dispatch_list_t = std::vector<callback_data>;
+
+  /// Lists are shared between snapshots. Change of callbacks copies the map of list pointers and
+  /// builds only the affected list, callbacks of the other lists aren't copied.
+  std::unordered_map<KeyAndModifiers, std::shared_ptr<const dispatch_list_t>,
+    key_and_modifiers_hash_fn> dispatch_lists;
+};
+
+struct KeyboardHandlerBase::CallTracker
+{
+  /// Set under callbacks_mutex_ when callback is deleted.
+  std::atomic_bool is_deleted{false};
+  std::atomic<uint32_t> number_of_calls{0};
+  /// Notified when call of the deleted callback is finished.
+  std::mutex mutex;
+  std::condition_variable calls_finished_cv;
+};
+
+struct KeyboardHandlerBase::HoldState
+{
+  HoldState(
+    const callback_t & callback, const HoldSettings & settings, KeyCode key_code,
+    KeyModifiers key_modifiers)
+  : callback(callback), settings(settings), key_code(key_code), key_modifiers(key_modifiers) {}
+
+  const callback_t callback;
+  const HoldSettings settings;
+  const KeyCode key_code;
+  const KeyModifiers key_modifiers;
+  std::mutex mutex;
+  bool is_held = false;
+  TimerWheel::timer_id_t timer_id = TimerWheel::invalid_timer_id;
+  TimerWheel::timer_id_t release_timer_id = TimerWheel::invalid_timer_id;
+  Clock::time_point next_call_time;
+  std::chrono::nanoseconds interval{0};
+};
+
+struct KeyboardHandlerBase::BindingStatsSlot
+{
+  std::atomic<uint64_t> number_of_calls{0};
+  std::atomic<int64_t> total_cpu_time_ns{0};
+  std::atomic<int64_t> max_cpu_time_ns{0};
+  std::atomic<int64_t> total_wall_time_ns{0};
+  std::atomic<int64_t> max_wall_time_ns{0};
+};
+
+namespace
+{
+std::shared_ptr<LogSink> g_log_sink = std::make_shared<StreamLogSink>();
+std::atomic<LogSeverity> g_log_severity{LogSeverity::INFO};
+
+/// Tracker of the callback called by the dispatch shard on this thread to let callback delete
+/// itself without waiting for its own call.
+thread_local const void * t_current_call_tracker = nullptr;
+
+/// Deleting callback logs a warning once it waits for the call in progress longer than this.
+constexpr std::chrono::seconds SLOW_DELETE_WARNING_TIMEOUT{1};
+
+/// States of the WatchdogSlot in the low bits of its call_id. Each call advances call_id by
+/// WATCHDOG_SLOT_CALL_STEP through writing and running back to idle.
+constexpr uint64_t WATCHDOG_SLOT_STATE_MASK = 3;
+constexpr uint64_t WATCHDOG_SLOT_WRITING = 1;
+constexpr uint64_t WATCHDOG_SLOT_RUNNING = 2;
+constexpr uint64_t WATCHDOG_SLOT_CALL_STEP = 4;
+
+/// \brief Get CPU time consumed by the calling thread.
+int64_t get_thread_cpu_time_ns()
+{
+#ifdef _WIN32
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (!GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+    return 0;
+  }
+  auto to_100ns = [](const FILETIME & time) {
+      return (static_cast<int64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+  return (to_100ns(kernel_time) + to_100ns(user_time)) * 100;
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/// \brief Update maximum. Each counter has single writer, the dispatching thread.
+void update_max(std::atomic<int64_t> & max, int64_t value)
+{
+  if (value > max.load(std::memory_order_relaxed)) {
+    max.store(value, std::memory_order_relaxed);
+  }
+}
+}  // namespace
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerBase::set_log_sink(std::shared_ptr<LogSink> sink)
+{
+  std::atomic_store(&g_log_sink, sink);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+std::shared_ptr<LogSink> KeyboardHandlerBase::get_log_sink()
+{
+  return std::atomic_load(&g_log_sink);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerBase::set_log_severity(LogSeverity severity)
+{
+  g_log_severity.store(severity);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+LogSeverity KeyboardHandlerBase::get_log_severity()
+{
+  return g_log_severity.load();
+}
+
+bool KeyboardHandlerBase::is_log_enabled(LogSeverity severity)
+{
+  return severity >= g_log_severity.load(std::memory_order_relaxed);
+}
+
+void KeyboardHandlerBase::log(LogSeverity severity, const std::string & message)
+{
+  if (!is_log_enabled(severity)) {
+    return;
+  }
+  auto sink = std::atomic_load(&g_log_sink);
+  if (sink) {
+    sink->log(severity, message.data(), message.size());
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerBase::throw_init_error(
+  const std::error_code & error, const std::string & message)
+{
+  if (error == std::errc::invalid_argument) {
+    KEYBOARD_HANDLER_THROW(std::invalid_argument(message));
+  }
+  KEYBOARD_HANDLER_THROW(std::runtime_error(message));
+}
+
+void KeyboardHandlerBase::set_reader_error(int error_number, const std::string & message)
+{
+  int no_error = 0;
+  // Failed call could leave errno unset
+  reader_errno_.compare_exchange_strong(no_error, error_number != 0 ? error_number : EIO);
+  log(LogSeverity::ERR, message);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+std::error_code KeyboardHandlerBase::get_reader_error() const
+{
+  int error_number = reader_errno_.load();
+  if (error_number == 0) {
+    return std::error_code();
+  }
+  return std::error_code(error_number, std::system_category());
+}
+
 KEYBOARD_HANDLER_PUBLIC
 KeyboardHandlerBase::callback_handle_t KeyboardHandlerBase::add_key_press_callback(
   const callback_t & callback, KeyboardHandlerBase::KeyCode key_code,
@@ -29,11 +234,301 @@ KeyboardHandlerBase::callback_handle_t KeyboardHandlerBase::add_key_press_callba
     return invalid_handle;
   }
   std::lock_guard<std::mutex> lk(callbacks_mutex_);
-  callback_handle_t new_handle = get_new_handle();
-  callbacks_.emplace(
-    KeyAndModifiers{key_code, key_modifiers},
-    callback_data{new_handle, callback});
-  return new_handle;
+  callback_data data = make_callback_data();
+  data.callback = callback;
+  return insert_callback(KeyAndModifiers{key_code, key_modifiers}, std::move(data));
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::callback_handle_t KeyboardHandlerBase::add_key_press_callback(
+  const std::weak_ptr<void> & owner, const callback_t & callback,
+  KeyboardHandlerBase::KeyCode key_code, KeyboardHandlerBase::KeyModifiers key_modifiers)
+{
+  if (callback == nullptr || owner.expired() || !is_init_succeed_) {
+    return invalid_handle;
+  }
+  std::lock_guard<std::mutex> lk(callbacks_mutex_);
+  callback_data data = make_callback_data();
+  data.callback = callback;
+  data.owner = owner;
+  data.has_owner = true;
+  return insert_callback(KeyAndModifiers{key_code, key_modifiers}, std::move(data));
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::callback_handle_t KeyboardHandlerBase::add_key_event_callback(
+  const key_event_callback_t & callback, KeyboardHandlerBase::KeyCode key_code,
+  KeyboardHandlerBase::KeyModifiers key_modifiers)
+{
+  if (callback == nullptr || !is_init_succeed_) {
+    return invalid_handle;
+  }
+  std::lock_guard<std::mutex> lk(callbacks_mutex_);
+  callback_data data = make_callback_data();
+  data.event_callback = callback;
+  return insert_callback(KeyAndModifiers{key_code, key_modifiers}, std::move(data));
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::callback_handle_t KeyboardHandlerBase::add_consuming_key_press_callback(
+  const consuming_callback_t & callback, KeyboardHandlerBase::KeyCode key_code,
+  KeyboardHandlerBase::KeyModifiers key_modifiers)
+{
+  if (callback == nullptr || !is_init_succeed_) {
+    return invalid_handle;
+  }
+  std::lock_guard<std::mutex> lk(callbacks_mutex_);
+  callback_data data = make_callback_data();
+  data.consuming_callback = callback;
+  return insert_callback(KeyAndModifiers{key_code, key_modifiers}, std::move(data));
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerBase::set_callback_priority(callback_handle_t handle, int priority)
+{
+  std::lock_guard<std::mutex> lk(callbacks_mutex_);
+  for (auto & it : callbacks_) {
+    if (it.second.handle == handle) {
+      it.second.priority = priority;
+      sort_dispatch_list(dispatch_lists_[it.first]);
+      publish_dispatch_list(it.first);
+      return true;
+    }
+  }
+  return false;
+}
+
+KeyboardHandlerBase::callback_handle_t KeyboardHandlerBase::insert_callback(
+  const KeyAndModifiers & key_and_modifiers, callback_data data)
+{
+  data.handle = get_new_handle();
+  data.tracker = std::make_shared<CallTracker>();
+  auto it = callbacks_.emplace(key_and_modifiers, std::move(data));
+  auto callbacks_per_key_code = get_callbacks_per_key_code(key_and_modifiers.key_code);
+  if (callbacks_per_key_code != nullptr) {
+    callbacks_per_key_code->fetch_add(1, std::memory_order_release);
+  }
+  auto & dispatch_list = dispatch_lists_[key_and_modifiers];
+  dispatch_list.push_back(&it->second);
+  sort_dispatch_list(dispatch_list);
+  publish_dispatch_list(key_and_modifiers);
+  KEYBOARD_HANDLER_TRACEPOINT(
+    callback_add, it->second.handle, static_cast<uint32_t>(key_and_modifiers.key_code),
+    static_cast<uint32_t>(key_and_modifiers.key_modifiers));
+  return it->second.handle;
+}
+
+KeyboardHandlerBase::callback_data KeyboardHandlerBase::erase_callback(
+  std::unordered_multimap<KeyAndModifiers, callback_data, key_and_modifiers_hash_fn>::iterator it)
+{
+  auto list_it = dispatch_lists_.find(it->first);
+  if (list_it != dispatch_lists_.end()) {
+    auto & dispatch_list = list_it->second;
+    dispatch_list.erase(
+      std::remove(dispatch_list.begin(), dispatch_list.end(), &it->second), dispatch_list.end());
+    if (dispatch_list.empty()) {
+      dispatch_lists_.erase(list_it);
+    }
+  }
+  // Shards which took previous snapshot check it before the call
+  it->second.tracker->is_deleted.store(true);
+  KeyAndModifiers key_and_modifiers = it->first;
+  auto callbacks_per_key_code = get_callbacks_per_key_code(key_and_modifiers.key_code);
+  if (callbacks_per_key_code != nullptr) {
+    callbacks_per_key_code->fetch_sub(1, std::memory_order_release);
+  }
+  callback_data erased = std::move(it->second);
+  callbacks_.erase(it);
+  publish_dispatch_list(key_and_modifiers);
+  return erased;
+}
+
+void KeyboardHandlerBase::publish_dispatch_list(const KeyAndModifiers & key_and_modifiers)
+{
+  if (dispatch_snapshot_ == nullptr) {
+    return;
+  }
+  auto snapshot = std::make_shared<DispatchSnapshot>(*dispatch_snapshot_);
+  auto list_it = dispatch_lists_.find(key_and_modifiers);
+  if (list_it == dispatch_lists_.end()) {
+    snapshot->dispatch_lists.erase(key_and_modifiers);
+  } else {
+    auto dispatch_list = std::make_shared<DispatchSnapshot::dispatch_list_t>();
+    dispatch_list->reserve(list_it->second.size());
+    for (const callback_data * data : list_it->second) {
+      dispatch_list->push_back(*data);
+    }
+    snapshot->dispatch_lists[key_and_modifiers] = std::move(dispatch_list);
+  }
+  dispatch_snapshot_ = std::move(snapshot);
+  dispatch_snapshot_generation_.fetch_add(1, std::memory_order_release);
+}
+
+void KeyboardHandlerBase::publish_all_dispatch_lists()
+{
+  auto snapshot = std::make_shared<DispatchSnapshot>();
+  for (const auto & list : dispatch_lists_) {
+    auto dispatch_list = std::make_shared<DispatchSnapshot::dispatch_list_t>();
+    dispatch_list->reserve(list.second.size());
+    for (const callback_data * data : list.second) {
+      dispatch_list->push_back(*data);
+    }
+    snapshot->dispatch_lists.emplace(list.first, std::move(dispatch_list));
+  }
+  dispatch_snapshot_ = std::move(snapshot);
+  dispatch_snapshot_generation_.fetch_add(1, std::memory_order_release);
+}
+
+void KeyboardHandlerBase::sort_dispatch_list(std::vector<callback_data *> & dispatch_list)
+{
+  // Handles grow monotonically, hence they keep order of registration
+  std::sort(
+    dispatch_list.begin(), dispatch_list.end(),
+    [](const callback_data * lhs, const callback_data * rhs) {
+      if (lhs->priority != rhs->priority) {
+        return lhs->priority > rhs->priority;
+      }
+      return lhs->handle < rhs->handle;
+    });
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::HoldSettings::HoldSettings() = default;
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::callback_handle_t KeyboardHandlerBase::add_key_hold_callback(
+  const callback_t & callback, const HoldSettings & settings,
+  KeyboardHandlerBase::KeyCode key_code, KeyboardHandlerBase::KeyModifiers key_modifiers)
+{
+  if (callback == nullptr || settings.hold_duration.count() < 0) {
+    return invalid_handle;
+  }
+  auto state = std::make_shared<HoldState>(callback, settings, key_code, key_modifiers);
+  return add_key_event_callback(
+    [this, state](KeyCode, KeyModifiers, KeyEventType event_type) {
+      std::lock_guard<std::mutex> lk(state->mutex);
+      if (event_type == KeyEventType::RELEASE) {
+        release_hold(*state);
+        return;
+      }
+      if (event_type != KeyEventType::PRESS && event_type != KeyEventType::REPEAT) {
+        return;
+      }
+      std::weak_ptr<HoldState> weak_state = state;
+      auto now = clock_->now();
+      // Auto repeat reported as presses doesn't restart the hold
+      if (!state->is_held) {
+        state->is_held = true;
+        state->interval = state->settings.repeat_interval;
+        state->next_call_time = now + state->settings.hold_duration;
+        state->timer_id = schedule_timer(
+          state->next_call_time, [this, weak_state]() {on_hold_timer(weak_state);});
+      }
+      if (state->settings.release_timeout.count() > 0) {
+        cancel_timer(state->release_timer_id);
+        state->release_timer_id = schedule_timer(
+          now + state->settings.release_timeout, [this, weak_state]() {
+            auto state = weak_state.lock();
+            if (state) {
+              std::lock_guard<std::mutex> lk(state->mutex);
+              release_hold(*state);
+            }
+          });
+      }
+    }, key_code, key_modifiers);
+}
+
+void KeyboardHandlerBase::on_hold_timer(const std::weak_ptr<HoldState> & weak_state)
+{
+  // Binding could be deleted while call was scheduled
+  auto state = weak_state.lock();
+  if (!state) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lk(state->mutex);
+    if (!state->is_held) {
+      return;
+    }
+    state->timer_id = TimerWheel::invalid_timer_id;
+    if (state->interval.count() > 0) {
+      // Count from the previous deadline to not accumulate delays of the keyboard handler's
+      // thread, but don't try to catch up after it stalled.
+      state->next_call_time = std::max(
+        state->next_call_time + state->interval, clock_->now());
+      state->timer_id = schedule_timer(
+        state->next_call_time, [this, weak_state]() {on_hold_timer(weak_state);});
+      auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        state->interval * state->settings.repeat_acceleration);
+      state->interval = std::max<std::chrono::nanoseconds>(
+        interval, state->settings.min_repeat_interval);
+    }
+  }
+  // Without state mutex to let callback delete bindings
+  state->callback(state->key_code, state->key_modifiers);
+}
+
+void KeyboardHandlerBase::release_hold(HoldState & state)
+{
+  state.is_held = false;
+  cancel_timer(state.timer_id);
+  cancel_timer(state.release_timer_id);
+  state.timer_id = TimerWheel::invalid_timer_id;
+  state.release_timer_id = TimerWheel::invalid_timer_id;
+}
+
+TimerWheel::timer_id_t KeyboardHandlerBase::schedule_timer(
+  Clock::time_point deadline, TimerWheel::callback_t callback)
+{
+  TimerWheel::timer_id_t timer_id = TimerWheel::invalid_timer_id;
+  bool is_earliest = false;
+  {
+    std::lock_guard<std::mutex> lk(timers_mutex_);
+    is_earliest = deadline < timer_wheel_.get_next_deadline();
+    timer_id = timer_wheel_.schedule(deadline, std::move(callback));
+    number_of_timers_.store(timer_wheel_.size(), std::memory_order_release);
+  }
+  if (is_earliest) {
+    on_timer_scheduled();
+  }
+  return timer_id;
+}
+
+bool KeyboardHandlerBase::cancel_timer(TimerWheel::timer_id_t timer_id)
+{
+  if (timer_id == TimerWheel::invalid_timer_id) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lk(timers_mutex_);
+  bool is_canceled = timer_wheel_.cancel(timer_id);
+  number_of_timers_.store(timer_wheel_.size(), std::memory_order_release);
+  return is_canceled;
+}
+
+void KeyboardHandlerBase::process_timers()
+{
+  if (number_of_timers_.load(std::memory_order_acquire) == 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lk(timers_mutex_);
+    timer_wheel_.advance(clock_->now(), expired_timers_);
+    number_of_timers_.store(timer_wheel_.size(), std::memory_order_release);
+  }
+  // Without timers_mutex_ to let scheduled functions schedule and cancel timers
+  for (auto & callback : expired_timers_) {
+    callback();
+  }
+  expired_timers_.clear();
+}
+
+Clock::time_point KeyboardHandlerBase::get_next_timer_deadline() const
+{
+  if (number_of_timers_.load(std::memory_order_acquire) == 0) {
+    return Clock::time_point::max();
+  }
+  std::lock_guard<std::mutex> lk(timers_mutex_);
+  return timer_wheel_.get_next_deadline();
 }
 
 KEYBOARD_HANDLER_PUBLIC
@@ -115,18 +610,844 @@ std::string enum_key_modifiers_to_str(KeyboardHandlerBase::KeyModifiers key_modi
 
 KEYBOARD_HANDLER_PUBLIC
 void KeyboardHandlerBase::delete_key_press_callback(const callback_handle_t & handle) noexcept
+{
+  KEYBOARD_HANDLER_TRACEPOINT(callback_delete, handle);
+  std::shared_ptr<CallTracker> tracker;
+  // Destroyed without callbacks_mutex_ since callback could own arbitrary objects
+  callback_data erased;
+  {
+    std::lock_guard<std::mutex> lk(callbacks_mutex_);
+    for (auto it = callbacks_.begin(); it != callbacks_.end(); ++it) {
+      if (it->second.handle == handle) {
+        tracker = it->second.tracker;
+        erased = erase_callback(it);
+        break;
+      }
+    }
+  }
+  if (tracker == nullptr) {
+    return;
+  }
+  // Wait for the calls which passed the check of is_deleted on the dispatch shards
+  const uint32_t own_calls = t_current_call_tracker == tracker.get() ? 1 : 0;
+  auto is_finished = [&tracker, own_calls]() {return tracker->number_of_calls.load() <= own_calls;};
+  std::unique_lock<std::mutex> lk(tracker->mutex);
+  if (!tracker->calls_finished_cv.wait_for(lk, SLOW_DELETE_WARNING_TIMEOUT, is_finished)) {
+    lk.unlock();
+    log(
+      LogSeverity::WARN, "Deleting callback " + std::to_string(handle) +
+      " waits for its call in progress on the dispatch shard");
+    lk.lock();
+    tracker->calls_finished_cv.wait(lk, is_finished);
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::callback_handle_t KeyboardHandlerBase::add_input_filter(
+  const input_filter_t & filter)
+{
+  if (filter == nullptr || !is_init_succeed_) {
+    return invalid_handle;
+  }
+  std::lock_guard<std::mutex> lk(callbacks_mutex_);
+  callback_handle_t new_handle = get_new_handle();
+  input_filters_.push_back(input_filter_data{new_handle, filter});
+  number_of_input_filters_.store(input_filters_.size(), std::memory_order_release);
+  return new_handle;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerBase::delete_input_filter(const callback_handle_t & handle) noexcept
 {
   std::lock_guard<std::mutex> lk(callbacks_mutex_);
-  for (auto it = callbacks_.begin(); it != callbacks_.end(); ++it) {
-    if (it->second.handle == handle) {
-      callbacks_.erase(it);
+  for (auto it = input_filters_.begin(); it != input_filters_.end(); ++it) {
+    if (it->handle == handle) {
+      input_filters_.erase(it);
+      number_of_input_filters_.store(input_filters_.size(), std::memory_order_release);
       return;
     }
   }
 }
 
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerBase::set_static_dispatcher(
+  std::shared_ptr<void> static_bindings, static_dispatch_fn_t static_dispatch_fn)
+{
+  if (!is_init_succeed_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lk(callbacks_mutex_);
+  static_bindings_ = std::move(static_bindings);
+  static_dispatch_fn_ = static_dispatch_fn;
+  static_bindings_changed_.store(true);
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerBase::clear_static_bindings()
+{
+  std::shared_ptr<void> static_bindings;
+  {
+    std::lock_guard<std::mutex> lk(callbacks_mutex_);
+    static_bindings.swap(static_bindings_);
+    static_dispatch_fn_ = nullptr;
+    static_bindings_changed_.store(true);
+  }
+  // Handlers are destroyed without callbacks_mutex_ since they could own arbitrary objects
+}
+
+void KeyboardHandlerBase::sync_static_bindings()
+{
+  std::shared_ptr<void> old_static_bindings;
+  {
+    std::lock_guard<std::mutex> lk(callbacks_mutex_);
+    old_static_bindings.swap(active_static_bindings_);
+    active_static_bindings_ = static_bindings_;
+    active_static_dispatch_fn_ = static_dispatch_fn_;
+  }
+  // Handlers are destroyed without callbacks_mutex_ since they could own arbitrary objects
+}
+
+std::atomic<uint32_t> * KeyboardHandlerBase::get_callbacks_per_key_code(KeyCode key_code) const
+{
+  auto index = static_cast<size_t>(key_code);
+  if (index >= static_cast<size_t>(KeyCode::END_OF_KEY_CODE_ENUM)) {
+    return nullptr;
+  }
+  return &callbacks_per_key_code_[index];
+}
+
+bool KeyboardHandlerBase::dispatch_key_press(
+  KeyCode key_code, KeyModifiers key_modifiers, KeyEventType event_type)
+{
+  if (static_bindings_changed_.exchange(false)) {
+    sync_static_bindings();
+  }
+  std::unique_lock<std::mutex> lk(callbacks_mutex_, std::defer_lock);
+  if (number_of_input_filters_.load(std::memory_order_acquire) != 0) {
+    lk.lock();
+    for (auto & it : input_filters_) {
+      if (!it.filter(key_code, key_modifiers)) {
+        return true;
+      }
+    }
+    lk.unlock();
+  }
+  // Queued key press isn't counted as handled, consumer of the queue could ignore it
+  push_event(key_code, key_modifiers, event_type);
+  bool is_statically_bound = active_static_dispatch_fn_ != nullptr &&
+    (event_type == KeyEventType::PRESS || event_type == KeyEventType::REPEAT) &&
+    active_static_dispatch_fn_(active_static_bindings_.get(), key_code, key_modifiers);
+  auto callbacks_per_key_code = get_callbacks_per_key_code(key_code);
+  if (callbacks_per_key_code != nullptr &&
+    callbacks_per_key_code->load(std::memory_order_acquire) == 0)
+  {
+    // Key press without callbacks added at runtime doesn't take the mutex
+    KEYBOARD_HANDLER_TRACEPOINT(
+      dispatch, static_cast<uint32_t>(key_code), static_cast<uint32_t>(key_modifiers), 0);
+    return is_statically_bound;
+  }
+  lk.lock();
+  KeyAndModifiers key_and_modifiers{key_code, key_modifiers};
+  auto list_it = dispatch_lists_.find(key_and_modifiers);
+  if (number_of_dispatch_shards_.load(std::memory_order_relaxed) != 0) {
+    size_t number_of_callbacks = 0;
+    if (list_it != dispatch_lists_.end()) {
+      for (const callback_data * data : list_it->second) {
+        if (is_callback_for_event(*data, event_type)) {
+          number_of_callbacks++;
+        }
+      }
+    }
+    // Worker takes callbacks_mutex_ to copy callbacks, don't hold it while waiting for space
+    lk.unlock();
+    if (number_of_callbacks != 0) {
+      push_to_dispatch_shard(key_and_modifiers, event_type);
+    }
+    KEYBOARD_HANDLER_TRACEPOINT(
+      dispatch, static_cast<uint32_t>(key_code), static_cast<uint32_t>(key_modifiers),
+      number_of_callbacks);
+    return is_statically_bound || number_of_callbacks != 0;
+  }
+
+  size_t number_of_called_callbacks = 0;
+  bool has_expired_callbacks = false;
+  if (list_it != dispatch_lists_.end()) {
+    for (const callback_data * data : list_it->second) {
+      if (!is_callback_for_event(*data, event_type)) {
+        continue;
+      }
+      bool is_consumed = false;
+      std::shared_ptr<void> owner;
+      if (invoke_callback(
+          *data, key_code, key_modifiers, event_type, watchdog_slot_, is_consumed, owner))
+      {
+        number_of_called_callbacks++;
+      } else {
+        has_expired_callbacks = true;
+      }
+      if (owner != nullptr) {
+        locked_owners_.push_back(std::move(owner));
+      }
+      if (is_consumed) {
+        break;
+      }
+    }
+  }
+  std::vector<callback_data> erased_callbacks;
+  if (has_expired_callbacks) {
+    prune_expired_callbacks(key_and_modifiers, erased_callbacks);
+  }
+  lk.unlock();
+  // Owners and callbacks could be destroyed here, their destructors could delete callbacks
+  erased_callbacks.clear();
+  locked_owners_.clear();
+  KEYBOARD_HANDLER_TRACEPOINT(
+    dispatch, static_cast<uint32_t>(key_code), static_cast<uint32_t>(key_modifiers),
+    number_of_called_callbacks);
+  return is_statically_bound || number_of_called_callbacks != 0;
+}
+
+bool KeyboardHandlerBase::invoke_callback(
+  const callback_data & data, KeyCode key_code, KeyModifiers key_modifiers,
+  KeyEventType event_type, WatchdogSlot & slot, bool & is_consumed,
+  std::shared_ptr<void> & owner)
+{
+  if (data.has_owner) {
+    owner = data.owner.lock();
+    if (!owner) {
+      return false;
+    }
+  }
+  BindingStatsSlot * stats = is_binding_stats_enabled_.load(std::memory_order_relaxed) ?
+    data.stats.get() : nullptr;
+  int64_t start_cpu_time_ns = 0;
+  std::chrono::steady_clock::time_point start_time;
+  if (stats != nullptr) {
+    start_cpu_time_ns = get_thread_cpu_time_ns();
+    start_time = std::chrono::steady_clock::now();
+  }
+  uint64_t call_id = 0;
+  if (is_watchdog_enabled_.load(std::memory_order_relaxed)) {
+    int64_t deadline_ns = data.deadline.count() != 0 ? data.deadline.count() :
+      default_deadline_ns_.load(std::memory_order_relaxed);
+    if (deadline_ns != 0) {
+      // Mark slot as being written before touching fields of the previous call, release fence
+      // keeps the field stores from becoming visible before it
+      call_id = slot.call_id.load(std::memory_order_relaxed) + WATCHDOG_SLOT_WRITING;
+      slot.call_id.store(call_id, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      slot.handle.store(data.handle, std::memory_order_relaxed);
+      slot.key_code.store(static_cast<uint32_t>(key_code), std::memory_order_relaxed);
+      slot.key_modifiers.store(static_cast<uint32_t>(key_modifiers), std::memory_order_relaxed);
+      slot.deadline_ns.store(deadline_ns, std::memory_order_relaxed);
+      slot.start_time_ns.store(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count(),
+        std::memory_order_relaxed);
+      call_id += WATCHDOG_SLOT_RUNNING - WATCHDOG_SLOT_WRITING;
+      slot.call_id.store(call_id, std::memory_order_release);
+    }
+  }
+#ifdef KEYBOARD_HANDLER_ENABLE_USDT
+  if (KEYBOARD_HANDLER_TRACEPOINT_ENABLED(callback)) {
+    // Measure callback duration only when tracer attached to the probe
+    auto start = std::chrono::steady_clock::now();
+    is_consumed = call_callback(data, key_code, key_modifiers, event_type);
+    KEYBOARD_HANDLER_TRACEPOINT(
+      callback, data.handle, static_cast<uint32_t>(key_code),
+      static_cast<uint32_t>(key_modifiers),
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+  } else {
+    is_consumed = call_callback(data, key_code, key_modifiers, event_type);
+  }
+#else
+  is_consumed = call_callback(data, key_code, key_modifiers, event_type);
+#endif
+  if (call_id != 0) {
+    slot.call_id.store(
+      call_id - WATCHDOG_SLOT_RUNNING + WATCHDOG_SLOT_CALL_STEP, std::memory_order_release);
+  }
+  if (stats != nullptr) {
+    int64_t cpu_time_ns = get_thread_cpu_time_ns() - start_cpu_time_ns;
+    int64_t wall_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start_time).count();
+    stats->number_of_calls.fetch_add(1, std::memory_order_relaxed);
+    stats->total_cpu_time_ns.fetch_add(cpu_time_ns, std::memory_order_relaxed);
+    stats->total_wall_time_ns.fetch_add(wall_time_ns, std::memory_order_relaxed);
+    update_max(stats->max_cpu_time_ns, cpu_time_ns);
+    update_max(stats->max_wall_time_ns, wall_time_ns);
+  }
+  return true;
+}
+
+bool KeyboardHandlerBase::call_callback(
+  const callback_data & data, KeyCode key_code, KeyModifiers key_modifiers,
+  KeyEventType event_type)
+{
+  if (data.event_callback) {
+    data.event_callback(key_code, key_modifiers, event_type);
+  } else if (data.consuming_callback) {
+    return data.consuming_callback(key_code, key_modifiers);
+  } else {
+    data.callback(key_code, key_modifiers);
+  }
+  return false;
+}
+
+KeyboardHandlerBase::callback_data KeyboardHandlerBase::make_callback_data() const
+{
+  callback_data data;
+  if (is_binding_stats_enabled_.load(std::memory_order_relaxed)) {
+    data.stats = std::make_shared<BindingStatsSlot>();
+  }
+  return data;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerBase::enable_binding_stats(bool enable)
+{
+  std::lock_guard<std::mutex> lk(callbacks_mutex_);
+  if (enable) {
+    for (auto & it : callbacks_) {
+      if (it.second.stats == nullptr) {
+        it.second.stats = std::make_shared<BindingStatsSlot>();
+      }
+    }
+    if (dispatch_snapshot_ != nullptr) {
+      publish_all_dispatch_lists();
+    }
+  }
+  is_binding_stats_enabled_.store(enable, std::memory_order_relaxed);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+std::vector<KeyboardHandlerBase::BindingStats> KeyboardHandlerBase::get_binding_stats() const
+{
+  std::vector<BindingStats> binding_stats;
+  {
+    std::lock_guard<std::mutex> lk(callbacks_mutex_);
+    for (const auto & it : callbacks_) {
+      const BindingStatsSlot * stats = it.second.stats.get();
+      if (stats == nullptr) {
+        continue;
+      }
+      binding_stats.push_back(
+        BindingStats{it.second.handle, it.first.key_code, it.first.key_modifiers,
+          stats->number_of_calls.load(std::memory_order_relaxed),
+          std::chrono::nanoseconds(stats->total_cpu_time_ns.load(std::memory_order_relaxed)),
+          std::chrono::nanoseconds(stats->max_cpu_time_ns.load(std::memory_order_relaxed)),
+          std::chrono::nanoseconds(stats->total_wall_time_ns.load(std::memory_order_relaxed)),
+          std::chrono::nanoseconds(stats->max_wall_time_ns.load(std::memory_order_relaxed))});
+    }
+  }
+  std::sort(
+    binding_stats.begin(), binding_stats.end(),
+    [](const BindingStats & lhs, const BindingStats & rhs) {
+      if (lhs.total_cpu_time != rhs.total_cpu_time) {
+        return lhs.total_cpu_time > rhs.total_cpu_time;
+      }
+      return lhs.total_wall_time > rhs.total_wall_time;
+    });
+  return binding_stats;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerBase::set_default_callback_deadline(std::chrono::nanoseconds deadline)
+{
+  default_deadline_ns_.store(deadline.count(), std::memory_order_relaxed);
+  update_watchdog(deadline);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerBase::set_callback_deadline(
+  callback_handle_t handle, std::chrono::nanoseconds deadline)
+{
+  {
+    std::lock_guard<std::mutex> lk(callbacks_mutex_);
+    auto it = callbacks_.begin();
+    while (it != callbacks_.end() && it->second.handle != handle) {
+      ++it;
+    }
+    if (it == callbacks_.end()) {
+      return false;
+    }
+    it->second.deadline = deadline;
+    publish_dispatch_list(it->first);
+  }
+  update_watchdog(deadline);
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerBase::set_slow_callback_handler(const slow_callback_handler_t & handler)
+{
+  std::lock_guard<std::mutex> lk(watchdog_mutex_);
+  slow_callback_handler_ = handler;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+uint64_t KeyboardHandlerBase::get_number_of_slow_callbacks() const
+{
+  return number_of_slow_callbacks_.load();
+}
+
+KEYBOARD_HANDLER_PUBLIC
+uint64_t KeyboardHandlerBase::get_number_of_slow_callbacks(callback_handle_t handle) const
+{
+  std::lock_guard<std::mutex> lk(watchdog_mutex_);
+  auto it = slow_callbacks_per_handle_.find(handle);
+  return it != slow_callbacks_per_handle_.end() ? it->second : 0;
+}
+
+void KeyboardHandlerBase::update_watchdog(std::chrono::nanoseconds deadline)
+{
+  if (deadline.count() <= 0 || !is_init_succeed_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lk(watchdog_mutex_);
+  std::chrono::nanoseconds period = deadline / 4;
+  if (period < std::chrono::milliseconds(1)) {
+    period = std::chrono::milliseconds(1);
+  }
+  if (period < watchdog_period_) {
+    watchdog_period_ = period;
+    watchdog_cv_.notify_one();
+  }
+  if (!watchdog_thread_.joinable()) {
+    watchdog_thread_ = std::thread(&KeyboardHandlerBase::run_watchdog, this);
+  }
+  is_watchdog_enabled_.store(true, std::memory_order_relaxed);
+}
+
+void KeyboardHandlerBase::run_watchdog()
+{
+  std::unique_lock<std::mutex> lk(watchdog_mutex_);
+  while (!watchdog_exit_) {
+    watchdog_cv_.wait_for(lk, watchdog_period_);
+    if (watchdog_exit_) {
+      break;
+    }
+    lk.unlock();
+    check_watchdog_slot(watchdog_slot_);
+    size_t number_of_shards = number_of_dispatch_shards_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < number_of_shards; i++) {
+      check_watchdog_slot(dispatch_shards_[i]->watchdog_slot);
+    }
+    lk.lock();
+  }
+}
+
+void KeyboardHandlerBase::check_watchdog_slot(WatchdogSlot & slot)
+{
+  uint64_t call_id = slot.call_id.load(std::memory_order_acquire);
+  if ((call_id & WATCHDOG_SLOT_STATE_MASK) != WATCHDOG_SLOT_RUNNING ||
+    call_id == slot.reported_call_id)
+  {
+    return;
+  }
+  SlowCallbackInfo info;
+  info.handle = slot.handle.load(std::memory_order_relaxed);
+  info.key_code = static_cast<KeyCode>(slot.key_code.load(std::memory_order_relaxed));
+  info.key_modifiers =
+    static_cast<KeyModifiers>(slot.key_modifiers.load(std::memory_order_relaxed));
+  info.deadline = std::chrono::nanoseconds(slot.deadline_ns.load(std::memory_order_relaxed));
+  int64_t start_time_ns = slot.start_time_ns.load(std::memory_order_relaxed);
+  // Fields written by the next call are ordered before its call_id by the writer's release
+  // fence, so reading any of them guarantees that the load below observes the changed call_id
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (slot.call_id.load(std::memory_order_relaxed) != call_id) {
+    // Callback returned or next call started while fields were read
+    return;
+  }
+  info.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()) -
+    std::chrono::nanoseconds(start_time_ns);
+  if (info.elapsed <= info.deadline) {
+    return;
+  }
+  slot.reported_call_id = call_id;
+  number_of_slow_callbacks_.fetch_add(1, std::memory_order_relaxed);
+
+  slow_callback_handler_t handler;
+  {
+    std::lock_guard<std::mutex> lk(watchdog_mutex_);
+    slow_callbacks_per_handle_[info.handle]++;
+    handler = slow_callback_handler_;
+  }
+  if (is_log_enabled(LogSeverity::WARN)) {
+    std::stringstream ss;
+    ss << "Callback " << info.handle << " for key '" << enum_key_code_to_str(info.key_code) <<
+      "' with modifiers '" << enum_key_modifiers_to_str(info.key_modifiers) <<
+      "' exceeded deadline of " <<
+      std::chrono::duration_cast<std::chrono::microseconds>(info.deadline).count() <<
+      " us, running for " <<
+      std::chrono::duration_cast<std::chrono::microseconds>(info.elapsed).count() << " us";
+    log(LogSeverity::WARN, ss.str());
+  }
+  if (handler) {
+    handler(info);
+  }
+}
+
+void KeyboardHandlerBase::stop_watchdog()
+{
+  {
+    std::lock_guard<std::mutex> lk(watchdog_mutex_);
+    watchdog_exit_ = true;
+  }
+  watchdog_cv_.notify_one();
+  if (watchdog_thread_.joinable()) {
+    watchdog_thread_.join();
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::KeyboardHandlerBase(std::shared_ptr<Clock> clock)
+: clock_(clock != nullptr ? std::move(clock) : std::make_shared<SteadyClock>()),
+  callbacks_per_key_code_(
+    new std::atomic<uint32_t>[static_cast<size_t>(KeyCode::END_OF_KEY_CODE_ENUM)]()),
+  timer_wheel_(std::chrono::milliseconds(1), clock_->now())
+{}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::~KeyboardHandlerBase()
+{
+  stop_sharded_dispatch();
+  stop_watchdog();
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerBase::enable_sharded_dispatch(size_t number_of_shards, size_t queue_capacity)
+{
+  if (number_of_shards == 0 || !is_init_succeed_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lk(callbacks_mutex_);
+  if (!dispatch_shards_.empty()) {
+    return false;
+  }
+  for (size_t i = 0; i < number_of_shards; i++) {
+    dispatch_shards_.push_back(std::make_shared<DispatchShard>(queue_capacity));
+  }
+  publish_all_dispatch_lists();
+  for (auto & shard : dispatch_shards_) {
+    DispatchShard * shard_ptr = shard.get();
+    shard->worker_thread = std::thread([this, shard_ptr]() {run_dispatch_shard(*shard_ptr);});
+  }
+  number_of_dispatch_shards_.store(number_of_shards, std::memory_order_release);
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+size_t KeyboardHandlerBase::get_dispatch_shard(KeyCode key_code, KeyModifiers key_modifiers) const
+{
+  size_t number_of_shards = number_of_dispatch_shards_.load(std::memory_order_acquire);
+  if (number_of_shards == 0) {
+    return 0;
+  }
+  // Fibonacci hashing mixes bits of key_and_modifiers_hash_fn which leaves low bits of key code
+  // in the upper bits of the hash.
+  uint64_t hash = key_and_modifiers_hash_fn()(KeyAndModifiers{key_code, key_modifiers});
+  return static_cast<size_t>(((hash * 0x9E3779B97F4A7C15ULL) >> 32) % number_of_shards);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+std::vector<KeyboardHandlerBase::DispatchShardStats>
+KeyboardHandlerBase::get_dispatch_shard_stats() const
+{
+  size_t number_of_shards = number_of_dispatch_shards_.load(std::memory_order_acquire);
+  std::vector<DispatchShardStats> stats;
+  stats.reserve(number_of_shards);
+  for (size_t i = 0; i < number_of_shards; i++) {
+    const DispatchShard & shard = *dispatch_shards_[i];
+    stats.push_back(
+      DispatchShardStats{shard.queue.size(), shard.max_queue_depth.load(),
+        shard.number_of_dispatched_key_presses.load(), shard.number_of_stalls.load()});
+  }
+  return stats;
+}
+
+void KeyboardHandlerBase::stop_sharded_dispatch()
+{
+  for (auto & shard : dispatch_shards_) {
+    {
+      std::lock_guard<std::mutex> lk(shard->worker_mutex);
+      shard->exit.store(true);
+    }
+    shard->worker_cv.notify_one();
+  }
+  for (auto & shard : dispatch_shards_) {
+    if (shard->worker_thread.joinable()) {
+      shard->worker_thread.join();
+    }
+  }
+}
+
+void KeyboardHandlerBase::push_to_dispatch_shard(
+  const KeyAndModifiers & key_and_modifiers, KeyEventType event_type)
+{
+  DispatchShard & shard =
+    *dispatch_shards_[get_dispatch_shard(key_and_modifiers.key_code,
+      key_and_modifiers.key_modifiers)];
+  DispatchShard::DispatchedKeyEvent key_event{key_and_modifiers, event_type};
+  if (!shard.queue.try_push(key_event)) {
+    shard.number_of_stalls.fetch_add(1, std::memory_order_relaxed);
+    do {
+      {
+        std::lock_guard<std::mutex> lk(shard.worker_mutex);
+        shard.worker_cv.notify_one();
+      }
+      std::this_thread::yield();
+    } while (!shard.queue.try_push(key_event));
+  }
+  // Keyboard handler's thread is the only producer
+  size_t queue_depth = shard.queue.size();
+  if (queue_depth > shard.max_queue_depth.load(std::memory_order_relaxed)) {
+    shard.max_queue_depth.store(queue_depth, std::memory_order_relaxed);
+  }
+  // Take the mutex only when worker is going to sleep or sleeping
+  if (shard.worker_sleeping.load()) {
+    std::lock_guard<std::mutex> lk(shard.worker_mutex);
+    shard.worker_cv.notify_one();
+  }
+}
+
+void KeyboardHandlerBase::run_dispatch_shard(DispatchShard & shard)
+{
+  // Decrement is ordered before the check of is_deleted, so either delete_key_press_callback
+  // is notified or it sees the decremented counter before waiting
+  auto finish_call = [](CallTracker & tracker) {
+      tracker.number_of_calls.fetch_sub(1);
+      if (tracker.is_deleted.load()) {
+        std::lock_guard<std::mutex> lk(tracker.mutex);
+        tracker.calls_finished_cv.notify_all();
+      }
+    };
+  while (true) {
+    DispatchShard::DispatchedKeyEvent key_event;
+    while (shard.queue.try_pop(key_event)) {
+      const KeyAndModifiers & key_and_modifiers = key_event.key_and_modifiers;
+      // Mutex is taken only when callbacks changed since the previous key press
+      uint64_t generation = dispatch_snapshot_generation_.load(std::memory_order_acquire);
+      if (generation != shard.snapshot_generation) {
+        std::lock_guard<std::mutex> lk(callbacks_mutex_);
+        shard.snapshot = dispatch_snapshot_;
+        shard.snapshot_generation = generation;
+      }
+      // Call callbacks without callbacks_mutex_ to let other shards run in parallel
+      bool has_expired_callbacks = false;
+      auto list_it = shard.snapshot->dispatch_lists.find(key_and_modifiers);
+      if (list_it != shard.snapshot->dispatch_lists.end()) {
+        for (const callback_data & data : *list_it->second) {
+          if (!is_callback_for_event(data, key_event.event_type)) {
+            continue;
+          }
+          // Counted before the check to let delete_key_press_callback either see the call or
+          // make it skip the deleted callback
+          CallTracker & tracker = *data.tracker;
+          tracker.number_of_calls.fetch_add(1);
+          if (tracker.is_deleted.load()) {
+            finish_call(tracker);
+            continue;
+          }
+          const void * outer_call_tracker = t_current_call_tracker;
+          t_current_call_tracker = &tracker;
+          bool is_consumed = false;
+          // Released after the call is finished, so deleting callback from the owner's
+          // destructor doesn't wait for this call
+          std::shared_ptr<void> owner;
+          if (!invoke_callback(
+              data, key_and_modifiers.key_code, key_and_modifiers.key_modifiers,
+              key_event.event_type, shard.watchdog_slot, is_consumed, owner))
+          {
+            has_expired_callbacks = true;
+          }
+          t_current_call_tracker = outer_call_tracker;
+          finish_call(tracker);
+          owner.reset();
+          if (is_consumed) {
+            break;
+          }
+        }
+      }
+      if (has_expired_callbacks) {
+        std::vector<callback_data> erased_callbacks;
+        std::lock_guard<std::mutex> lk(callbacks_mutex_);
+        prune_expired_callbacks(key_and_modifiers, erased_callbacks);
+      }
+      shard.number_of_dispatched_key_presses.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (shard.exit.load()) {
+      break;
+    }
+    std::unique_lock<std::mutex> lk(shard.worker_mutex);
+    shard.worker_sleeping.store(true);
+    // Re-check after announcing sleep: producer which pushed key press before it could see
+    // worker_sleeping == true will not notify.
+    if (shard.queue.empty() && !shard.exit.load()) {
+      shard.worker_cv.wait_for(lk, std::chrono::milliseconds(100));
+    }
+    shard.worker_sleeping.store(false);
+  }
+}
+
+bool KeyboardHandlerBase::push_event(
+  KeyCode key_code, KeyModifiers key_modifiers, KeyEventType event_type)
+{
+  auto queue = event_queue_ptr_.load(std::memory_order_acquire);
+  if (queue == nullptr) {
+    return false;
+  }
+  if (!queue->try_push(
+      KeyEvent{key_code, key_modifiers, clock_->now(), event_type}))
+  {
+    dropped_events_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  // Take the mutex only when some consumer is going to sleep or sleeping
+  if (event_waiters_.load() != 0) {
+    std::lock_guard<std::mutex> lk(event_mutex_);
+    event_cv_.notify_all();
+  }
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerBase::enable_event_queue(size_t capacity)
+{
+  if (!is_init_succeed_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lk(callbacks_mutex_);
+  if (event_queue_ != nullptr) {
+    return false;
+  }
+  event_queue_.reset(new BoundedQueue<KeyEvent>(capacity));
+  event_queue_ptr_.store(event_queue_.get(), std::memory_order_release);
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerBase::try_pop_event(KeyEvent & event) noexcept
+{
+  auto queue = event_queue_ptr_.load(std::memory_order_acquire);
+  return queue != nullptr && queue->try_pop(event);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerBase::wait_pop_event(KeyEvent & event, std::chrono::nanoseconds timeout)
+{
+  auto queue = event_queue_ptr_.load(std::memory_order_acquire);
+  if (queue == nullptr) {
+    return false;
+  }
+  if (queue->try_pop(event)) {
+    return true;
+  }
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::unique_lock<std::mutex> lk(event_mutex_);
+  event_waiters_.fetch_add(1);
+  bool is_popped = false;
+  // Re-check after announcing wait: producer which pushed event before it could see
+  // event_waiters_ != 0 will not notify. Event could be taken by the concurrent consumer, in
+  // this case keep waiting for the next one.
+  while (!is_popped) {
+    if (!event_cv_.wait_until(lk, deadline, [queue]() {return !queue->empty();})) {
+      break;
+    }
+    is_popped = queue->try_pop(event);
+  }
+  event_waiters_.fetch_sub(1);
+  return is_popped;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+size_t KeyboardHandlerBase::pop_events(KeyEvent * events, size_t max_events) noexcept
+{
+  auto queue = event_queue_ptr_.load(std::memory_order_acquire);
+  if (queue == nullptr || events == nullptr) {
+    return 0;
+  }
+  size_t number_of_events = 0;
+  while (number_of_events < max_events && queue->try_pop(events[number_of_events])) {
+    number_of_events++;
+  }
+  return number_of_events;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+uint64_t KeyboardHandlerBase::get_number_of_dropped_events() const
+{
+  return dropped_events_.load();
+}
+
+void KeyboardHandlerBase::prune_expired_callbacks(
+  const KeyAndModifiers & key_and_modifiers, std::vector<callback_data> & erased)
+{
+  auto range = callbacks_.equal_range(key_and_modifiers);
+  for (auto it = range.first; it != range.second; ) {
+    if (it->second.has_owner && it->second.owner.expired()) {
+      erased.push_back(erase_callback(it++));
+    } else {
+      ++it;
+    }
+  }
+}
+
 KeyboardHandlerBase::callback_handle_t KeyboardHandlerBase::get_new_handle()
 {
   static std::atomic<callback_handle_t> handle_count{0};
   return handle_count.fetch_add(1, std::memory_order_relaxed) + 1;
 }
+
+KEYBOARD_HANDLER_PUBLIC
+ScopedKeyBinding::ScopedKeyBinding(
+  KeyboardHandlerBase & keyboard_handler,
+  KeyboardHandlerBase::callback_handle_t handle) noexcept
+: keyboard_handler_(&keyboard_handler), handle_(handle) {}
+
+KEYBOARD_HANDLER_PUBLIC
+ScopedKeyBinding::ScopedKeyBinding(ScopedKeyBinding && other) noexcept
+: keyboard_handler_(other.keyboard_handler_), handle_(other.release()) {}
+
+KEYBOARD_HANDLER_PUBLIC
+ScopedKeyBinding & ScopedKeyBinding::operator=(ScopedKeyBinding && other) noexcept
+{
+  if (this != &other) {
+    reset();
+    keyboard_handler_ = other.keyboard_handler_;
+    handle_ = other.release();
+  }
+  return *this;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+ScopedKeyBinding::~ScopedKeyBinding()
+{
+  reset();
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void ScopedKeyBinding::reset() noexcept
+{
+  if (keyboard_handler_ != nullptr && handle_ != KeyboardHandlerBase::invalid_handle) {
+    keyboard_handler_->delete_key_press_callback(handle_);
+  }
+  handle_ = KeyboardHandlerBase::invalid_handle;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::callback_handle_t ScopedKeyBinding::release() noexcept
+{
+  auto handle = handle_;
+  handle_ = KeyboardHandlerBase::invalid_handle;
+  return handle;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::callback_handle_t ScopedKeyBinding::get() const noexcept
+{
+  return handle_;
+}
@@ -0,0 +1,432 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include "keyboard_handler/keyboard_handler_evdev_impl.hpp"
+
+namespace
+{
+/// Number of input events read out from the device at once.
+constexpr size_t READ_BUFFER_EVENTS = 64;
+/// Timeout of waiting for input to check exit request.
+constexpr int POLL_TIMEOUT_MS = 100;
+/// Value of the EV_KEY event.
+constexpr int32_t KEY_RELEASED = 0;
+constexpr int32_t KEY_PRESSED = 1;
+constexpr int32_t KEY_AUTOREPEAT = 2;
+}  // namespace
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerEvdevImpl::EvdevSettings::EvdevSettings() = default;
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerEvdevImpl::KeyboardHandlerEvdevImpl(
+  const std::string & device_path, const EvdevSettings & settings)
+: settings_(settings)
+{
+  std::string error_message;
+  std::error_code error = init(device_path, error_message);
+  if (error) {
+    throw_init_error(error, error_message);
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerEvdevImpl::KeyboardHandlerEvdevImpl(
+  std::error_code & error, const std::string & device_path, const EvdevSettings & settings)
+: settings_(settings)
+{
+  std::string error_message;
+  error = init(device_path, error_message);
+  if (error) {
+    log(LogSeverity::ERR, error_message);
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerResult<KeyboardHandlerEvdevImpl> KeyboardHandlerEvdevImpl::create(
+  const std::string & device_path, const EvdevSettings & settings)
+{
+  std::error_code error;
+  std::unique_ptr<KeyboardHandlerEvdevImpl> keyboard_handler(
+    new KeyboardHandlerEvdevImpl(error, device_path, settings));
+  if (error) {
+    return error;
+  }
+  return keyboard_handler;
+}
+
+std::error_code KeyboardHandlerEvdevImpl::init(
+  const std::string & device_path, std::string & error_message)
+{
+  for (size_t i = 0; i < STATIC_KEY_MAP_LENGTH; i++) {
+    key_codes_map_.emplace(DEFAULT_STATIC_KEY_MAP[i].scancode, DEFAULT_STATIC_KEY_MAP[i]);
+  }
+
+  // Non blocking to not wait in open() for the writer of the named pipe. Reader thread waits for
+  // input in poll().
+  fd_ = open(device_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd_ == -1) {
+    int open_errno = errno;
+    error_message = "Error in open(\"" + device_path + "\"). errno = " + std::to_string(open_errno);
+    return std::error_code(open_errno, std::system_category());
+  }
+  if (settings_.grab_device && ioctl(fd_, EVIOCGRAB, 1) == -1) {
+    int grab_errno = errno;
+    close(fd_);
+    fd_ = -1;
+    error_message = "Error in ioctl(EVIOCGRAB) for \"" + device_path + "\". errno = " +
+      std::to_string(grab_errno);
+    return std::error_code(grab_errno, std::system_category());
+  }
+  if (is_log_enabled(LogSeverity::INFO)) {
+    char name[256] = {0};
+    // Fails for the files and pipes with recorded events
+    if (ioctl(fd_, EVIOCGNAME(sizeof(name) - 1), name) >= 0) {
+      log(LogSeverity::INFO, "Reading key events from \"" + std::string(name) + "\"");
+    }
+  }
+
+  is_init_succeed_ = true;
+
+  key_handler_thread_ = std::thread(
+    [this]() {
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+      // Reader loop reports its errors without exceptions, only callbacks could throw
+      try {
+        read_loop();
+      } catch (...) {
+        thread_exception_ptr = std::current_exception();
+      }
+#else
+      read_loop();
+#endif
+    });
+  return std::error_code();
+}
+
+void KeyboardHandlerEvdevImpl::read_loop()
+{
+  struct input_event events[READ_BUFFER_EVENTS];
+  // Pipe could return part of the event, keep it until the rest of it will be read out.
+  size_t buffered_bytes = 0;
+  do {
+    struct pollfd poll_fd = {fd_, POLLIN, 0};
+    // Wake up for the next timer if it's due earlier than the regular timeout
+    int timeout_ms = POLL_TIMEOUT_MS;
+    auto next_timer_deadline = get_next_timer_deadline();
+    if (next_timer_deadline != std::chrono::steady_clock::time_point::max()) {
+      auto time_to_next_timer = std::chrono::duration_cast<std::chrono::milliseconds>(
+        next_timer_deadline - clock_->now() +
+        std::chrono::microseconds(999)).count();
+      if (time_to_next_timer < timeout_ms) {
+        timeout_ms = time_to_next_timer > 0 ? static_cast<int>(time_to_next_timer) : 0;
+      }
+    }
+    int ret = poll(&poll_fd, 1, timeout_ms);
+    if (ret < 0 && errno != EINTR) {
+      int error_number = errno;
+      set_reader_error(error_number, "Error in poll(). errno = " + std::to_string(error_number));
+      break;
+    }
+    if (ret > 0) {
+      char * buff = reinterpret_cast<char *>(events);
+      ssize_t read_bytes = read(fd_, buff + buffered_bytes, sizeof(events) - buffered_bytes);
+      if (read_bytes < 0) {
+        if (errno == ENODEV) {
+          log(LogSeverity::WARN, "Input device disconnected. Keyboard handling stopped.");
+          break;
+        }
+        if (errno != EAGAIN && errno != EINTR) {
+          int error_number = errno;
+          set_reader_error(
+            error_number, "Error in read(). errno = " + std::to_string(error_number));
+          break;
+        }
+      } else if (read_bytes == 0) {
+        log(LogSeverity::INFO, "End of key events input. Keyboard handling stopped.");
+        break;
+      } else {
+        buffered_bytes += static_cast<size_t>(read_bytes);
+        size_t number_of_events = buffered_bytes / sizeof(struct input_event);
+        for (size_t i = 0; i < number_of_events && !exit_.load(); i++) {
+          const auto & ev = events[i];
+          int64_t event_time_us = static_cast<int64_t>(ev.input_event_sec) * 1000000 +
+            static_cast<int64_t>(ev.input_event_usec);
+          process_event(ev.type, ev.code, ev.value, event_time_us);
+        }
+        size_t processed_bytes = number_of_events * sizeof(struct input_event);
+        buffered_bytes -= processed_bytes;
+        if (buffered_bytes != 0) {
+          std::memmove(buff, buff + processed_bytes, buffered_bytes);
+        }
+      }
+    }
+    process_timers();
+  } while (!exit_.load());
+}
+
+KeyboardHandlerEvdevImpl::~KeyboardHandlerEvdevImpl()
+{
+  exit_ = true;
+  if (key_handler_thread_.joinable()) {
+    key_handler_thread_.join();
+  }
+  // Callbacks could refer to this object, finish dispatching before members will be destroyed
+  stop_sharded_dispatch();
+
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+  try {
+    if (thread_exception_ptr != nullptr) {
+      std::rethrow_exception(thread_exception_ptr);
+    }
+  } catch (const std::exception & e) {
+    log(LogSeverity::ERR, std::string("Caught exception: \"") + e.what() + "\"");
+  } catch (...) {
+    log(LogSeverity::ERR, "Caught unknown exception");
+  }
+#endif
+
+  if (fd_ != -1) {
+    // Closing file descriptor releases the grab
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+std::tuple<KeyboardHandlerBase::KeyCode, KeyboardHandlerBase::KeyModifiers>
+KeyboardHandlerEvdevImpl::scancode_to_enums(uint16_t scancode, KeyModifiers key_modifiers) const
+{
+  auto key_map_it = key_codes_map_.find(scancode);
+  if (key_map_it == key_codes_map_.end()) {
+    return std::make_tuple(KeyCode::UNKNOWN, key_modifiers);
+  }
+  const KeyMap & key_map = key_map_it->second;
+  if (key_modifiers && KeyModifiers::SHIFT && key_map.shifted_code != key_map.inner_code) {
+    // Shifted character already implies SHIFT, the same as in terminal
+    auto mods = static_cast<uint32_t>(key_modifiers) & ~static_cast<uint32_t>(KeyModifiers::SHIFT);
+    return std::make_tuple(key_map.shifted_code, static_cast<KeyModifiers>(mods));
+  }
+  return std::make_tuple(key_map.inner_code, key_modifiers);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerBase::KeyModifiers KeyboardHandlerEvdevImpl::get_held_key_modifiers() const
+{
+  return to_key_modifiers(modifier_keys_.load(std::memory_order_relaxed));
+}
+
+void KeyboardHandlerEvdevImpl::process_event(
+  uint16_t type, uint16_t code, int32_t value, int64_t event_time_us)
+{
+  if (type == EV_SYN) {
+    if (code == SYN_DROPPED) {
+      // Kernel buffer overrun. Events are dropped until the next SYN_REPORT.
+      log(LogSeverity::WARN, "Input events were dropped by kernel. Re-reading key state.");
+      is_dropping_events_ = true;
+    } else if (code == SYN_REPORT && is_dropping_events_) {
+      is_dropping_events_ = false;
+      resync_key_state();
+    }
+    return;
+  }
+  if (type != EV_KEY || is_dropping_events_) {
+    return;
+  }
+
+  process_long_presses(event_time_us);
+
+  uint32_t modifier_key = get_modifier_key(code);
+  if (modifier_key != 0) {
+    if (value == KEY_RELEASED) {
+      modifier_keys_.fetch_and(~modifier_key, std::memory_order_relaxed);
+    } else {
+      modifier_keys_.fetch_or(modifier_key, std::memory_order_relaxed);
+    }
+    return;
+  }
+
+  auto held_key_it = std::find_if(
+    held_keys_.begin(), held_keys_.end(),
+    [code](const HeldKey & held_key) {return held_key.scancode == code;});
+
+  if (value == KEY_PRESSED) {
+    KeyCode key_code = KeyCode::UNKNOWN;
+    KeyModifiers key_modifiers = KeyModifiers::NONE;
+    std::tie(key_code, key_modifiers) = scancode_to_enums(code, get_held_key_modifiers());
+    if (held_key_it != held_keys_.end()) {
+      // Release was lost, e.g. device was grabbed by another reader for a while
+      erase_held_key(held_key_it);
+    }
+    TimerWheel::timer_id_t timer_id = TimerWheel::invalid_timer_id;
+    if (settings_.long_press_threshold.count() > 0) {
+      timer_id = schedule_timer(
+        clock_->now() + settings_.long_press_threshold, [this, code]() {
+          auto it = std::find_if(
+            held_keys_.begin(), held_keys_.end(),
+            [code](const HeldKey & held_key) {return held_key.scancode == code;});
+          if (it != held_keys_.end()) {
+            it->long_press_timer_id = TimerWheel::invalid_timer_id;
+            report_long_press(*it);
+          }
+        });
+    }
+    held_keys_.push_back(
+      HeldKey{code, key_code, key_modifiers, event_time_us, timer_id, false});
+    if (is_log_enabled(LogSeverity::DEBUG)) {
+      std::stringstream ss;
+      ss << "Pressed evdev key code = " << code << ".";
+      auto modifiers_str = enum_key_modifiers_to_str(key_modifiers);
+      ss << " Detected as pressed key: " << modifiers_str;
+      if (!modifiers_str.empty()) {
+        ss << " + ";
+      }
+      ss << "'" << enum_key_code_to_str(key_code) << "'";
+      log(LogSeverity::DEBUG, ss.str());
+    }
+    dispatch_key_press(key_code, key_modifiers, KeyEventType::PRESS);
+    return;
+  }
+
+  if (held_key_it == held_keys_.end()) {
+    // Key was pressed before device was opened
+    return;
+  }
+  HeldKey held_key = *held_key_it;
+  if (value == KEY_AUTOREPEAT) {
+    dispatch_key_press(held_key.key_code, held_key.key_modifiers, KeyEventType::REPEAT);
+  } else if (value == KEY_RELEASED) {
+    erase_held_key(held_key_it);
+    dispatch_key_press(held_key.key_code, held_key.key_modifiers, KeyEventType::RELEASE);
+  }
+}
+
+void KeyboardHandlerEvdevImpl::process_long_presses(int64_t event_time_us)
+{
+  if (settings_.long_press_threshold.count() <= 0) {
+    return;
+  }
+  const int64_t threshold_us =
+    std::chrono::duration_cast<std::chrono::microseconds>(settings_.long_press_threshold).count();
+  // Index based loop since callbacks are called from this loop, held_keys_ is modified only by
+  // this thread.
+  for (size_t i = 0; i < held_keys_.size(); i++) {
+    if (event_time_us - held_keys_[i].event_time_us >= threshold_us) {
+      report_long_press(held_keys_[i]);
+    }
+  }
+}
+
+void KeyboardHandlerEvdevImpl::report_long_press(HeldKey & held_key)
+{
+  if (held_key.is_long_press_reported) {
+    return;
+  }
+  held_key.is_long_press_reported = true;
+  cancel_timer(held_key.long_press_timer_id);
+  held_key.long_press_timer_id = TimerWheel::invalid_timer_id;
+  dispatch_key_press(held_key.key_code, held_key.key_modifiers, KeyEventType::LONG_PRESS);
+}
+
+void KeyboardHandlerEvdevImpl::erase_held_key(std::vector<HeldKey>::iterator held_key_it)
+{
+  cancel_timer(held_key_it->long_press_timer_id);
+  held_keys_.erase(held_key_it);
+}
+
+void KeyboardHandlerEvdevImpl::resync_key_state()
+{
+  uint8_t key_state[KEY_MAX / 8 + 1] = {0};
+  // Fails for the files and pipes with recorded events, consider all keys as released then.
+  if (ioctl(fd_, EVIOCGKEY(sizeof(key_state)), key_state) < 0) {
+    std::memset(key_state, 0, sizeof(key_state));
+  }
+  auto is_held = [&key_state](uint16_t scancode) {
+      return (key_state[scancode / 8] & (1 << (scancode % 8))) != 0;
+    };
+
+  uint32_t modifier_keys = 0;
+  for (uint16_t scancode : {KEY_LEFTSHIFT, KEY_RIGHTSHIFT, KEY_LEFTCTRL, KEY_RIGHTCTRL,
+      KEY_LEFTALT, KEY_RIGHTALT})
+  {
+    if (is_held(scancode)) {
+      modifier_keys |= get_modifier_key(scancode);
+    }
+  }
+  modifier_keys_.store(modifier_keys, std::memory_order_relaxed);
+
+  // Release keys which were released while events were dropped. Keys pressed meanwhile are not
+  // reported since their press time is unknown.
+  for (size_t i = 0; i < held_keys_.size(); ) {
+    if (is_held(held_keys_[i].scancode)) {
+      i++;
+      continue;
+    }
+    HeldKey held_key = held_keys_[i];
+    erase_held_key(held_keys_.begin() + static_cast<std::ptrdiff_t>(i));
+    dispatch_key_press(held_key.key_code, held_key.key_modifiers, KeyEventType::RELEASE);
+  }
+}
+
+uint32_t KeyboardHandlerEvdevImpl::get_modifier_key(uint16_t scancode)
+{
+  switch (scancode) {
+    case KEY_LEFTSHIFT:
+      return LEFT_SHIFT;
+    case KEY_RIGHTSHIFT:
+      return RIGHT_SHIFT;
+    case KEY_LEFTCTRL:
+      return LEFT_CTRL;
+    case KEY_RIGHTCTRL:
+      return RIGHT_CTRL;
+    case KEY_LEFTALT:
+      return LEFT_ALT;
+    case KEY_RIGHTALT:
+      return RIGHT_ALT;
+    default:
+      return 0;
+  }
+}
+
+KeyboardHandlerBase::KeyModifiers KeyboardHandlerEvdevImpl::to_key_modifiers(
+  uint32_t modifier_keys)
+{
+  KeyModifiers key_modifiers = KeyModifiers::NONE;
+  if (modifier_keys & (LEFT_SHIFT | RIGHT_SHIFT)) {
+    key_modifiers = key_modifiers | KeyModifiers::SHIFT;
+  }
+  if (modifier_keys & (LEFT_CTRL | RIGHT_CTRL)) {
+    key_modifiers = key_modifiers | KeyModifiers::CTRL;
+  }
+  if (modifier_keys & (LEFT_ALT | RIGHT_ALT)) {
+    key_modifiers = key_modifiers | KeyModifiers::ALT;
+  }
+  return key_modifiers;
+}
+
+#endif  // #ifdef __linux__
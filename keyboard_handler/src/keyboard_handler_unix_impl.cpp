@@ -13,20 +13,84 @@
 // limitations under the License.
 
 #ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <algorithm>
 #include <csignal>
+#include <cstring>
 #include <exception>
-#include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <tuple>
+#include <utility>
+#include <vector>
 #include "keyboard_handler/keyboard_handler_unix_impl.hpp"
+#include "tracepoints.hpp"
 
-std::atomic_bool KeyboardHandlerUnixImpl::exit_{false};
+constexpr size_t KeyboardHandlerUnixImpl::READ_BUFFER_LENGTH;
+constexpr size_t KeyboardHandlerUnixImpl::INJECTED_INPUT_CAPACITY;
+constexpr size_t KeyboardHandlerUnixImpl::MAX_PLAYING_MACROS;
+constexpr size_t KeyboardHandlerUnixImpl::MAX_PENDING_INPUT_LENGTH;
+constexpr uint32_t KeyboardHandlerUnixImpl::BUSY_POLL_FOREGROUND_CHECK_PERIOD;
+constexpr uint32_t KeyboardHandlerUnixImpl::KITTY_DISAMBIGUATE_ESCAPE_CODES;
+constexpr uint32_t KeyboardHandlerUnixImpl::KITTY_REPORT_EVENT_TYPES;
+constexpr uint32_t KeyboardHandlerUnixImpl::KITTY_REPORT_ALTERNATE_KEYS;
+constexpr uint32_t KeyboardHandlerUnixImpl::KITTY_REPORT_ALL_KEYS_AS_ESCAPE_CODES;
+
+namespace
+{
+constexpr char ESC = 27;
+/// Incomplete sequence is decoded in legacy encoding if the rest of it didn't arrive in time.
+constexpr std::chrono::milliseconds PENDING_INPUT_TIMEOUT{50};
+
+/// Length of the reply to the terminal probe at pos: `CSI ? ... u`, `CSI ? ... c` or
+/// `DCS > | ... ST`.
+/// \return Length of the reply, 0 if input ends with the beginning of the reply or
+/// std::string::npos if it's not a reply.
+size_t get_probe_reply_length(const std::string & input, size_t pos)
+{
+  const size_t available = input.size() - pos;
+  if (available < 3) {
+    return available == 1 || input[pos + 1] == '[' || input[pos + 1] == 'P' ?
+           0 : std::string::npos;
+  }
+  if (input[pos + 1] == 'P' && input[pos + 2] == '>') {
+    size_t st_pos = input.find("\x1b\\", pos + 3);
+    return st_pos == std::string::npos ? 0 : st_pos + 2 - pos;
+  }
+  if (input[pos + 1] != '[' || input[pos + 2] != '?') {
+    return std::string::npos;
+  }
+  size_t final_pos = pos + 3;
+  while (final_pos < input.size() &&
+    ((input[final_pos] >= '0' && input[final_pos] <= '9') || input[final_pos] == ';'))
+  {
+    final_pos++;
+  }
+  if (final_pos == input.size()) {
+    return 0;
+  }
+  if (input[final_pos] != 'u' && input[final_pos] != 'c') {
+    return std::string::npos;
+  }
+  return final_pos + 1 - pos;
+}
+}  // namespace
+
+std::atomic<uint32_t> KeyboardHandlerUnixImpl::sigint_generation_{0};
 struct termios KeyboardHandlerUnixImpl::old_term_settings_ = {};
 KeyboardHandlerUnixImpl::tcsetattrFunction KeyboardHandlerUnixImpl::tcsetattr_fn_ = tcsetattr;
 KeyboardHandlerUnixImpl::signal_handler_type KeyboardHandlerUnixImpl::old_sigint_handler_ =
   SIG_DFL;
+KeyboardHandlerUnixImpl::signal_handler_type KeyboardHandlerUnixImpl::old_sigttin_handler_ =
+  SIG_DFL;
+KeyboardHandlerUnixImpl::signal_handler_type KeyboardHandlerUnixImpl::old_sigcont_handler_ =
+  SIG_DFL;
+std::atomic_bool KeyboardHandlerUnixImpl::sigcont_received_{false};
+std::atomic_bool KeyboardHandlerUnixImpl::kitty_keyboard_mode_pushed_{false};
 
 void KeyboardHandlerUnixImpl::on_signal(int signal_number)
 {
@@ -39,7 +103,8 @@ void KeyboardHandlerUnixImpl::on_signal(int signal_number)
       _exit(EXIT_FAILURE);
     }
   } else {
-    exit_ = true;
+    // Request exit from all live instances
+    sigint_generation_.fetch_add(1);
     KeyboardHandlerUnixImpl::restore_buffer_mode_for_stdin();
   }
 
@@ -51,6 +116,17 @@ void KeyboardHandlerUnixImpl::on_signal(int signal_number)
   }
 }
 
+void KeyboardHandlerUnixImpl::on_sigcont(int signal_number)
+{
+  sigcont_received_ = true;
+  if ((old_sigcont_handler_ != SIG_ERR) &&
+    (old_sigcont_handler_ != SIG_IGN) &&
+    (old_sigcont_handler_ != SIG_DFL))
+  {
+    old_sigcont_handler_(signal_number);
+  }
+}
+
 KEYBOARD_HANDLER_PUBLIC
 KeyboardHandlerUnixImpl::KeyboardHandlerUnixImpl()
 : KeyboardHandlerUnixImpl(read, isatty, tcgetattr, tcsetattr) {}
@@ -59,22 +135,45 @@ KEYBOARD_HANDLER_PUBLIC
 KeyboardHandlerUnixImpl::KeyboardHandlerUnixImpl(bool install_signal_handler)
 : KeyboardHandlerUnixImpl(read, isatty, tcgetattr, tcsetattr, install_signal_handler) {}
 
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerUnixImpl::KeyboardHandlerUnixImpl(
+  bool install_signal_handler,
+  ReaderBackend reader_backend)
+: KeyboardHandlerUnixImpl(
+    read, isatty, tcgetattr, tcsetattr, install_signal_handler, tcgetpgrp, reader_backend) {}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerUnixImpl::BusyPollSettings::BusyPollSettings() = default;
+
+KeyboardHandlerUnixImpl::FloodProtectionSettings::FloodProtectionSettings() = default;
+
+KeyboardHandlerUnixImpl::TerminalProbeSettings::TerminalProbeSettings() = default;
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerUnixImpl::KeyboardHandlerUnixImpl(
+  bool install_signal_handler,
+  const BusyPollSettings & busy_poll_settings)
+: KeyboardHandlerUnixImpl(
+    read, isatty, tcgetattr, tcsetattr, install_signal_handler, tcgetpgrp,
+    ReaderBackend::BUSY_POLL, busy_poll_settings) {}
+
 std::tuple<KeyboardHandlerBase::KeyCode, KeyboardHandlerBase::KeyModifiers>
 KeyboardHandlerUnixImpl::parse_input(const char * buff, ssize_t read_bytes)
 {
-#ifdef PRINT_DEBUG_INFO
-  std::cout << "Read " << read_bytes << " bytes: ";
-  if (read_bytes > 1) {
-    std::cout << "[] = {";
-    for (ssize_t i = 0; i < read_bytes; ++i) {
-      std::cout << static_cast<int>(buff[i]) << ", ";
+  if (is_log_enabled(LogSeverity::DEBUG)) {
+    std::stringstream ss;
+    ss << "Read " << read_bytes << " bytes: ";
+    if (read_bytes > 1) {
+      ss << "[] = {";
+      for (ssize_t i = 0; i < read_bytes; ++i) {
+        ss << static_cast<int>(buff[i]) << ", ";
+      }
+      ss << "'\\0'};";
+    } else {
+      ss << " : " << static_cast<int>(buff[0]) << " : '" << buff[0] << "'";
     }
-    std::cout << "'\\0'};";
-  } else {
-    std::cout << " : " << static_cast<int>(buff[0]) << " : '" << buff[0] << "'";
+    log(LogSeverity::DEBUG, ss.str());
   }
-  std::cout << std::endl;
-#endif
   KeyCode pressed_key_code = KeyCode::UNKNOWN;
   KeyModifiers key_modifiers = KeyModifiers::NONE;
 
@@ -113,6 +212,9 @@ KeyboardHandlerUnixImpl::parse_input(const char * buff, ssize_t read_bytes)
       pressed_key_code = key_map_it->second;
     }
   }
+  KEYBOARD_HANDLER_TRACEPOINT(
+    parse_input, static_cast<uint32_t>(pressed_key_code), static_cast<uint32_t>(key_modifiers),
+    read_bytes);
   return std::make_tuple(pressed_key_code, key_modifiers);
 }
 
@@ -122,22 +224,97 @@ KeyboardHandlerUnixImpl::KeyboardHandlerUnixImpl(
   const isattyFunction & isatty_fn,
   const tcgetattrFunction & tcgetattr_fn,
   const tcsetattrFunction & tcsetattr_fn,
-  bool install_signal_handler)
-: stdin_fd_(fileno(stdin))
+  bool install_signal_handler,
+  const tcgetpgrpFunction & tcgetpgrp_fn,
+  ReaderBackend reader_backend,
+  const BusyPollSettings & busy_poll_settings,
+  std::shared_ptr<Clock> clock)
+: KeyboardHandlerBase(std::move(clock)), tcgetpgrp_fn_(tcgetpgrp_fn), stdin_fd_(fileno(stdin)),
+  reader_backend_(reader_backend), busy_poll_settings_(busy_poll_settings)
 {
-  if (read_fn == nullptr) {
-    throw std::invalid_argument("KeyboardHandlerUnixImpl read_fn must be non-empty.");
+  std::string error_message;
+  std::error_code error = init(
+    read_fn, isatty_fn, tcgetattr_fn, tcsetattr_fn, install_signal_handler, error_message);
+  if (error) {
+    throw_init_error(error, error_message);
   }
-  if (isatty_fn == nullptr) {
-    throw std::invalid_argument("KeyboardHandlerUnixImpl isatty_fn must be non-empty.");
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerUnixImpl::KeyboardHandlerUnixImpl(
+  std::error_code & error,
+  const readFunction & read_fn,
+  const isattyFunction & isatty_fn,
+  const tcgetattrFunction & tcgetattr_fn,
+  const tcsetattrFunction & tcsetattr_fn,
+  bool install_signal_handler,
+  const tcgetpgrpFunction & tcgetpgrp_fn,
+  ReaderBackend reader_backend,
+  const BusyPollSettings & busy_poll_settings,
+  std::shared_ptr<Clock> clock)
+: KeyboardHandlerBase(std::move(clock)), tcgetpgrp_fn_(tcgetpgrp_fn), stdin_fd_(fileno(stdin)),
+  reader_backend_(reader_backend), busy_poll_settings_(busy_poll_settings)
+{
+  std::string error_message;
+  error = init(
+    read_fn, isatty_fn, tcgetattr_fn, tcsetattr_fn, install_signal_handler, error_message);
+  if (error) {
+    log(LogSeverity::ERR, error_message);
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerResult<KeyboardHandlerUnixImpl> KeyboardHandlerUnixImpl::create(
+  bool install_signal_handler, ReaderBackend reader_backend)
+{
+  std::error_code error;
+  std::unique_ptr<KeyboardHandlerUnixImpl> keyboard_handler(
+    new KeyboardHandlerUnixImpl(
+      error, read, isatty, tcgetattr, tcsetattr, install_signal_handler, tcgetpgrp,
+      reader_backend));
+  if (error) {
+    return error;
   }
-  if (tcgetattr_fn == nullptr) {
-    throw std::invalid_argument("KeyboardHandlerUnixImpl tcgetattr_fn must be non-empty.");
+  return keyboard_handler;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerResult<KeyboardHandlerUnixImpl> KeyboardHandlerUnixImpl::create(
+  bool install_signal_handler, const BusyPollSettings & busy_poll_settings)
+{
+  std::error_code error;
+  std::unique_ptr<KeyboardHandlerUnixImpl> keyboard_handler(
+    new KeyboardHandlerUnixImpl(
+      error, read, isatty, tcgetattr, tcsetattr, install_signal_handler, tcgetpgrp,
+      ReaderBackend::BUSY_POLL, busy_poll_settings));
+  if (error) {
+    return error;
   }
-  if (tcsetattr_fn == nullptr) {
-    throw std::invalid_argument("KeyboardHandlerUnixImpl tcsetattr_fn must be non-empty.");
+  return keyboard_handler;
+}
+
+std::error_code KeyboardHandlerUnixImpl::init(
+  const readFunction & read_fn,
+  const isattyFunction & isatty_fn,
+  const tcgetattrFunction & tcgetattr_fn,
+  const tcsetattrFunction & tcsetattr_fn,
+  bool install_signal_handler,
+  std::string & error_message)
+{
+  const char * empty_function_name =
+    read_fn == nullptr ? "read_fn" :
+    isatty_fn == nullptr ? "isatty_fn" :
+    tcgetattr_fn == nullptr ? "tcgetattr_fn" :
+    tcsetattr_fn == nullptr ? "tcsetattr_fn" :
+    tcgetpgrp_fn_ == nullptr ? "tcgetpgrp_fn" : nullptr;
+  if (empty_function_name != nullptr) {
+    error_message =
+      std::string("KeyboardHandlerUnixImpl ") + empty_function_name + " must be non-empty.";
+    return std::make_error_code(std::errc::invalid_argument);
   }
   tcsetattr_fn_ = tcsetattr_fn;
+  // SIGINT received before this instance was created doesn't request its exit
+  sigint_generation_at_init_ = sigint_generation_.load();
 
   for (size_t i = 0; i < STATIC_KEY_MAP_LENGTH; i++) {
     key_codes_map_.emplace(
@@ -149,13 +326,15 @@ KeyboardHandlerUnixImpl::KeyboardHandlerUnixImpl(
   if (!isatty_fn(stdin_fd_)) {
     // If stdin is not a real terminal (redirected to text file or pipe ) can't do much here
     // with keyboard handling.
-    std::cerr << "stdin is not a terminal device. Keyboard handling disabled.";
-    return;
+    log(LogSeverity::WARN, "stdin is not a terminal device. Keyboard handling disabled.");
+    return std::error_code();
   }
 
   struct termios new_term_settings;
   if (tcgetattr_fn(stdin_fd_, &old_term_settings_) == -1) {
-    throw std::runtime_error("Error in tcgetattr(). errno = " + std::to_string(errno));
+    int error_number = errno;
+    error_message = "Error in tcgetattr(). errno = " + std::to_string(error_number);
+    return std::error_code(error_number, std::system_category());
   }
 
   if (install_signal_handler) {
@@ -163,10 +342,23 @@ KeyboardHandlerUnixImpl::KeyboardHandlerUnixImpl(
     old_sigint_handler_ = std::signal(SIGINT, KeyboardHandlerUnixImpl::on_signal);
     // terminal in original (buffered) mode in case of abnormal program termination.
     if (old_sigint_handler_ == SIG_ERR) {
-      throw std::runtime_error("Error. Can't install SIGINT handler");
+      int error_number = errno;
+      error_message = "Error. Can't install SIGINT handler";
+      return std::error_code(error_number, std::system_category());
+    }
+    // Restored on the error paths below, destructor doesn't run if constructor throws
+    install_signal_handler_ = true;
+    // With ignored SIGTTIN read() from the background process returns EIO instead of stopping
+    // the whole process.
+    old_sigttin_handler_ = std::signal(SIGTTIN, SIG_IGN);
+    old_sigcont_handler_ = std::signal(SIGCONT, KeyboardHandlerUnixImpl::on_sigcont);
+    if (old_sigttin_handler_ == SIG_ERR || old_sigcont_handler_ == SIG_ERR) {
+      int error_number = errno;
+      error_message = "Error. Can't install SIGTTIN or SIGCONT handler";
+      restore_signal_handlers();
+      return std::error_code(error_number, std::system_category());
     }
   }
-  install_signal_handler_ = install_signal_handler;
 
   new_term_settings = old_term_settings_;
   // Set stdin to unbuffered mode for reading directly from the stdin.
@@ -174,95 +366,679 @@ KeyboardHandlerUnixImpl::KeyboardHandlerUnixImpl(
   new_term_settings.c_lflag &= ~(ICANON | ECHO);
   new_term_settings.c_cc[VMIN] = 0;   // 0 means purely timeout driven readout
   new_term_settings.c_cc[VTIME] = 1;  // Wait maximum for 0.1 sec since start of the read() call.
+  if (reader_backend_ == ReaderBackend::BUSY_POLL) {
+    // read() returns immediately without input. Unlike O_NONBLOCK it doesn't change file status
+    // flags of the open file description shared with the shell and other processes, and is
+    // reverted along with the other terminal settings.
+    new_term_settings.c_cc[VTIME] = 0;
+  }
+
+  // Changing terminal settings from the background process, e.g. started with '&', raises
+  // SIGTTOU which stops the whole process. Reader thread applies them once in the foreground.
+  is_raw_mode_deferred_ = !is_in_foreground();
+  if (!is_raw_mode_deferred_ && tcsetattr_fn_(stdin_fd_, TCSANOW, &new_term_settings) == -1) {
+    int error_number = errno;
+    error_message = "Error in tcsetattr(). errno = " + std::to_string(error_number);
+    restore_signal_handlers();
+    return std::error_code(error_number, std::system_category());
+  }
+  raw_term_settings_ = new_term_settings;
 
-  if (tcsetattr_fn_(stdin_fd_, TCSANOW, &new_term_settings) == -1) {
-    throw std::runtime_error("Error in tcsetattr(). errno = " + std::to_string(errno));
+  if (reader_backend_ == ReaderBackend::POLL) {
+    if (pipe(wake_up_pipe_fds_) == -1) {
+      int pipe_errno = errno;
+      error_message = "Error in pipe(). errno = " + std::to_string(pipe_errno);
+      restore_buffer_mode_for_stdin();
+      restore_signal_handlers();
+      return std::error_code(pipe_errno, std::system_category());
+    }
+    for (auto fd : wake_up_pipe_fds_) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
   }
   is_init_succeed_ = true;
+  // Timers and input timeouts could become due without any input
+  clock_advance_callback_handle_ = clock_->add_advance_callback([this]() {wake_up_reader();});
 
   key_handler_thread_ = std::thread(
     [ = ]() {
+      // Changing terminal settings from the background process raises SIGTTOU which stops the
+      // whole process. Block it in the reader thread to be able to restore terminal settings
+      // on exit even if process is in the background.
+      sigset_t sigttou_mask;
+      sigemptyset(&sigttou_mask);
+      sigaddset(&sigttou_mask, SIGTTOU);
+      pthread_sigmask(SIG_BLOCK, &sigttou_mask, nullptr);
+      pin_reader_thread();
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+      // Reader loop reports its errors without exceptions, only callbacks could throw
       try {
-        static constexpr size_t BUFF_LEN = 10;
-        char buff[BUFF_LEN] = {0};
-        do {
-          ssize_t read_bytes = read_fn(stdin_fd_, buff, BUFF_LEN);
-          if (read_bytes < 0 && errno != EAGAIN) {
-            throw std::runtime_error("Error in read(). errno = " + std::to_string(errno));
-          }
-
-          if (read_bytes == 0) {
-            // Do nothing. 0 means read() returned by timeout.
-          } else {  // read_bytes > 0
-            buff[std::min(BUFF_LEN - 1, static_cast<size_t>(read_bytes))] = '\0';
-
-            auto key_code_and_modifiers = parse_input(buff, read_bytes);
-
-            KeyCode pressed_key_code = std::get<0>(key_code_and_modifiers);
-            KeyModifiers key_modifiers = std::get<1>(key_code_and_modifiers);
-
-#ifdef PRINT_DEBUG_INFO
-            auto modifiers_str = enum_key_modifiers_to_str(key_modifiers);
-            std::cout << "pressed key: " << modifiers_str;
-            if (!modifiers_str.empty()) {
-              std::cout << " + ";
-            }
-            std::cout << "'" << enum_key_code_to_str(pressed_key_code) << "'" << std::endl;
-#endif
-            std::lock_guard<std::mutex> lk(callbacks_mutex_);
-            auto range = callbacks_.equal_range(KeyAndModifiers{pressed_key_code, key_modifiers});
-            for (auto it = range.first; it != range.second; ++it) {
-              it->second.callback(pressed_key_code, key_modifiers);
-            }
-          }
-        } while (!exit_.load());
+        read_loop(read_fn);
       } catch (...) {
         thread_exception_ptr = std::current_exception();
       }
+#else
+      read_loop(read_fn);
+#endif
 
       // Restore buffer mode for stdin
       if (!restore_buffer_mode_for_stdin()) {
-        if (thread_exception_ptr == nullptr) {
-          try {
-            throw std::runtime_error(
-              "Error in tcsetattr old_term_settings. errno = " + std::to_string(errno));
-          } catch (...) {
-            thread_exception_ptr = std::current_exception();
-          }
-        } else {
-          std::cerr <<
-            "Error in tcsetattr old_term_settings. errno = " + std::to_string(errno) << std::endl;
-        }
+        int error_number = errno;
+        set_reader_error(
+          error_number,
+          "Error in tcsetattr old_term_settings. errno = " + std::to_string(error_number));
       }
     });
+  return std::error_code();
 }
 
-KeyboardHandlerUnixImpl::~KeyboardHandlerUnixImpl()
+void KeyboardHandlerUnixImpl::read_loop(const readFunction & read_fn)
+{
+  char buff[READ_BUFFER_LENGTH] = {0};
+  bool in_background = is_raw_mode_deferred_;
+  do {
+    begin_reader_iteration();
+    process_injected_input();
+    process_timers();
+    process_terminal_probe();
+    if (is_iteration_budget_exhausted()) {
+      // Rest of the injected input waits for the next iteration, stdin is still read once per
+      // iteration to not starve real input while other threads inject continuously
+      number_of_budget_yields_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (in_background || (is_foreground_check_due() && !is_in_foreground())) {
+      // Don't read and don't touch terminal settings while in the background
+      wait_for_foreground();
+      if (is_exit_requested()) {
+        break;
+      }
+      // Shell could change terminal settings while process was in the background
+      auto term_settings = get_term_settings(passthrough_mode_.load());
+      if (tcsetattr_fn_(stdin_fd_, TCSANOW, &term_settings) == -1) {
+        int error_number = errno;
+        set_reader_error(
+          error_number, "Error in tcsetattr(). errno = " + std::to_string(error_number));
+        break;
+      }
+      in_background = false;
+    }
+    ssize_t read_bytes = read_input(read_fn, buff, READ_BUFFER_LENGTH);
+    KEYBOARD_HANDLER_TRACEPOINT(read, stdin_fd_, read_bytes);
+    if (read_bytes < 0 && errno == EIO) {
+      // read() from the background process with ignored SIGTTIN
+      in_background = true;
+      continue;
+    }
+    if (read_bytes < 0 && errno != EAGAIN && errno != EINTR) {
+      int error_number = errno;
+      set_reader_error(error_number, "Error in read(). errno = " + std::to_string(error_number));
+      break;
+    }
+
+    if (read_bytes > 0) {
+      iteration_bytes_ += static_cast<size_t>(read_bytes);
+      buff[std::min(READ_BUFFER_LENGTH - 1, static_cast<size_t>(read_bytes))] = '\0';
+      process_input(buff, read_bytes);
+    } else if (read_bytes == 0 && !pending_input_.empty()) {
+      flush_pending_input();
+    }
+    // read_bytes == 0 means read() returned by timeout.
+  } while (!is_exit_requested());
+}
+
+void KeyboardHandlerUnixImpl::process_input(const char * buff, ssize_t read_bytes)
+{
+  if (passthrough_mode_.load() == PassthroughMode::ALL) {
+    forward_to_passthrough(buff, read_bytes);
+    return;
+  }
+  if (kitty_keyboard_flags_.load(std::memory_order_relaxed) != 0) {
+    // Replies to the terminal probe are split from the key presses by the streaming parser
+    process_kitty_input(buff, read_bytes);
+    return;
+  }
+  if (terminal_probe_state_.load(std::memory_order_relaxed) == TerminalProbeState::PENDING) {
+    process_probe_input(buff, read_bytes);
+    return;
+  }
+  if (!pending_input_.empty()) {
+    process_kitty_input(buff, read_bytes);
+    return;
+  }
+  process_legacy_input(buff, read_bytes);
+}
+
+void KeyboardHandlerUnixImpl::process_probe_input(const char * buff, ssize_t read_bytes)
+{
+  std::string input;
+  input.swap(pending_input_);
+  input.append(buff, static_cast<size_t>(read_bytes));
+  // Legacy parser expects null terminated buffer
+  auto process_key_input = [this, &input](size_t begin, size_t end) {
+      if (begin != end) {
+        std::string key_input = input.substr(begin, end - begin);
+        process_legacy_input(key_input.c_str(), static_cast<ssize_t>(key_input.size()));
+      }
+    };
+  size_t key_input_pos = 0;
+  size_t pos = 0;
+  while ((pos = input.find(ESC, pos)) != std::string::npos) {
+    size_t length = get_probe_reply_length(input, pos);
+    if (length == std::string::npos) {
+      pos++;
+      continue;
+    }
+    // Key presses read together with the reply
+    process_key_input(key_input_pos, pos);
+    if (length == 0) {
+      // Wait for the rest of the reply
+      pending_input_ = input.substr(pos);
+      pending_input_time_ = clock_->now();
+      if (pending_input_.size() > MAX_PENDING_INPUT_LENGTH) {
+        pending_input_time_ = std::chrono::steady_clock::time_point();
+        flush_pending_input();
+      }
+      return;
+    }
+    if (input[pos + 1] == 'P') {
+      process_dcs_sequence(input.c_str() + pos, length);
+    } else {
+      process_csi_sequence(input.c_str() + pos, length);
+    }
+    pos += length;
+    key_input_pos = pos;
+    if (terminal_probe_state_.load() != TerminalProbeState::PENDING) {
+      // Rest of the input is decoded by the parser of the new state
+      if (key_input_pos != input.size()) {
+        process_input(
+          input.c_str() + key_input_pos, static_cast<ssize_t>(input.size() - key_input_pos));
+      }
+      return;
+    }
+  }
+  process_key_input(key_input_pos, input.size());
+}
+
+void KeyboardHandlerUnixImpl::process_legacy_input(const char * buff, ssize_t read_bytes)
+{
+  auto key_code_and_modifiers = parse_input(buff, read_bytes);
+  process_key_event(
+    std::get<0>(key_code_and_modifiers), std::get<1>(key_code_and_modifiers),
+    KeyEventType::PRESS, buff, read_bytes);
+}
+
+void KeyboardHandlerUnixImpl::process_key_event(
+  KeyCode pressed_key_code, KeyModifiers key_modifiers, KeyEventType event_type,
+  const char * buff, ssize_t read_bytes)
+{
+  iteration_events_++;
+  if (!admit_key_event(pressed_key_code, key_modifiers, event_type)) {
+    return;
+  }
+  if (is_log_enabled(LogSeverity::DEBUG)) {
+    auto modifiers_str = enum_key_modifiers_to_str(key_modifiers);
+    std::stringstream ss;
+    ss << "pressed key: " << modifiers_str;
+    if (!modifiers_str.empty()) {
+      ss << " + ";
+    }
+    ss << "'" << enum_key_code_to_str(pressed_key_code) << "'";
+    log(LogSeverity::DEBUG, ss.str());
+  }
+  bool consumed = false;
+  if (pressed_key_code == KeyCode::UNKNOWN && has_unknown_sequence_callback_.load()) {
+    std::lock_guard<std::mutex> lk(callbacks_mutex_);
+    if (unknown_sequence_callback_ != nullptr) {
+      unknown_sequence_callback_(buff, read_bytes, clock_->now());
+      consumed = true;
+    }
+  }
+  if (!consumed) {
+    consumed = dispatch_key_press(pressed_key_code, key_modifiers, event_type);
+  }
+  if (!consumed && passthrough_mode_.load() == PassthroughMode::UNHANDLED) {
+    forward_to_passthrough(buff, read_bytes);
+  }
+}
+
+void KeyboardHandlerUnixImpl::process_kitty_input(const char * buff, ssize_t read_bytes)
+{
+  if (pending_input_.empty()) {
+    pending_input_time_ = clock_->now();
+  }
+  pending_input_.append(buff, static_cast<size_t>(read_bytes));
+  size_t pos = 0;
+  while (pos < pending_input_.size()) {
+    size_t length = process_kitty_sequence(pos);
+    if (length == 0) {
+      // Wait for the rest of the sequence
+      break;
+    }
+    pos += length;
+  }
+  pending_input_.erase(0, pos);
+  if (pos != 0) {
+    pending_input_time_ = clock_->now();
+  }
+  if (pending_input_.size() > MAX_PENDING_INPUT_LENGTH) {
+    pending_input_time_ = std::chrono::steady_clock::time_point();
+    flush_pending_input();
+  }
+}
+
+size_t KeyboardHandlerUnixImpl::process_kitty_sequence(size_t pos)
+{
+  const char * seq = pending_input_.data() + pos;
+  size_t available = pending_input_.size() - pos;
+  if (seq[0] != ESC) {
+    // Text keys without modifiers are sent as is
+    char key[2] = {seq[0], '\0'};
+    if (key[0] == '\t') {
+      process_key_event(KeyCode::TAB, KeyModifiers::NONE, KeyEventType::PRESS, key, 1);
+    } else {
+      process_legacy_input(key, 1);
+    }
+    return 1;
+  }
+  if (available < 2) {
+    return 0;
+  }
+  if (seq[1] == 'O') {
+    // SS3 sequences of the F1..F4 keys
+    if (available < 3) {
+      return 0;
+    }
+    std::string sequence(seq, 3);
+    process_legacy_input(sequence.c_str(), 3);
+    return 3;
+  }
+  if (seq[1] == 'P' && terminal_probe_state_.load() == TerminalProbeState::PENDING) {
+    // XTVERSION reply: DCS > | version ST
+    if (available < 3) {
+      return 0;
+    }
+    if (seq[2] == '>') {
+      size_t st_pos = pending_input_.find("\x1b\\", pos + 3);
+      if (st_pos == std::string::npos) {
+        return 0;
+      }
+      size_t length = st_pos + 2 - pos;
+      process_dcs_sequence(seq, length);
+      return length;
+    }
+  }
+  if (seq[1] != '[') {
+    // ESC + key is ALT + key in legacy encoding
+    std::string sequence(seq, 2);
+    process_legacy_input(sequence.c_str(), 2);
+    return 2;
+  }
+  // Parameter and intermediate bytes are followed by the final byte
+  size_t final_pos = 2;
+  while (final_pos < available && seq[final_pos] >= 0x20 && seq[final_pos] <= 0x3F) {
+    final_pos++;
+  }
+  if (final_pos == available) {
+    return 0;
+  }
+  if (seq[final_pos] < 0x40 || seq[final_pos] > 0x7E) {
+    // Malformed sequence interrupted by another one
+    std::string sequence(seq, final_pos);
+    process_legacy_input(sequence.c_str(), static_cast<ssize_t>(final_pos));
+    return final_pos;
+  }
+  process_csi_sequence(seq, final_pos + 1);
+  return final_pos + 1;
+}
+
+void KeyboardHandlerUnixImpl::process_csi_sequence(const char * seq, size_t length)
+{
+  const char final_byte = seq[length - 1];
+  const char * params = seq + 2;
+  const char * params_end = seq + length - 1;
+  if (final_byte == 'u' && params < params_end && *params == '?') {
+    // Reply to the query of the active flags: CSI ? flags u
+    int32_t flags = 0;
+    for (const char * it = params + 1; it < params_end && *it >= '0' && *it <= '9'; ++it) {
+      flags = flags * 10 + (*it - '0');
+    }
+    reported_kitty_keyboard_flags_.store(flags);
+    if (terminal_probe_state_.load() == TerminalProbeState::PENDING) {
+      std::lock_guard<std::mutex> lk(terminal_probe_mutex_);
+      terminal_capabilities_.supports_kitty_keyboard_protocol = true;
+      terminal_capabilities_.kitty_keyboard_flags = flags;
+    }
+    return;
+  }
+  if (final_byte == 'c' && params < params_end && *params == '?' &&
+    terminal_probe_state_.load() == TerminalProbeState::PENDING)
+  {
+    // Reply to the primary device attributes query: CSI ? attribute ; ... c
+    std::vector<uint32_t> attributes;
+    uint32_t value = 0;
+    for (const char * it = params + 1; it <= params_end; ++it) {
+      if (it < params_end && *it >= '0' && *it <= '9') {
+        value = std::min<uint32_t>(value * 10 + static_cast<uint32_t>(*it - '0'), 0xFFFF);
+        continue;
+      }
+      attributes.push_back(value);
+      value = 0;
+    }
+    {
+      std::lock_guard<std::mutex> lk(terminal_probe_mutex_);
+      terminal_capabilities_.device_attributes = std::move(attributes);
+    }
+    finish_terminal_probe(TerminalProbeState::COMPLETED);
+    return;
+  }
+
+  // CSI key_code[:alternate_key_codes] ; modifiers[:event_type] [; text] final_byte
+  uint32_t values[2][2] = {{1, 0}, {1, 1}};
+  size_t field = 0;
+  size_t subfield = 0;
+  uint32_t value = 0;
+  bool has_value = false;
+  bool is_valid = true;
+  for (const char * it = params; it <= params_end; ++it) {
+    if (it < params_end && *it >= '0' && *it <= '9') {
+      value = std::min<uint32_t>(value * 10 + static_cast<uint32_t>(*it - '0'), 0x10FFFF);
+      has_value = true;
+      continue;
+    }
+    if (it < params_end && *it != ':' && *it != ';') {
+      // Private parameters, e.g. replies to the other queries
+      is_valid = false;
+      break;
+    }
+    if (has_value && field < 2 && subfield < 2) {
+      values[field][subfield] = value;
+    }
+    value = 0;
+    has_value = false;
+    if (it < params_end && *it == ';') {
+      field++;
+      subfield = 0;
+    } else {
+      subfield++;
+    }
+  }
+
+  KeyCode key_code = KeyCode::UNKNOWN;
+  uint32_t modifiers_mask = values[1][0] > 0 ? values[1][0] - 1 : 0;
+  if (is_valid) {
+    uint32_t code = values[0][0];
+    std::string legacy_sequence;
+    if (final_byte == 'u') {
+      switch (code) {
+        case 9:
+          key_code = KeyCode::TAB;
+          break;
+        case 13:
+          key_code = KeyCode::ENTER;
+          break;
+        case 27:
+          key_code = KeyCode::ESCAPE;
+          break;
+        case 127:
+          key_code = KeyCode::BACK_SPACE;
+          break;
+        default:
+          if (code >= 'A' && code <= 'Z') {
+            code += 'a' - 'A';
+            modifiers_mask |= static_cast<uint32_t>(KeyModifiers::SHIFT);
+          }
+          if (code >= 32 && code < 127) {
+            legacy_sequence = std::string(1, static_cast<char>(code));
+          }
+      }
+    } else if (final_byte == '~') {
+      legacy_sequence = std::string("\x1b[") + std::to_string(code) + "~";
+    } else if (final_byte >= 'P' && final_byte <= 'S') {
+      legacy_sequence = std::string("\x1bO") + final_byte;
+    } else {
+      legacy_sequence = std::string("\x1b[") + final_byte;
+    }
+    if (!legacy_sequence.empty()) {
+      auto key_map_it = key_codes_map_.find(legacy_sequence);
+      if (key_map_it != key_codes_map_.end()) {
+        key_code = key_map_it->second;
+      }
+    }
+  }
+  KeyEventType event_type = KeyEventType::PRESS;
+  if (values[1][1] == static_cast<uint32_t>(KeyEventType::REPEAT) ||
+    values[1][1] == static_cast<uint32_t>(KeyEventType::RELEASE))
+  {
+    event_type = static_cast<KeyEventType>(values[1][1]);
+  }
+  // Shift, alt and ctrl have the same bits in kitty protocol, other modifiers are ignored
+  KeyModifiers key_modifiers = key_code == KeyCode::UNKNOWN ? KeyModifiers::NONE :
+    static_cast<KeyModifiers>(modifiers_mask & 7);
+  process_key_event(key_code, key_modifiers, event_type, seq, static_cast<ssize_t>(length));
+}
+
+void KeyboardHandlerUnixImpl::process_dcs_sequence(const char * seq, size_t length)
+{
+  // ESC P > | version ESC backslash
+  if (length >= 6 && seq[3] == '|') {
+    std::lock_guard<std::mutex> lk(terminal_probe_mutex_);
+    terminal_capabilities_.terminal_version.assign(seq + 4, length - 6);
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerUnixImpl::probe_terminal_capabilities(const TerminalProbeSettings & settings)
+{
+  if (!is_init_succeed_ || settings.timeout <= std::chrono::milliseconds(0)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lk(terminal_probe_mutex_);
+  if (terminal_probe_state_.load() == TerminalProbeState::PENDING) {
+    return false;
+  }
+  terminal_probe_settings_ = settings;
+  terminal_capabilities_ = TerminalCapabilities();
+  terminal_capabilities_.state = TerminalProbeState::PENDING;
+  terminal_probe_state_.store(TerminalProbeState::PENDING);
+  terminal_probe_requested_.store(true);
+  wake_up_reader();
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerUnixImpl::TerminalCapabilities KeyboardHandlerUnixImpl::get_terminal_capabilities()
+const
 {
-  if (install_signal_handler_) {
-    signal_handler_type old_sigint_handler = std::signal(SIGINT, old_sigint_handler_);
-    if (old_sigint_handler == SIG_ERR) {
-      std::cerr << "Error. Can't install old SIGINT handler" << std::endl;
+  std::lock_guard<std::mutex> lk(terminal_probe_mutex_);
+  return terminal_capabilities_;
+}
+
+void KeyboardHandlerUnixImpl::process_terminal_probe()
+{
+  if (terminal_probe_state_.load(std::memory_order_relaxed) != TerminalProbeState::PENDING) {
+    return;
+  }
+  if (terminal_probe_requested_.exchange(false)) {
+    std::chrono::milliseconds timeout;
+    {
+      std::lock_guard<std::mutex> lk(terminal_probe_mutex_);
+      timeout = terminal_probe_settings_.timeout;
+    }
+    terminal_probe_deadline_ = clock_->now() + timeout;
+    // Device attributes go last, every terminal replies to them after replies to the others
+    static const char queries[] = "\x1b[?u\x1b[>0q\x1b[c";
+    if (!write_to_terminal(queries, sizeof(queries) - 1)) {
+      finish_terminal_probe(TerminalProbeState::FAILED);
     }
-    if (old_sigint_handler != KeyboardHandlerUnixImpl::on_signal) {
-      std::cerr << "Error. Can't return old SIGINT handler, someone override our signal handler" <<
-        std::endl;
-      std::signal(SIGINT, old_sigint_handler);  // return overridden signal handler
+    return;
+  }
+  if (clock_->now() >= terminal_probe_deadline_) {
+    finish_terminal_probe(TerminalProbeState::TIMED_OUT);
+  }
+}
+
+void KeyboardHandlerUnixImpl::finish_terminal_probe(TerminalProbeState state)
+{
+  TerminalCapabilities capabilities;
+  TerminalProbeSettings settings;
+  {
+    std::lock_guard<std::mutex> lk(terminal_probe_mutex_);
+    terminal_capabilities_.state = state;
+    terminal_probe_state_.store(state);
+    capabilities = terminal_capabilities_;
+    settings = terminal_probe_settings_;
+  }
+  if (is_log_enabled(LogSeverity::DEBUG)) {
+    log(
+      LogSeverity::DEBUG, "Terminal probe is over. state = " +
+      std::to_string(static_cast<uint32_t>(state)) + ", version = '" +
+      capabilities.terminal_version + "', kitty keyboard protocol = " +
+      std::to_string(capabilities.kitty_keyboard_flags));
+  }
+  if (capabilities.supports_kitty_keyboard_protocol && settings.kitty_keyboard_flags != 0 &&
+    kitty_keyboard_flags_.load() == 0)
+  {
+    enable_kitty_keyboard_protocol(settings.kitty_keyboard_flags);
+  }
+  if (settings.callback) {
+    settings.callback(capabilities);
+  }
+}
+
+void KeyboardHandlerUnixImpl::flush_pending_input()
+{
+  if (clock_->now() - pending_input_time_ < PENDING_INPUT_TIMEOUT) {
+    return;
+  }
+  std::string pending_input;
+  pending_input.swap(pending_input_);
+  process_legacy_input(pending_input.c_str(), static_cast<ssize_t>(pending_input.size()));
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerUnixImpl::enable_kitty_keyboard_protocol(uint32_t flags)
+{
+  if (flags == 0 || !is_init_succeed_) {
+    return false;
+  }
+  // Push new mode only once to restore terminal's mode with a single pop
+  std::string request = kitty_keyboard_mode_pushed_.load() ?
+    "\x1b[=" + std::to_string(flags) + ";1u" : "\x1b[>" + std::to_string(flags) + "u";
+  // Query active flags to detect terminal support
+  request += "\x1b[?u";
+  uint32_t old_flags = kitty_keyboard_flags_.exchange(flags);
+  if (!write_to_terminal(request.data(), request.size())) {
+    kitty_keyboard_flags_.store(old_flags);
+    return false;
+  }
+  kitty_keyboard_mode_pushed_.store(true);
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerUnixImpl::disable_kitty_keyboard_protocol()
+{
+  if (kitty_keyboard_flags_.exchange(0) == 0) {
+    return false;
+  }
+  if (kitty_keyboard_mode_pushed_.exchange(false)) {
+    write_to_terminal("\x1b[<u", 4);
+  }
+  reported_kitty_keyboard_flags_.store(-1);
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+int32_t KeyboardHandlerUnixImpl::get_kitty_keyboard_flags() const
+{
+  return reported_kitty_keyboard_flags_.load();
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerUnixImpl::write_to_terminal(const char * data, size_t length)
+{
+  while (length > 0) {
+    ssize_t written_bytes = write(fileno(stdout), data, length);
+    if (written_bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
     }
+    data += written_bytes;
+    length -= static_cast<size_t>(written_bytes);
+  }
+  return true;
+}
+
+void KeyboardHandlerUnixImpl::pop_kitty_keyboard_mode()
+{
+  if (kitty_keyboard_mode_pushed_.exchange(false)) {
+    ssize_t written_bytes = write(fileno(stdout), "\x1b[<u", 4);
+    (void)written_bytes;
+  }
+}
+
+void KeyboardHandlerUnixImpl::restore_signal_handlers()
+{
+  if (!install_signal_handler_) {
+    return;
+  }
+  install_signal_handler_ = false;
+  signal_handler_type old_sigint_handler = std::signal(SIGINT, old_sigint_handler_);
+  if (old_sigint_handler == SIG_ERR) {
+    log(LogSeverity::ERR, "Error. Can't install old SIGINT handler");
   }
+  if (old_sigint_handler != KeyboardHandlerUnixImpl::on_signal) {
+    log(
+      LogSeverity::ERR,
+      "Error. Can't return old SIGINT handler, someone override our signal handler");
+    std::signal(SIGINT, old_sigint_handler);  // return overridden signal handler
+  }
+  // Handlers which failed to install have nothing to restore
+  if ((old_sigttin_handler_ != SIG_ERR && std::signal(SIGTTIN, old_sigttin_handler_) == SIG_ERR) ||
+    (old_sigcont_handler_ != SIG_ERR && std::signal(SIGCONT, old_sigcont_handler_) == SIG_ERR))
+  {
+    log(LogSeverity::ERR, "Error. Can't install old SIGTTIN or SIGCONT handler");
+  }
+}
+
+KeyboardHandlerUnixImpl::~KeyboardHandlerUnixImpl()
+{
+  clock_->remove_advance_callback(clock_advance_callback_handle_);
+  restore_signal_handlers();
   exit_ = true;
+  wake_up_reader();
   if (key_handler_thread_.joinable()) {
     key_handler_thread_.join();
   }
+  // Callbacks could refer to this object, finish dispatching before members will be destroyed
+  stop_sharded_dispatch();
 
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
   try {
     if (thread_exception_ptr != nullptr) {
       std::rethrow_exception(thread_exception_ptr);
     }
   } catch (const std::exception & e) {
-    std::cerr << "Caught exception: \"" << e.what() << "\"\n";
+    log(LogSeverity::ERR, std::string("Caught exception: \"") + e.what() + "\"");
   } catch (...) {
-    std::cerr << "Caught unknown exception" << std::endl;
+    log(LogSeverity::ERR, "Caught unknown exception");
+  }
+#endif
+
+  for (auto & fd : wake_up_pipe_fds_) {
+    if (fd != -1) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  for (auto & fd : passthrough_pipe_fds_) {
+    if (fd != -1) {
+      close(fd);
+      fd = -1;
+    }
   }
 }
 
@@ -281,6 +1057,7 @@ KeyboardHandlerUnixImpl::get_terminal_sequence(KeyboardHandlerUnixImpl::KeyCode
 
 bool KeyboardHandlerUnixImpl::restore_buffer_mode_for_stdin()
 {
+  pop_kitty_keyboard_mode();
   if (tcsetattr_fn_(fileno(stdin), TCSANOW, &old_term_settings_) == -1) {
     return false;
   }
@@ -292,4 +1069,558 @@ KeyboardHandlerUnixImpl::signal_handler_type KeyboardHandlerUnixImpl::get_old_si
   return old_sigint_handler_;
 }
 
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerUnixImpl::set_passthrough_mode(PassthroughMode mode)
+{
+  if (!is_init_succeed_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lk(passthrough_mutex_);
+  if (mode != PassthroughMode::OFF && passthrough_pipe_fds_[0] == -1) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1) {
+      return false;
+    }
+    // Reader thread shall never block on writing to the pipe
+    fcntl(pipe_fds[1], F_SETFL, fcntl(pipe_fds[1], F_GETFL) | O_NONBLOCK);
+    fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+    passthrough_pipe_fds_[0] = pipe_fds[0];
+    passthrough_pipe_fds_[1] = pipe_fds[1];
+  }
+
+  auto old_mode = passthrough_mode_.load();
+  if ((old_mode == PassthroughMode::ALL) != (mode == PassthroughMode::ALL)) {
+    auto term_settings = get_term_settings(mode);
+    if (tcsetattr_fn_(stdin_fd_, TCSANOW, &term_settings) == -1) {
+      return false;
+    }
+  }
+  passthrough_mode_.store(mode);
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerUnixImpl::PassthroughMode KeyboardHandlerUnixImpl::get_passthrough_mode() const
+{
+  return passthrough_mode_.load();
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerUnixImpl::set_flood_protection(const FloodProtectionSettings & settings)
+{
+  if (settings.flood_threshold != 0 && settings.flood_window <= std::chrono::milliseconds(0)) {
+    log(LogSeverity::WARN, "Flood window shall be positive when flood detection is enabled");
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lk(flood_mutex_);
+    flood_settings_ = settings;
+  }
+  flood_settings_changed_.store(true);
+  wake_up_reader();
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerUnixImpl::FloodProtectionSettings KeyboardHandlerUnixImpl::get_flood_protection()
+const
+{
+  std::lock_guard<std::mutex> lk(flood_mutex_);
+  return flood_settings_;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerUnixImpl::FloodStats KeyboardHandlerUnixImpl::get_flood_stats() const
+{
+  FloodStats stats;
+  stats.number_of_budget_yields = number_of_budget_yields_.load(std::memory_order_relaxed);
+  stats.number_of_floods = number_of_floods_.load(std::memory_order_relaxed);
+  stats.number_of_dropped_events = number_of_dropped_events_.load(std::memory_order_relaxed);
+  stats.number_of_coalesced_events = number_of_coalesced_events_.load(std::memory_order_relaxed);
+  stats.is_flooding = is_flooding_.load();
+  return stats;
+}
+
+void KeyboardHandlerUnixImpl::begin_reader_iteration()
+{
+  iteration_bytes_ = 0;
+  iteration_events_ = 0;
+  apply_flood_settings();
+  if (active_flood_settings_.flood_threshold != 0) {
+    update_flood_window(clock_->now());
+  }
+}
+
+void KeyboardHandlerUnixImpl::apply_flood_settings()
+{
+  if (!flood_settings_changed_.load() || !flood_settings_changed_.exchange(false)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lk(flood_mutex_);
+  active_flood_settings_ = flood_settings_;
+  flood_window_start_ = clock_->now();
+  flood_window_events_ = 0;
+  has_last_admitted_key_event_ = false;
+  is_flooding_.store(false);
+}
+
+bool KeyboardHandlerUnixImpl::is_iteration_budget_exhausted() const
+{
+  return (active_flood_settings_.max_bytes_per_iteration != 0 &&
+         iteration_bytes_ >= active_flood_settings_.max_bytes_per_iteration) ||
+         (active_flood_settings_.max_events_per_iteration != 0 &&
+         iteration_events_ >= active_flood_settings_.max_events_per_iteration);
+}
+
+void KeyboardHandlerUnixImpl::update_flood_window(Clock::time_point now)
+{
+  if (now - flood_window_start_ < active_flood_settings_.flood_window) {
+    return;
+  }
+  if (is_flooding_.load() && flood_window_events_ <= active_flood_settings_.flood_threshold) {
+    is_flooding_.store(false);
+    log(LogSeverity::INFO, "Input flood is over");
+  }
+  flood_window_start_ = now;
+  flood_window_events_ = 0;
+  // Let the stuck key through once per window in the COALESCE mode
+  has_last_admitted_key_event_ = false;
+}
+
+bool KeyboardHandlerUnixImpl::admit_key_event(
+  KeyCode key_code, KeyModifiers key_modifiers, KeyEventType event_type)
+{
+  // Settings could be changed by the callback of the previous key event within the iteration
+  apply_flood_settings();
+  if (active_flood_settings_.flood_threshold == 0) {
+    return true;
+  }
+  update_flood_window(clock_->now());
+  flood_window_events_++;
+  if (!is_flooding_.load() && flood_window_events_ > active_flood_settings_.flood_threshold) {
+    is_flooding_.store(true);
+    number_of_floods_.fetch_add(1, std::memory_order_relaxed);
+    log(
+      LogSeverity::WARN, "Input flood detected: more than " +
+      std::to_string(active_flood_settings_.flood_threshold) + " key events in " +
+      std::to_string(active_flood_settings_.flood_window.count()) + " ms");
+  }
+  KeyAndModifiers key{key_code, key_modifiers};
+  if (is_flooding_.load()) {
+    if (active_flood_settings_.flood_mode == FloodMode::DROP) {
+      number_of_dropped_events_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (active_flood_settings_.flood_mode == FloodMode::COALESCE &&
+      has_last_admitted_key_event_ && last_admitted_key_ == key &&
+      last_admitted_event_type_ == event_type)
+    {
+      number_of_coalesced_events_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+  has_last_admitted_key_event_ = true;
+  last_admitted_key_ = key;
+  last_admitted_event_type_ = event_type;
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+int KeyboardHandlerUnixImpl::get_passthrough_fd() const
+{
+  return passthrough_pipe_fds_[0];
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerUnixImpl::set_unknown_sequence_callback(
+  const unknown_sequence_callback_t & callback)
+{
+  std::lock_guard<std::mutex> lk(callbacks_mutex_);
+  unknown_sequence_callback_ = callback;
+  has_unknown_sequence_callback_.store(callback != nullptr);
+}
+
+struct termios KeyboardHandlerUnixImpl::get_term_settings(PassthroughMode mode) const
+{
+  struct termios term_settings = raw_term_settings_;
+  if (mode == PassthroughMode::ALL) {
+    // Echo typed characters while application reads lines from the passthrough pipe
+    term_settings.c_lflag |= ECHO;
+  }
+  return term_settings;
+}
+
+bool KeyboardHandlerUnixImpl::is_exit_requested() const
+{
+  return exit_.load() || sigint_generation_.load() != sigint_generation_at_init_;
+}
+
+bool KeyboardHandlerUnixImpl::is_in_foreground() const
+{
+  pid_t foreground_process_group = tcgetpgrp_fn_(stdin_fd_);
+  if (foreground_process_group == -1) {
+    // Can't determine foreground process group, e.g. stdin is not a real terminal.
+    return true;
+  }
+  return foreground_process_group == getpgrp();
+}
+
+bool KeyboardHandlerUnixImpl::is_foreground_check_due()
+{
+  if (reader_backend_ != ReaderBackend::BUSY_POLL) {
+    return true;
+  }
+  if (++polls_since_foreground_check_ < BUSY_POLL_FOREGROUND_CHECK_PERIOD) {
+    return false;
+  }
+  polls_since_foreground_check_ = 0;
+  return true;
+}
+
+void KeyboardHandlerUnixImpl::wait_for_foreground()
+{
+  while (!is_exit_requested() && !is_in_foreground()) {
+    // Process group will be checked again in 100 ms or shortly after SIGCONT arrival. Timers,
+    // e.g. hold repeats and macro steps, and injected input don't need the terminal and keep
+    // running meanwhile.
+    for (int i = 0; i < 10 && !is_exit_requested() && !sigcont_received_.exchange(false); i++) {
+      begin_reader_iteration();
+      process_injected_input();
+      process_timers();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+}
+
+ssize_t KeyboardHandlerUnixImpl::read_input(
+  const readFunction & read_fn, char * buff, size_t buff_len)
+{
+  switch (reader_backend_) {
+    case ReaderBackend::POLL:
+      {
+        struct pollfd pollfds[2] = {{stdin_fd_, POLLIN, 0}, {wake_up_pipe_fds_[0], POLLIN, 0}};
+        // Don't wait if injected input is left for the next iteration. Otherwise wake up for the
+        // next timer, e.g. macro step, if it's due earlier than the regular timeout.
+        int timeout_ms = is_iteration_budget_exhausted() ? 0 : 100;
+        auto next_timer_deadline = get_next_timer_deadline();
+        if (next_timer_deadline != std::chrono::steady_clock::time_point::max()) {
+          auto time_to_next_timer = std::chrono::duration_cast<std::chrono::milliseconds>(
+            next_timer_deadline - clock_->now() +
+            std::chrono::microseconds(999)).count();
+          if (time_to_next_timer < timeout_ms) {
+            timeout_ms = time_to_next_timer > 0 ? static_cast<int>(time_to_next_timer) : 0;
+          }
+        }
+        int ret = poll(pollfds, 2, timeout_ms);
+        if (ret <= 0) {
+          return ret;
+        }
+        if (pollfds[1].revents != 0) {
+          // Woken up for injected input or exit. Return as on timeout to let caller handle it.
+          char drain_buff[64];
+          while (read(wake_up_pipe_fds_[0], drain_buff, sizeof(drain_buff)) > 0) {}
+          if (pollfds[0].revents == 0) {
+            return 0;
+          }
+        }
+        break;
+      }
+    case ReaderBackend::BUSY_POLL:
+      {
+        ssize_t ret = read_fn(stdin_fd_, buff, buff_len - 1);
+        if (ret > 0) {
+          number_of_empty_polls_ = 0;
+          busy_poll_sleep_ = std::chrono::microseconds(0);
+        } else if (ret == 0 || errno == EAGAIN) {
+          busy_poll_backoff();
+        }
+        return ret;
+      }
+    case ReaderBackend::BLOCKING_READ:
+      break;
+  }
+  // Reserve last byte in buffer for null terminator
+  return read_fn(stdin_fd_, buff, buff_len - 1);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerUnixImpl::inject_key(KeyCode key_code, KeyModifiers key_modifiers)
+{
+  if (!is_init_succeed_) {
+    return false;
+  }
+  InjectedInput input;
+  input.key_code = key_code;
+  input.key_modifiers = key_modifiers;
+  input.length = 0;
+  if (!injected_input_.try_push(input)) {
+    return false;
+  }
+  wake_up_reader();
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+size_t KeyboardHandlerUnixImpl::inject_bytes(const char * data, size_t length)
+{
+  if (!is_init_succeed_ || data == nullptr) {
+    return 0;
+  }
+  size_t injected_bytes = 0;
+  while (injected_bytes < length) {
+    InjectedInput input;
+    input.key_code = KeyCode::UNKNOWN;
+    input.key_modifiers = KeyModifiers::NONE;
+    // Reserve last byte for null terminator as for real input
+    input.length = static_cast<uint8_t>(
+      std::min(length - injected_bytes, READ_BUFFER_LENGTH - 1));
+    std::memcpy(input.bytes, data + injected_bytes, input.length);
+    if (!injected_input_.try_push(input)) {
+      break;
+    }
+    injected_bytes += input.length;
+  }
+  if (injected_bytes != 0) {
+    wake_up_reader();
+  }
+  return injected_bytes;
+}
+
+void KeyboardHandlerUnixImpl::process_injected_input()
+{
+  // Limit number of processed inputs to not starve real input when other threads inject
+  // continuously
+  InjectedInput input;
+  for (size_t i = 0; i < INJECTED_INPUT_CAPACITY && !is_iteration_budget_exhausted() &&
+    injected_input_.try_pop(input); i++)
+  {
+    // Settings changed before injection apply to the injected input
+    apply_flood_settings();
+    if (input.length == 0) {
+      iteration_events_++;
+      dispatch_key_press(input.key_code, input.key_modifiers);
+    } else {
+      iteration_bytes_ += input.length;
+      input.bytes[input.length] = '\0';
+      process_input(input.bytes, input.length);
+    }
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerUnixImpl::macro_handle_t KeyboardHandlerUnixImpl::add_macro(
+  const std::vector<MacroStep> & steps)
+{
+  if (steps.empty() || !is_init_succeed_) {
+    return invalid_handle;
+  }
+  CompiledMacro macro;
+  macro.key_codes.reserve(steps.size());
+  macro.key_modifiers.reserve(steps.size());
+  macro.offsets.reserve(steps.size());
+  // Offsets from the start of the playback don't accumulate scheduling error of the each step
+  std::chrono::nanoseconds offset{0};
+  for (const auto & step : steps) {
+    offset += step.delay;
+    macro.key_codes.push_back(step.key_code);
+    macro.key_modifiers.push_back(step.key_modifiers);
+    macro.offsets.push_back(offset);
+  }
+  std::lock_guard<std::mutex> lk(macros_mutex_);
+  macro_handle_t handle = ++last_macro_handle_;
+  macros_.emplace(handle, std::move(macro));
+  return handle;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerUnixImpl::delete_macro(macro_handle_t handle)
+{
+  std::lock_guard<std::mutex> lk(macros_mutex_);
+  if (handle == invalid_handle) {
+    return;
+  }
+  cancel_macro_playbacks(handle);
+  macros_.erase(handle);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+bool KeyboardHandlerUnixImpl::play_macro(macro_handle_t handle)
+{
+  std::lock_guard<std::mutex> lk(macros_mutex_);
+  auto it = macros_.find(handle);
+  if (it == macros_.end() || macro_playbacks_.size() >= MAX_PLAYING_MACROS) {
+    return false;
+  }
+  macro_playbacks_.push_back(
+    MacroPlayback{++last_playback_id_, handle, &it->second, clock_->now(), 0,
+      TimerWheel::invalid_timer_id});
+  schedule_macro_step(macro_playbacks_.back());
+  return true;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerUnixImpl::callback_handle_t KeyboardHandlerUnixImpl::add_macro_binding(
+  macro_handle_t handle, KeyCode key_code, KeyModifiers key_modifiers)
+{
+  {
+    std::lock_guard<std::mutex> lk(macros_mutex_);
+    if (macros_.find(handle) == macros_.end()) {
+      return invalid_handle;
+    }
+  }
+  return add_key_press_callback(
+    [this, handle](KeyCode, KeyModifiers) {play_macro(handle);}, key_code, key_modifiers);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerUnixImpl::cancel_macro(macro_handle_t handle)
+{
+  std::lock_guard<std::mutex> lk(macros_mutex_);
+  if (handle != invalid_handle) {
+    cancel_macro_playbacks(handle);
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void KeyboardHandlerUnixImpl::cancel_all_macros()
+{
+  std::lock_guard<std::mutex> lk(macros_mutex_);
+  cancel_macro_playbacks(invalid_handle);
+}
+
+KEYBOARD_HANDLER_PUBLIC
+size_t KeyboardHandlerUnixImpl::get_number_of_playing_macros() const
+{
+  std::lock_guard<std::mutex> lk(macros_mutex_);
+  return macro_playbacks_.size();
+}
+
+void KeyboardHandlerUnixImpl::process_macro_playback(uint64_t playback_id)
+{
+  due_macro_steps_.clear();
+  {
+    std::lock_guard<std::mutex> lk(macros_mutex_);
+    auto it = std::find_if(
+      macro_playbacks_.begin(), macro_playbacks_.end(),
+      [playback_id](const MacroPlayback & playback) {
+        return playback.playback_id == playback_id;
+      });
+    if (it == macro_playbacks_.end()) {
+      // Cancelled while its timer was expiring
+      return;
+    }
+    MacroPlayback & playback = *it;
+    const CompiledMacro & macro = *playback.macro;
+    auto now = clock_->now();
+    while (playback.next_step < macro.offsets.size() &&
+      playback.start_time + macro.offsets[playback.next_step] <= now)
+    {
+      due_macro_steps_.push_back(
+        KeyAndModifiers{macro.key_codes[playback.next_step],
+          macro.key_modifiers[playback.next_step]});
+      playback.next_step++;
+    }
+    if (playback.next_step < macro.offsets.size()) {
+      schedule_macro_step(playback);
+    } else {
+      macro_playbacks_.erase(it);
+    }
+  }
+  // Dispatch without macros_mutex_ to let callbacks start and cancel macros
+  for (const auto & step : due_macro_steps_) {
+    dispatch_key_press(step.key_code, step.key_modifiers);
+  }
+}
+
+void KeyboardHandlerUnixImpl::schedule_macro_step(MacroPlayback & playback)
+{
+  uint64_t playback_id = playback.playback_id;
+  playback.timer_id = schedule_timer(
+    playback.start_time + playback.macro->offsets[playback.next_step],
+    [this, playback_id]() {process_macro_playback(playback_id);});
+}
+
+void KeyboardHandlerUnixImpl::cancel_macro_playbacks(macro_handle_t handle)
+{
+  auto it = std::remove_if(
+    macro_playbacks_.begin(), macro_playbacks_.end(),
+    [this, handle](const MacroPlayback & playback) {
+      if (handle != invalid_handle && playback.handle != handle) {
+        return false;
+      }
+      cancel_timer(playback.timer_id);
+      return true;
+    });
+  macro_playbacks_.erase(it, macro_playbacks_.end());
+}
+
+void KeyboardHandlerUnixImpl::on_timer_scheduled()
+{
+  wake_up_reader();
+}
+
+void KeyboardHandlerUnixImpl::wake_up_reader()
+{
+  if (wake_up_pipe_fds_[1] != -1) {
+    // Pipe is non blocking. If it's full, reader will be woken up anyway.
+    ssize_t written_bytes = write(wake_up_pipe_fds_[1], "w", 1);
+    (void)written_bytes;
+  }
+}
+
+void KeyboardHandlerUnixImpl::pin_reader_thread() const
+{
+  if (reader_backend_ != ReaderBackend::BUSY_POLL || busy_poll_settings_.cpu < 0) {
+    return;
+  }
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(busy_poll_settings_.cpu, &cpu_set);
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (ret != 0) {
+    log(
+      LogSeverity::WARN, "Can't pin reader thread to CPU " +
+      std::to_string(busy_poll_settings_.cpu) + ". errno = " + std::to_string(ret));
+  }
+#else
+  log(LogSeverity::WARN, "Pinning of the reader thread is supported only on Linux.");
+#endif
+}
+
+void KeyboardHandlerUnixImpl::busy_poll_backoff()
+{
+  if (busy_poll_settings_.max_backoff.count() > 0 &&
+    number_of_empty_polls_ >= busy_poll_settings_.polls_before_backoff)
+  {
+    busy_poll_sleep_ = std::min(
+      std::max(busy_poll_sleep_ * 2, std::chrono::microseconds(1)),
+      busy_poll_settings_.max_backoff);
+    std::this_thread::sleep_for(busy_poll_sleep_);
+    return;
+  }
+  number_of_empty_polls_++;
+  if (busy_poll_settings_.use_pause_hint) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__ ("yield");
+#endif
+  }
+}
+
+KeyboardHandlerUnixImpl::ReaderBackend KeyboardHandlerUnixImpl::get_reader_backend() const
+{
+  return reader_backend_;
+}
+
+void KeyboardHandlerUnixImpl::forward_to_passthrough(const char * buff, ssize_t read_bytes)
+{
+  // Write directly from the read buffer. If application doesn't drain the pipe, excess input
+  // is discarded instead of blocking the reader thread.
+  ssize_t written_bytes = write(passthrough_pipe_fds_[1], buff, read_bytes);
+  (void)written_bytes;
+}
+
 #endif  // #ifndef _WIN32
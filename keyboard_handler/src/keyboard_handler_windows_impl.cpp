@@ -18,7 +18,9 @@
 #include <stdio.h>
 #include <windows.h>
 #include <exception>
-#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
 #include <tuple>
 #include "keyboard_handler/keyboard_handler_windows_impl.hpp"
 
@@ -35,14 +37,54 @@ KeyboardHandlerWindowsImpl::KeyboardHandlerWindowsImpl(
   const getchFunction & getch_fn)
 : exit_(false)
 {
-  if (isatty_fn == nullptr) {
-    throw std::invalid_argument("KeyboardHandlerWindowsImpl isatty_fn must be non-empty.");
+  std::string error_message;
+  std::error_code error = init(isatty_fn, kbhit_fn, getch_fn, error_message);
+  if (error) {
+    throw_init_error(error, error_message);
   }
-  if (kbhit_fn == nullptr) {
-    throw std::invalid_argument("KeyboardHandlerWindowsImpl kbhit_fn must be non-empty.");
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerWindowsImpl::KeyboardHandlerWindowsImpl(
+  std::error_code & error,
+  const isattyFunction & isatty_fn,
+  const kbhitFunction & kbhit_fn,
+  const getchFunction & getch_fn)
+: exit_(false)
+{
+  std::string error_message;
+  error = init(isatty_fn, kbhit_fn, getch_fn, error_message);
+  if (error) {
+    log(LogSeverity::ERR, error_message);
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+KeyboardHandlerResult<KeyboardHandlerWindowsImpl> KeyboardHandlerWindowsImpl::create()
+{
+  std::error_code error;
+  std::unique_ptr<KeyboardHandlerWindowsImpl> keyboard_handler(
+    new KeyboardHandlerWindowsImpl(error, _isatty, _kbhit, _getch));
+  if (error) {
+    return error;
   }
-  if (getch_fn == nullptr) {
-    throw std::invalid_argument("KeyboardHandlerWindowsImpl getch_fn must be non-empty.");
+  return keyboard_handler;
+}
+
+std::error_code KeyboardHandlerWindowsImpl::init(
+  const isattyFunction & isatty_fn,
+  const kbhitFunction & kbhit_fn,
+  const getchFunction & getch_fn,
+  std::string & error_message)
+{
+  const char * empty_function_name =
+    isatty_fn == nullptr ? "isatty_fn" :
+    kbhit_fn == nullptr ? "kbhit_fn" :
+    getch_fn == nullptr ? "getch_fn" : nullptr;
+  if (empty_function_name != nullptr) {
+    error_message =
+      std::string("KeyboardHandlerWindowsImpl ") + empty_function_name + " must be non-empty.";
+    return std::make_error_code(std::errc::invalid_argument);
   }
 
   for (size_t i = 0; i < STATIC_KEY_MAP_LENGTH; i++) {
@@ -55,16 +97,21 @@ KeyboardHandlerWindowsImpl::KeyboardHandlerWindowsImpl(
   if (!isatty_fn(_fileno(stdin))) {
     // If stdin is not a real terminal or console (redirected to file or pipe ) can't do much here
     // with keyboard handling.
-    std::cerr << "stdin is not a terminal or console device. Keyboard handling disabled.";
-    return;
+    log(
+      LogSeverity::WARN,
+      "stdin is not a terminal or console device. Keyboard handling disabled.");
+    return std::error_code();
   }
 
   is_init_succeed_ = true;
 
   key_handler_thread_ = std::thread(
     [ = ]() {
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
       try {
+#endif
         do {
+          process_timers();
           if (kbhit_fn()) {
             WinKeyCode win_key_code{WinKeyCode::NOT_A_KEY, WinKeyCode::NOT_A_KEY};
             KeyModifiers key_modifiers = KeyModifiers::NONE;
@@ -86,29 +133,30 @@ KeyboardHandlerWindowsImpl::KeyboardHandlerWindowsImpl(
             KeyCode pressed_key_code = std::get<0>(key_code_and_modifiers);
             key_modifiers = key_modifiers | std::get<1>(key_code_and_modifiers);
 
-#ifdef PRINT_DEBUG_INFO
-            std::cout << "Pressed first key code = " << win_key_code.first << ". ";
-            std::cout << "Second code = " << win_key_code.second << ".";
-            auto modifiers_str = enum_key_modifiers_to_str(key_modifiers);
-            std::cout << " Detected as pressed key: " << modifiers_str;
-            if (!modifiers_str.empty()) {
-              std::cout << " + ";
-            }
-            std::cout << "'" << enum_key_code_to_str(pressed_key_code) << "'" << std::endl;
-#endif
-            std::lock_guard<std::mutex> lk(callbacks_mutex_);
-            auto range = callbacks_.equal_range(KeyAndModifiers{pressed_key_code, key_modifiers});
-            for (auto it = range.first; it != range.second; ++it) {
-              it->second.callback(pressed_key_code, key_modifiers);
+            if (is_log_enabled(LogSeverity::DEBUG)) {
+              std::stringstream ss;
+              ss << "Pressed first key code = " << win_key_code.first << ". ";
+              ss << "Second code = " << win_key_code.second << ".";
+              auto modifiers_str = enum_key_modifiers_to_str(key_modifiers);
+              ss << " Detected as pressed key: " << modifiers_str;
+              if (!modifiers_str.empty()) {
+                ss << " + ";
+              }
+              ss << "'" << enum_key_code_to_str(pressed_key_code) << "'";
+              log(LogSeverity::DEBUG, ss.str());
             }
+            dispatch_key_press(pressed_key_code, key_modifiers);
             // Wait for 0.1 sec to yield processor resources for another threads
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
           }
         } while (!exit_.load());
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
       } catch (...) {
         thread_exception_ptr = std::current_exception();
       }
+#endif
     });
+  return std::error_code();
 }
 
 KeyboardHandlerWindowsImpl::~KeyboardHandlerWindowsImpl()
@@ -117,16 +165,20 @@ KeyboardHandlerWindowsImpl::~KeyboardHandlerWindowsImpl()
   if (key_handler_thread_.joinable()) {
     key_handler_thread_.join();
   }
+  // Callbacks could refer to this object, finish dispatching before members will be destroyed
+  stop_sharded_dispatch();
 
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
   try {
     if (thread_exception_ptr != nullptr) {
       std::rethrow_exception(thread_exception_ptr);
     }
   } catch (const std::exception & e) {
-    std::cerr << "Caught exception \"" << e.what() << "\"\n";
+    log(LogSeverity::ERR, std::string("Caught exception \"") + e.what() + "\"");
   } catch (...) {
-    std::cerr << "Caught unknown exception" << std::endl;
+    log(LogSeverity::ERR, "Caught unknown exception");
   }
+#endif
 }
 
 KEYBOARD_HANDLER_PUBLIC
@@ -0,0 +1,139 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include "keyboard_handler/error.hpp"
+#include "keyboard_handler/log_sink.hpp"
+
+constexpr size_t AsyncLogSink::MAX_MESSAGE_LENGTH;
+
+KEYBOARD_HANDLER_PUBLIC
+StreamLogSink::StreamLogSink(std::ostream & stream)
+: stream_(stream) {}
+
+KEYBOARD_HANDLER_PUBLIC
+void StreamLogSink::log(LogSeverity /* severity */, const char * message, size_t length) noexcept
+{
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+  try {
+    write(message, length);
+  } catch (...) {
+    // Nothing could be done if output stream throws
+  }
+#else
+  write(message, length);
+#endif
+}
+
+void StreamLogSink::write(const char * message, size_t length)
+{
+  std::lock_guard<std::mutex> lk(stream_mutex_);
+  stream_.write(message, length);
+  stream_ << std::endl;
+}
+
+KEYBOARD_HANDLER_PUBLIC
+AsyncLogSink::AsyncLogSink(std::shared_ptr<LogSink> output_sink, size_t capacity)
+: output_sink_(std::move(output_sink)), messages_(capacity)
+{
+  if (output_sink_ == nullptr) {
+    KEYBOARD_HANDLER_THROW(std::invalid_argument("AsyncLogSink output_sink must be non-empty."));
+  }
+  writer_thread_ = std::thread(
+    [this]() {
+      while (true) {
+        while (write_next_message()) {}
+        if (exit_.load()) {
+          // Write messages which could be logged concurrently with exit request
+          while (write_next_message()) {}
+          break;
+        }
+        std::unique_lock<std::mutex> lk(writer_mutex_);
+        writer_sleeping_.store(true);
+        // Re-check after announcing sleep: producer which published message before it could
+        // see writer_sleeping_ == true will not notify.
+        if (messages_.empty() && !exit_.load()) {
+          writer_cv_.wait_for(lk, std::chrono::milliseconds(100));
+        }
+        writer_sleeping_.store(false);
+      }
+    });
+}
+
+KEYBOARD_HANDLER_PUBLIC
+AsyncLogSink::~AsyncLogSink()
+{
+  {
+    std::lock_guard<std::mutex> lk(writer_mutex_);
+    exit_.store(true);
+  }
+  writer_cv_.notify_one();
+  if (writer_thread_.joinable()) {
+    writer_thread_.join();
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void AsyncLogSink::log(LogSeverity severity, const char * message, size_t length) noexcept
+{
+  Message entry;
+  entry.severity = severity;
+  entry.length = static_cast<uint8_t>(std::min(length, MAX_MESSAGE_LENGTH));
+  std::memcpy(entry.text, message, entry.length);
+  if (!messages_.try_push(entry)) {
+    dropped_messages_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // Take the mutex only when writer thread is going to sleep or sleeping
+  if (writer_sleeping_.load()) {
+    std::lock_guard<std::mutex> lk(writer_mutex_);
+    writer_cv_.notify_one();
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+void AsyncLogSink::flush()
+{
+  size_t pos = messages_.get_number_of_pushed_elements();
+  while (written_messages_.load() < pos) {
+    {
+      std::lock_guard<std::mutex> lk(writer_mutex_);
+      writer_cv_.notify_one();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+KEYBOARD_HANDLER_PUBLIC
+uint64_t AsyncLogSink::get_number_of_dropped_messages() const
+{
+  return dropped_messages_.load();
+}
+
+bool AsyncLogSink::write_next_message()
+{
+  Message entry;
+  if (!messages_.try_pop(entry)) {
+    return false;
+  }
+  output_sink_->log(entry.severity, entry.text, entry.length);
+  written_messages_.fetch_add(1);
+  return true;
+}
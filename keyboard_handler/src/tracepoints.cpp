@@ -0,0 +1,31 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tracepoints.hpp"
+
+#ifdef KEYBOARD_HANDLER_ENABLE_USDT
+/// Semaphores shall be placed in the `.probes` section to be found by tracers. C linkage comes
+/// from the declarations in tracepoints.hpp.
+#define KEYBOARD_HANDLER_DEFINE_TRACEPOINT_SEMAPHORE(name) \
+  __extension__ unsigned short /* NOLINT(runtime/int) */ \
+  keyboard_handler_ ## name ## _semaphore __attribute__((unused)) \
+  __attribute__((section(".probes"))) = 0
+
+KEYBOARD_HANDLER_DEFINE_TRACEPOINT_SEMAPHORE(read);
+KEYBOARD_HANDLER_DEFINE_TRACEPOINT_SEMAPHORE(parse_input);
+KEYBOARD_HANDLER_DEFINE_TRACEPOINT_SEMAPHORE(callback_add);
+KEYBOARD_HANDLER_DEFINE_TRACEPOINT_SEMAPHORE(callback_delete);
+KEYBOARD_HANDLER_DEFINE_TRACEPOINT_SEMAPHORE(dispatch);
+KEYBOARD_HANDLER_DEFINE_TRACEPOINT_SEMAPHORE(callback);
+#endif  // KEYBOARD_HANDLER_ENABLE_USDT
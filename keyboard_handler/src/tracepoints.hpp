@@ -0,0 +1,52 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TRACEPOINTS_HPP_
+#define TRACEPOINTS_HPP_
+
+/// USDT (User Statically-Defined Tracing) probes for bpftrace, perf and SystemTap.
+/// Probes are placed under the `keyboard_handler` provider and could be listed with
+/// `bpftrace -l 'usdt:/path/to/libkeyboard_handler.so:*'`.
+/// Each probe compiles to a single NOP instruction. Probe arguments which are expensive to
+/// compute (e.g. callback duration) are guarded with KEYBOARD_HANDLER_TRACEPOINT_ENABLED() and
+/// evaluated only when tracer is attached to the probe.
+/// When library built without KEYBOARD_HANDLER_ENABLE_USDT all macros expand to nothing.
+
+#ifdef KEYBOARD_HANDLER_ENABLE_USDT
+// Semaphores are incremented by tracer when it attaches to the probe
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define KEYBOARD_HANDLER_TRACEPOINT(name, ...) \
+  STAP_PROBEV(keyboard_handler, name, __VA_ARGS__)
+
+#define KEYBOARD_HANDLER_TRACEPOINT_ENABLED(name) \
+  __builtin_expect(keyboard_handler_ ## name ## _semaphore != 0, 0)
+
+#define KEYBOARD_HANDLER_TRACEPOINT_SEMAPHORE(name) \
+  extern "C" unsigned short keyboard_handler_ ## name ## _semaphore  // NOLINT(runtime/int)
+
+KEYBOARD_HANDLER_TRACEPOINT_SEMAPHORE(read);
+KEYBOARD_HANDLER_TRACEPOINT_SEMAPHORE(parse_input);
+KEYBOARD_HANDLER_TRACEPOINT_SEMAPHORE(callback_add);
+KEYBOARD_HANDLER_TRACEPOINT_SEMAPHORE(callback_delete);
+KEYBOARD_HANDLER_TRACEPOINT_SEMAPHORE(dispatch);
+KEYBOARD_HANDLER_TRACEPOINT_SEMAPHORE(callback);
+
+#else
+#define KEYBOARD_HANDLER_TRACEPOINT(name, ...)
+#define KEYBOARD_HANDLER_TRACEPOINT_ENABLED(name) false
+#endif  // KEYBOARD_HANDLER_ENABLE_USDT
+
+#endif  // TRACEPOINTS_HPP_
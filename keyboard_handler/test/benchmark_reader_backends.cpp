@@ -0,0 +1,172 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark for the reader backends of KeyboardHandlerUnixImpl.
+// Replaces stdin with the slave side of the pseudo terminal, writes key presses to the master
+// side and measures time until the key press callback is called. Also measures CPU time
+// consumed by the process while there is no input.
+// Usage: benchmark_reader_backends [number_of_key_presses] [busy_poll_cpu]
+// [busy_poll_median_limit_us]
+// Exits with failure if median latency of the busy poll backend exceeds the limit, 10 us by
+// default. Busy poll reader is pinned to busy_poll_cpu if it's specified.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "keyboard_handler/keyboard_handler_unix_impl.hpp"
+
+namespace
+{
+using ReaderBackend = KeyboardHandlerUnixImpl::ReaderBackend;
+
+const char * backend_to_str(ReaderBackend backend)
+{
+  switch (backend) {
+    case ReaderBackend::BLOCKING_READ:
+      return "blocking read";
+    case ReaderBackend::POLL:
+      return "poll";
+    case ReaderBackend::BUSY_POLL:
+      return "busy poll";
+  }
+  return "unknown";
+}
+
+std::chrono::microseconds get_cpu_time()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+         std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+/// \brief Run benchmark for the keyboard handler.
+/// \return Median latency in microseconds or negative value on failure.
+double run_benchmark(
+  KeyboardHandlerUnixImpl & keyboard_handler, ReaderBackend backend, int pty_master_fd,
+  size_t number_of_key_presses)
+{
+  using KeyCode = KeyboardHandlerUnixImpl::KeyCode;
+  using KeyModifiers = KeyboardHandlerUnixImpl::KeyModifiers;
+  std::atomic<int64_t> callback_time_ns{0};
+  keyboard_handler.add_key_press_callback(
+    [&callback_time_ns](KeyCode, KeyModifiers) {
+      callback_time_ns.store(
+        std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_release);
+    }, KeyCode::A);
+
+  std::vector<double> latencies_us;
+  latencies_us.reserve(number_of_key_presses);
+  for (size_t i = 0; i < number_of_key_presses; i++) {
+    // Let reader thread go to sleep before the next key press
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    callback_time_ns.store(0);
+    auto start = std::chrono::steady_clock::now();
+    if (write(pty_master_fd, "a", 1) != 1) {
+      std::cerr << "Error in write() to the pseudo terminal" << std::endl;
+      return -1.0;
+    }
+    // Spin to not add wake up latency of this thread to the measurement. Yield to let reader
+    // thread run on systems with a single CPU.
+    while (callback_time_ns.load(std::memory_order_acquire) == 0) {
+      if (std::chrono::steady_clock::now() - start > std::chrono::seconds(1)) {
+        std::cerr << "Key press lost" << std::endl;
+        return -1.0;
+      }
+      std::this_thread::yield();
+    }
+    auto end = std::chrono::steady_clock::time_point(
+      std::chrono::steady_clock::duration(callback_time_ns.load()));
+    latencies_us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+  }
+  std::sort(latencies_us.begin(), latencies_us.end());
+
+  auto cpu_time_before_idle = get_cpu_time();
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  auto idle_cpu_time = get_cpu_time() - cpu_time_before_idle;
+
+  double median_us = latencies_us[latencies_us.size() / 2];
+  std::printf(
+    "%-14s %-14s %10.1f %10.1f %10.1f %10.1f %16lld\n",
+    backend_to_str(backend), backend_to_str(keyboard_handler.get_reader_backend()),
+    latencies_us.front(), median_us,
+    latencies_us[latencies_us.size() * 99 / 100], latencies_us.back(),
+    static_cast<long long>(idle_cpu_time.count()));  // NOLINT(runtime/int)
+  return median_us;
+}
+}  // namespace
+
+int main(int argc, char ** argv)
+{
+  size_t number_of_key_presses = 1000;
+  if (argc > 1) {
+    number_of_key_presses = std::max(1L, std::strtol(argv[1], nullptr, 10));
+  }
+
+  int pty_master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (pty_master_fd == -1 || grantpt(pty_master_fd) == -1 || unlockpt(pty_master_fd) == -1) {
+    std::cerr << "Can't create pseudo terminal" << std::endl;
+    return EXIT_FAILURE;
+  }
+  int pty_slave_fd = open(ptsname(pty_master_fd), O_RDWR | O_NOCTTY);
+  if (pty_slave_fd == -1 || dup2(pty_slave_fd, fileno(stdin)) == -1) {
+    std::cerr << "Can't replace stdin with pseudo terminal" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::printf(
+    "%-14s %-14s %10s %10s %10s %10s %16s\n", "requested", "used", "min us", "median us",
+    "p99 us", "max us", "idle cpu us/s");
+  for (auto backend : {ReaderBackend::BLOCKING_READ, ReaderBackend::POLL}) {
+    KeyboardHandlerUnixImpl keyboard_handler(false, backend);
+    run_benchmark(keyboard_handler, backend, pty_master_fd, number_of_key_presses);
+  }
+
+  KeyboardHandlerUnixImpl::BusyPollSettings busy_poll_settings;
+  if (argc > 2) {
+    busy_poll_settings.cpu = static_cast<int>(std::strtol(argv[2], nullptr, 10));
+  }
+  double busy_poll_median_limit_us = 10.0;
+  if (argc > 3) {
+    busy_poll_median_limit_us = std::strtod(argv[3], nullptr);
+  }
+  double busy_poll_median_us = 0.0;
+  {
+    KeyboardHandlerUnixImpl keyboard_handler(false, busy_poll_settings);
+    busy_poll_median_us = run_benchmark(
+      keyboard_handler, ReaderBackend::BUSY_POLL, pty_master_fd, number_of_key_presses);
+  }
+  if (std::thread::hardware_concurrency() < 2) {
+    std::printf("busy poll reader shares the single CPU with the benchmark, results are skewed\n");
+  }
+  bool is_busy_poll_within_limit =
+    busy_poll_median_us >= 0.0 && busy_poll_median_us <= busy_poll_median_limit_us;
+  std::printf(
+    "busy poll median latency %.1f us, limit %.1f us: %s\n", busy_poll_median_us,
+    busy_poll_median_limit_us, is_busy_poll_within_limit ? "OK" : "FAILED");
+
+  close(pty_slave_fd);
+  close(pty_master_fd);
+  return is_busy_poll_within_limit ? EXIT_SUCCESS : EXIT_FAILURE;
+}
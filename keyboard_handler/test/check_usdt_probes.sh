@@ -0,0 +1,38 @@
+#!/bin/sh
+# Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Verify that all USDT probes are emitted into the .note.stapsdt section of the library.
+# Usage: check_usdt_probes.sh <path to libkeyboard_handler.so>
+
+LIBRARY="$1"
+if [ -z "$LIBRARY" ] || [ ! -f "$LIBRARY" ]; then
+  echo "Usage: $0 <path to libkeyboard_handler.so>"
+  exit 1
+fi
+
+NOTES=$(readelf -n "$LIBRARY") || exit 1
+# Each probe descriptor in .note.stapsdt printed as "Provider: <provider>" followed by "Name: <name>"
+PROBES=$(echo "$NOTES" | awk '/Provider:/ {provider = $2} /Name:/ {if (provider == "keyboard_handler") print $2}')
+
+STATUS=0
+for PROBE in read parse_input callback_add callback_delete dispatch callback; do
+  if echo "$PROBES" | grep -qx "$PROBE"; then
+    echo "Found probe keyboard_handler:${PROBE}"
+  else
+    echo "Missing probe keyboard_handler:${PROBE}"
+    STATUS=1
+  fi
+done
+exit $STATUS
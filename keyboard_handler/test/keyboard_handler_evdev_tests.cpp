@@ -0,0 +1,350 @@
+// Copyright 2021 Apex.AI, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/input.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "gmock/gmock.h"
+#include "keyboard_handler/keyboard_handler_evdev_impl.hpp"
+
+using KeyCode = KeyboardHandlerBase::KeyCode;
+using KeyModifiers = KeyboardHandlerBase::KeyModifiers;
+using KeyEventType = KeyboardHandlerBase::KeyEventType;
+
+namespace
+{
+struct input_event make_event(uint16_t type, uint16_t code, int32_t value, int64_t time_ms)
+{
+  struct input_event ev {};
+  ev.input_event_sec = time_ms / 1000;
+  ev.input_event_usec = (time_ms % 1000) * 1000;
+  ev.type = type;
+  ev.code = code;
+  ev.value = value;
+  return ev;
+}
+
+/// Appends key event followed by SYN_REPORT as the real device does.
+void add_key(
+  std::vector<struct input_event> & events, uint16_t code, int32_t value, int64_t time_ms)
+{
+  events.push_back(make_event(EV_KEY, code, value, time_ms));
+  events.push_back(make_event(EV_SYN, SYN_REPORT, 0, time_ms));
+}
+
+struct RecordedKeyEvent
+{
+  KeyCode key_code;
+  KeyModifiers key_modifiers;
+  KeyEventType event_type;
+
+  bool operator==(const RecordedKeyEvent & rhs) const
+  {
+    return key_code == rhs.key_code && key_modifiers == rhs.key_modifiers &&
+           event_type == rhs.event_type;
+  }
+};
+
+void PrintTo(const RecordedKeyEvent & event, std::ostream * os)
+{
+  *os << enum_key_modifiers_to_str(event.key_modifiers) << " " <<
+    enum_key_code_to_str(event.key_code) << " " << static_cast<uint32_t>(event.event_type);
+}
+
+/// Collects key events from the callbacks for all key codes and modifiers used in tests.
+class KeyEventRecorder
+{
+public:
+  void subscribe(KeyboardHandlerBase & keyboard_handler, KeyCode key_code, KeyModifiers mods)
+  {
+    keyboard_handler.add_key_event_callback(
+      [this](KeyCode key_code, KeyModifiers key_modifiers, KeyEventType event_type) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        events_.push_back({key_code, key_modifiers, event_type});
+        cv_.notify_all();
+      }, key_code, mods);
+  }
+
+  std::vector<RecordedKeyEvent> wait_for(size_t number_of_events)
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    cv_.wait_for(
+      lk, std::chrono::seconds(5), [&]() {return events_.size() >= number_of_events;});
+    return events_;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<RecordedKeyEvent> events_;
+};
+
+class KeyboardHandlerEvdevTest : public ::testing::Test
+{
+public:
+  void SetUp() override
+  {
+    char dir_template[] = "/tmp/keyboard_handler_evdev_XXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    dir_ = dir_template;
+    path_ = dir_ + "/events";
+  }
+
+  void TearDown() override
+  {
+    unlink(path_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  void write_events(int fd, const std::vector<struct input_event> & events)
+  {
+    auto length = events.size() * sizeof(struct input_event);
+    ASSERT_EQ(write(fd, events.data(), length), static_cast<ssize_t>(length));
+  }
+
+protected:
+  std::string dir_;
+  std::string path_;
+};
+}  // namespace
+
+TEST_F(KeyboardHandlerEvdevTest, open_non_existent_device) {
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+  EXPECT_THROW(KeyboardHandlerEvdevImpl{path_}, std::runtime_error);
+#endif
+  auto result = KeyboardHandlerEvdevImpl::create(path_);
+  EXPECT_FALSE(result);
+  EXPECT_EQ(result.error(), std::errc::no_such_file_or_directory);
+}
+
+TEST_F(KeyboardHandlerEvdevTest, grab_non_device_file) {
+  int fd = open(path_.c_str(), O_WRONLY | O_CREAT, 0600);
+  ASSERT_NE(fd, -1);
+  close(fd);
+  KeyboardHandlerEvdevImpl::EvdevSettings settings;
+  settings.grab_device = true;
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+  EXPECT_THROW(KeyboardHandlerEvdevImpl(path_, settings), std::runtime_error);
+#endif
+  auto result = KeyboardHandlerEvdevImpl::create(path_, settings);
+  EXPECT_FALSE(result);
+  EXPECT_TRUE(result.error());
+  settings.grab_device = false;
+  result = KeyboardHandlerEvdevImpl::create(path_, settings);
+  ASSERT_TRUE(result);
+  EXPECT_FALSE(result.error());
+  EXPECT_FALSE(result->get_reader_error());
+}
+
+TEST_F(KeyboardHandlerEvdevTest, scancode_translation) {
+  int fd = open(path_.c_str(), O_WRONLY | O_CREAT, 0600);
+  ASSERT_NE(fd, -1);
+  close(fd);
+  KeyboardHandlerEvdevImpl keyboard_handler(path_);
+
+  EXPECT_EQ(
+    keyboard_handler.scancode_to_enums(KEY_A, KeyModifiers::NONE),
+    std::make_tuple(KeyCode::A, KeyModifiers::NONE));
+  EXPECT_EQ(
+    keyboard_handler.scancode_to_enums(KEY_A, KeyModifiers::SHIFT),
+    std::make_tuple(KeyCode::A, KeyModifiers::SHIFT));
+  EXPECT_EQ(
+    keyboard_handler.scancode_to_enums(KEY_1, KeyModifiers::SHIFT | KeyModifiers::CTRL),
+    std::make_tuple(KeyCode::EXCLAMATION_MARK, KeyModifiers::CTRL));
+  EXPECT_EQ(
+    keyboard_handler.scancode_to_enums(KEY_KP5, KeyModifiers::SHIFT),
+    std::make_tuple(KeyCode::NUMBER_5, KeyModifiers::SHIFT));
+  EXPECT_EQ(
+    keyboard_handler.scancode_to_enums(KEY_TAB, KeyModifiers::NONE),
+    std::make_tuple(KeyCode::TAB, KeyModifiers::NONE));
+  EXPECT_EQ(
+    keyboard_handler.scancode_to_enums(KEY_LEFTMETA, KeyModifiers::NONE),
+    std::make_tuple(KeyCode::UNKNOWN, KeyModifiers::NONE));
+}
+
+TEST_F(KeyboardHandlerEvdevTest, recorded_events) {
+  std::vector<struct input_event> events;
+  // SHIFT + A with release of SHIFT before release of A
+  add_key(events, KEY_LEFTSHIFT, 1, 1000);
+  add_key(events, KEY_A, 1, 1010);
+  add_key(events, KEY_LEFTSHIFT, 0, 1020);
+  add_key(events, KEY_A, 0, 1030);
+  // Keypad 5 held for 700 ms with autorepeat and right CTRL
+  add_key(events, KEY_RIGHTCTRL, 1, 2000);
+  add_key(events, KEY_KP5, 1, 2010);
+  add_key(events, KEY_KP5, 2, 2260);
+  add_key(events, KEY_KP5, 2, 2510);
+  add_key(events, KEY_KP5, 0, 2710);
+  add_key(events, KEY_RIGHTCTRL, 0, 2720);
+  // Events dropped by the kernel while ENTER was held
+  add_key(events, KEY_ENTER, 1, 3000);
+  events.push_back(make_event(EV_SYN, SYN_DROPPED, 0, 3010));
+  add_key(events, KEY_ENTER, 0, 3020);
+  // Plain key press
+  add_key(events, KEY_SPACE, 1, 4000);
+  add_key(events, KEY_SPACE, 0, 4010);
+
+  // Named pipe lets subscribe before reader thread will reach the end of input
+  ASSERT_EQ(mkfifo(path_.c_str(), 0600), 0);
+  int fifo_fd = open(path_.c_str(), O_RDWR);
+  ASSERT_NE(fifo_fd, -1);
+  // Declared before keyboard handler to outlive its reader thread
+  KeyEventRecorder recorder;
+  std::atomic<size_t> number_of_space_presses{0};
+  KeyboardHandlerEvdevImpl::EvdevSettings settings;
+  settings.long_press_threshold = std::chrono::milliseconds(500);
+  KeyboardHandlerEvdevImpl keyboard_handler(path_, settings);
+
+  recorder.subscribe(keyboard_handler, KeyCode::A, KeyModifiers::SHIFT);
+  recorder.subscribe(keyboard_handler, KeyCode::NUMBER_5, KeyModifiers::CTRL);
+  recorder.subscribe(keyboard_handler, KeyCode::ENTER, KeyModifiers::NONE);
+  recorder.subscribe(keyboard_handler, KeyCode::SPACE, KeyModifiers::NONE);
+  keyboard_handler.add_key_press_callback(
+    [&](KeyCode, KeyModifiers) {number_of_space_presses++;}, KeyCode::SPACE);
+
+  write_events(fifo_fd, events);
+  close(fifo_fd);
+
+  std::vector<RecordedKeyEvent> expected = {
+    {KeyCode::A, KeyModifiers::SHIFT, KeyEventType::PRESS},
+    {KeyCode::A, KeyModifiers::SHIFT, KeyEventType::RELEASE},
+    {KeyCode::NUMBER_5, KeyModifiers::CTRL, KeyEventType::PRESS},
+    {KeyCode::NUMBER_5, KeyModifiers::CTRL, KeyEventType::REPEAT},
+    {KeyCode::NUMBER_5, KeyModifiers::CTRL, KeyEventType::LONG_PRESS},
+    {KeyCode::NUMBER_5, KeyModifiers::CTRL, KeyEventType::REPEAT},
+    {KeyCode::NUMBER_5, KeyModifiers::CTRL, KeyEventType::RELEASE},
+    {KeyCode::ENTER, KeyModifiers::NONE, KeyEventType::PRESS},
+    {KeyCode::ENTER, KeyModifiers::NONE, KeyEventType::RELEASE},
+    {KeyCode::SPACE, KeyModifiers::NONE, KeyEventType::PRESS},
+    {KeyCode::SPACE, KeyModifiers::NONE, KeyEventType::RELEASE},
+  };
+  EXPECT_THAT(recorder.wait_for(expected.size()), ::testing::ContainerEq(expected));
+  // Callbacks for key presses are not called for release
+  EXPECT_EQ(number_of_space_presses, 1u);
+  EXPECT_EQ(keyboard_handler.get_held_key_modifiers(), KeyModifiers::NONE);
+}
+
+TEST_F(KeyboardHandlerEvdevTest, long_press_without_autorepeat) {
+  ASSERT_EQ(mkfifo(path_.c_str(), 0600), 0);
+  int fifo_fd = open(path_.c_str(), O_RDWR);
+  ASSERT_NE(fifo_fd, -1);
+  KeyEventRecorder recorder;
+  KeyboardHandlerEvdevImpl::EvdevSettings settings;
+  settings.long_press_threshold = std::chrono::milliseconds(50);
+  KeyboardHandlerEvdevImpl keyboard_handler(path_, settings);
+  recorder.subscribe(keyboard_handler, KeyCode::F5, KeyModifiers::NONE);
+
+  std::vector<struct input_event> events;
+  add_key(events, KEY_F5, 1, 0);
+  // Split event between writes as pipe could do
+  const char * bytes = reinterpret_cast<const char *>(events.data());
+  ASSERT_EQ(write(fifo_fd, bytes, 5), 5);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto rest = events.size() * sizeof(struct input_event) - 5;
+  ASSERT_EQ(write(fifo_fd, bytes + 5, rest), static_cast<ssize_t>(rest));
+  auto press_time = std::chrono::steady_clock::now();
+  // Long press is reported by elapsed time without any further events from the device
+  auto recorded_events = recorder.wait_for(2);
+  auto elapsed = std::chrono::steady_clock::now() - press_time;
+  ASSERT_EQ(recorded_events.size(), 2u);
+  EXPECT_EQ(recorded_events[1].event_type, KeyEventType::LONG_PRESS);
+  EXPECT_GE(elapsed, std::chrono::milliseconds(40));
+
+  events.clear();
+  add_key(events, KEY_F5, 0, 10);
+  write_events(fifo_fd, events);
+  recorded_events = recorder.wait_for(3);
+  ASSERT_EQ(recorded_events.size(), 3u);
+  EXPECT_EQ(recorded_events[2].event_type, KeyEventType::RELEASE);
+  close(fifo_fd);
+}
+
+TEST_F(KeyboardHandlerEvdevTest, hold_callback_with_accelerating_repeat) {
+  using Clock = std::chrono::steady_clock;
+  ASSERT_EQ(mkfifo(path_.c_str(), 0600), 0);
+  int fifo_fd = open(path_.c_str(), O_RDWR);
+  ASSERT_NE(fifo_fd, -1);
+  std::mutex call_times_mutex;
+  std::condition_variable call_times_cv;
+  std::vector<Clock::time_point> call_times;
+  KeyboardHandlerEvdevImpl::EvdevSettings evdev_settings;
+  evdev_settings.long_press_threshold = std::chrono::milliseconds(0);
+  KeyboardHandlerEvdevImpl keyboard_handler(path_, evdev_settings);
+
+  KeyboardHandlerBase::HoldSettings hold_settings;
+  hold_settings.hold_duration = std::chrono::milliseconds(50);
+  hold_settings.repeat_interval = std::chrono::milliseconds(40);
+  hold_settings.repeat_acceleration = 0.5;
+  hold_settings.min_repeat_interval = std::chrono::milliseconds(5);
+  auto handle = keyboard_handler.add_key_hold_callback(
+    [&](KeyCode key_code, KeyModifiers key_modifiers) {
+      EXPECT_EQ(key_code, KeyCode::H);
+      EXPECT_EQ(key_modifiers, KeyModifiers::NONE);
+      std::lock_guard<std::mutex> lk(call_times_mutex);
+      call_times.push_back(Clock::now());
+      call_times_cv.notify_all();
+    }, hold_settings, KeyCode::H);
+  EXPECT_NE(handle, KeyboardHandlerBase::invalid_handle);
+  auto wait_for_calls = [&](size_t number_of_calls) {
+      std::unique_lock<std::mutex> lk(call_times_mutex);
+      call_times_cv.wait_for(
+        lk, std::chrono::seconds(5), [&]() {return call_times.size() >= number_of_calls;});
+      return call_times;
+    };
+
+  std::vector<struct input_event> events;
+  add_key(events, KEY_H, 1, 0);
+  auto press_time = Clock::now();
+  write_events(fifo_fd, events);
+  // 50 ms hold, then repeats after 40, 20, 10, 5, 5 ms
+  // Repeats continue after the sixth call until release, so only the first six are checked
+  auto hold_call_times = wait_for_calls(6);
+  ASSERT_GE(hold_call_times.size(), 6u);
+  // Calls are kept on the schedule counted from the press and are never early
+  EXPECT_GE(hold_call_times[0] - press_time, std::chrono::milliseconds(50));
+  EXPECT_GE(hold_call_times[1] - press_time, std::chrono::milliseconds(90));
+  EXPECT_GE(hold_call_times[5] - press_time, std::chrono::milliseconds(130));
+
+  // Autorepeat from the device doesn't restart the hold
+  events.clear();
+  add_key(events, KEY_H, 2, 30);
+  add_key(events, KEY_H, 0, 40);
+  write_events(fifo_fd, events);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  size_t number_of_calls = wait_for_calls(0).size();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(wait_for_calls(0).size(), number_of_calls);
+
+  // Release before the hold duration doesn't call back
+  events.clear();
+  add_key(events, KEY_H, 1, 100);
+  add_key(events, KEY_H, 0, 110);
+  write_events(fifo_fd, events);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(wait_for_calls(0).size(), number_of_calls);
+  close(fifo_fd);
+}
+#endif  // #ifdef __linux__
@@ -13,18 +13,28 @@
 // limitations under the License.
 
 #ifndef _WIN32
+#include <poll.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <algorithm>
 #include <condition_variable>
 #include <csignal>
+#include <future>
 #include <memory>
+#include <random>
 #include <string>
 #include <utility>
 #include <tuple>
+#include <vector>
 #include "gmock/gmock.h"
 #include "fake_recorder.hpp"
 #include "fake_player.hpp"
+#include "keyboard_handler/input_pipeline.hpp"
+#include "keyboard_handler/key_chord.hpp"
 #include "keyboard_handler/keyboard_handler_unix_impl.hpp"
+#include "keyboard_handler/static_bindings.hpp"
+#include "keyboard_handler/timer_wheel.hpp"
 
 using ::testing::Return;
 using ::testing::Eq;
@@ -39,6 +49,20 @@ int isatty_mock(int fd) {return 1;}
 int tcgetattr_mock(int fd, struct termios * termios_p) {return 0;}
 
 int tcsetattr_mock(int fd, int optional_actions, const struct termios * termios_p) {return 0;}
+
+std::atomic<int> g_applied_vtime{-1};
+
+int tcsetattr_capture_vtime(int fd, int optional_actions, const struct termios * termios_p)
+{
+  g_applied_vtime = termios_p->c_cc[VTIME];
+  return 0;
+}
+
+int tcsetattr_fail(int fd, int optional_actions, const struct termios * termios_p)
+{
+  errno = EIO;
+  return -1;
+}
 }  // namespace
 
 // Mock the public system calls APIs. read() function become the stub function.
@@ -110,6 +134,27 @@ private:
 
 std::shared_ptr<MockSystemCalls> g_system_calls_stub;
 
+class CaptureLogSink : public LogSink
+{
+public:
+  void log(LogSeverity severity, const char * message, size_t length) noexcept override
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    messages_.emplace_back(severity, std::string(message, length));
+  }
+
+  std::vector<std::pair<LogSeverity, std::string>> get_messages()
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    return messages_;
+  }
+
+  std::mutex mutex_;
+
+private:
+  std::vector<std::pair<LogSeverity, std::string>> messages_;
+};
+
 class MockKeyboardHandler : public KeyboardHandlerUnixImpl
 {
 public:
@@ -117,9 +162,10 @@ public:
     const readFunction & read_fn,
     const isattyFunction & isatty_fn = isatty_mock,
     std::weak_ptr<MockSystemCalls> system_calls_stub = g_system_calls_stub,
-    bool install_signal_handler = false)
+    bool install_signal_handler = false,
+    const tcgetpgrpFunction & tcgetpgrp_fn = tcgetpgrp)
   : KeyboardHandlerUnixImpl(read_fn, isatty_fn, tcgetattr_mock, tcsetattr_mock,
-      install_signal_handler),
+      install_signal_handler, tcgetpgrp_fn),
     system_calls_stub_(std::move(system_calls_stub)) {}
 
   ~MockKeyboardHandler() override
@@ -137,6 +183,35 @@ public:
     return callbacks_.size();
   }
 
+  bool write_to_terminal(const char * data, size_t length) override
+  {
+    std::lock_guard<std::mutex> lk(written_to_terminal_mutex_);
+    written_to_terminal_.append(data, length);
+    return true;
+  }
+
+  std::string get_written_to_terminal()
+  {
+    std::lock_guard<std::mutex> lk(written_to_terminal_mutex_);
+    return written_to_terminal_;
+  }
+
+  bool wait_for_number_of_registered_callbacks(
+    size_t expected_number, std::chrono::milliseconds timeout)
+  {
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < timeout) {
+      {
+        std::lock_guard<std::mutex> lk(callbacks_mutex_);
+        if (callbacks_.size() == expected_number) {
+          return true;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+  }
+
   std::tuple<KeyCode, KeyModifiers> parse_input_mock(const char * buff, ssize_t read_bytes)
   {
     return parse_input(buff, read_bytes - 1);  // -1 to strip out null terminator
@@ -146,6 +221,8 @@ public:
 
 private:
   std::weak_ptr<MockSystemCalls> system_calls_stub_;
+  std::mutex written_to_terminal_mutex_;
+  std::string written_to_terminal_;
 };
 
 class MockPlayer : public FakePlayer
@@ -182,6 +259,22 @@ public:
     running_ = false;
   }
 
+  /// \brief Poll predicate until it returns true or timeout expires.
+  /// \return Last result of the predicate.
+  template<typename PredicateT>
+  static bool wait_until(
+    PredicateT predicate, std::chrono::milliseconds timeout = std::chrono::seconds(5))
+  {
+    auto start = std::chrono::steady_clock::now();
+    while (!predicate()) {
+      if (std::chrono::steady_clock::now() - start >= timeout) {
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+
 protected:
   KeyboardHandlerUnixImpl::readFunction read_fn_ = nullptr;
   static std::atomic_bool running_;
@@ -443,9 +536,12 @@ TEST_F(KeyboardHandlerUnixTest, install_signal_handler_with_old_handler) {
 
 TEST_F(KeyboardHandlerUnixTest, force_exit_from_main_loop_after_signal_handling) {
   constexpr int expected_ret_code = 101;
+  int ready_pipe_fds[2];
+  ASSERT_EQ(pipe(ready_pipe_fds), 0);
   auto process_id = fork();
 
   if (process_id == 0) {  // In child process
+    close(ready_pipe_fds[0]);
     auto old_sigint_handler = std::signal(SIGINT, KeyboardHandlerUnixTest::on_signal);
     EXPECT_NE(old_sigint_handler, SIG_ERR) << "Can't install SIGINT handler in test";
     using KeyCode = KeyboardHandler::KeyCode;
@@ -456,6 +552,9 @@ TEST_F(KeyboardHandlerUnixTest, force_exit_from_main_loop_after_signal_handling)
       g_system_calls_stub->read_will_repeatedly_return("E");
       MockKeyboardHandler keyboard_handler(read_fn_, isatty_mock, g_system_calls_stub, true);
       keyboard_handler.unblock_read_fn_on_destruction_ = false;
+      // Let parent send SIGINT only after keyboard handler installed its signal handler
+      EXPECT_EQ(write(ready_pipe_fds[1], "r", 1), 1);
+      close(ready_pipe_fds[1]);
 
       while (running_) {
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -468,7 +567,10 @@ TEST_F(KeyboardHandlerUnixTest, force_exit_from_main_loop_after_signal_handling)
     // terminate it by timeout
     _exit(expected_ret_code);
   } else {
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    close(ready_pipe_fds[1]);
+    struct pollfd ready_pollfd = {ready_pipe_fds[0], POLLIN, 0};
+    EXPECT_EQ(poll(&ready_pollfd, 1, 10000), 1) << "Child process wasn't ready in time";
+    close(ready_pipe_fds[0]);
     kill(process_id, SIGINT);
 
     int status = EXIT_FAILURE;
@@ -502,4 +604,1636 @@ TEST_F(KeyboardHandlerUnixTest, return_old_signal_handler_after_destruction) {
   old_sigint_handler = std::signal(SIGINT, SIG_DFL);
   EXPECT_EQ(old_sigint_handler, on_signal);
 }
+
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+TEST_F(KeyboardHandlerUnixTest, return_old_signal_handler_after_failed_construction) {
+  auto on_signal = [](int /* signal */) {
+      _exit(EXIT_SUCCESS);
+    };
+  class FailingKeyboardHandler : public KeyboardHandlerUnixImpl
+  {
+public:
+    explicit FailingKeyboardHandler(const readFunction & read_fn)
+    : KeyboardHandlerUnixImpl(read_fn, isatty_mock, tcgetattr_mock, tcsetattr_fail, true) {}
+  };
+  auto old_sigint_handler = std::signal(SIGINT, on_signal);
+  EXPECT_NE(old_sigint_handler, SIG_ERR) << "Can't install SIGINT handler in test";
+  // Destructor doesn't run when constructor throws
+  EXPECT_THROW(FailingKeyboardHandler{read_fn_}, std::runtime_error);
+  EXPECT_EQ(std::signal(SIGTTIN, SIG_DFL), SIG_DFL);
+  old_sigint_handler = std::signal(SIGINT, SIG_DFL);
+  EXPECT_EQ(old_sigint_handler, on_signal);
+}
+#endif
+
+TEST_F(KeyboardHandlerUnixTest, input_pipeline_stages) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  bool modal_dialog_open = false;
+  size_t logged_keys = 0;
+  auto pipeline = make_input_pipeline(
+    [&logged_keys](KeyCode &, KeyModifiers &) {
+      logged_keys++;
+      return true;
+    },
+    make_suppress_stage([&modal_dialog_open]() {return modal_dialog_open;}),
+    KeyRemapStage(KeyCode::E, KeyModifiers::NONE, KeyCode::A, KeyModifiers::CTRL));
+
+  KeyCode key_code = KeyCode::E;
+  KeyModifiers key_modifiers = KeyModifiers::NONE;
+  EXPECT_TRUE(pipeline(key_code, key_modifiers));
+  EXPECT_EQ(key_code, KeyCode::A);
+  EXPECT_EQ(key_modifiers, KeyModifiers::CTRL);
+
+  modal_dialog_open = true;
+  key_code = KeyCode::E;
+  key_modifiers = KeyModifiers::NONE;
+  EXPECT_FALSE(pipeline(key_code, key_modifiers));
+  EXPECT_EQ(key_code, KeyCode::E);
+  EXPECT_EQ(logged_keys, 2U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, input_filters_remap_and_drop_key_presses) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  testing::MockFunction<void(KeyCode key_code, KeyModifiers key_modifiers)> mock_callback_a;
+  testing::MockFunction<void(KeyCode key_code, KeyModifiers key_modifiers)> mock_callback_e;
+  testing::MockFunction<void(KeyCode key_code, KeyModifiers key_modifiers)> mock_callback_q;
+
+  EXPECT_CALL(mock_callback_a, Call(Eq(KeyCode::A), Eq(KeyModifiers::NONE))).Times(AtLeast(1));
+  EXPECT_CALL(mock_callback_e, Call(_, _)).Times(0);
+  EXPECT_CALL(mock_callback_q, Call(_, _)).Times(0);
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  keyboard_handler.add_key_press_callback(mock_callback_a.AsStdFunction(), KeyCode::A);
+  keyboard_handler.add_key_press_callback(mock_callback_e.AsStdFunction(), KeyCode::E);
+  keyboard_handler.add_key_press_callback(mock_callback_q.AsStdFunction(), KeyCode::Q);
+
+  EXPECT_NE(
+    KeyboardHandler::invalid_handle,
+    keyboard_handler.add_input_filter(
+      KeyRemapStage(KeyCode::E, KeyModifiers::NONE, KeyCode::A, KeyModifiers::NONE)));
+  auto drop_all_handle = keyboard_handler.add_input_filter(
+    [](KeyCode &, KeyModifiers &) {return false;});
+  EXPECT_NE(drop_all_handle, KeyboardHandler::invalid_handle);
+  keyboard_handler.delete_input_filter(drop_all_handle);
+  EXPECT_EQ(KeyboardHandler::invalid_handle, keyboard_handler.add_input_filter(nullptr));
+
+  g_system_calls_stub->read_will_return_once("e");
+}
+
+TEST_F(KeyboardHandlerUnixTest, weak_owner_callbacks) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  auto alive_player = std::make_shared<MockPlayer>();
+  EXPECT_CALL(*alive_player, callback_func(Eq(KeyCode::CURSOR_UP), _)).Times(AtLeast(1));
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  const std::string terminal_seq = keyboard_handler.get_terminal_sequence(KeyCode::CURSOR_UP);
+
+  EXPECT_EQ(
+    KeyboardHandler::invalid_handle,
+    keyboard_handler.add_key_press_callback(
+      std::weak_ptr<void>(), [](KeyCode, KeyboardHandler::KeyModifiers) {}, KeyCode::CURSOR_UP));
+
+  EXPECT_NE(
+    KeyboardHandler::invalid_handle,
+    keyboard_handler.add_key_press_callback(
+      alive_player, &MockPlayer::callback_func, KeyCode::CURSOR_UP));
+  {
+    auto deleted_player = std::make_shared<MockPlayer>();
+    EXPECT_CALL(*deleted_player, callback_func(_, _)).Times(0);
+    EXPECT_NE(
+      KeyboardHandler::invalid_handle,
+      keyboard_handler.add_key_press_callback(
+        deleted_player, &MockPlayer::callback_func, KeyCode::CURSOR_UP));
+  }
+  ASSERT_EQ(keyboard_handler.get_number_of_registered_callbacks(), 2U);
+
+  g_system_calls_stub->read_will_return_once(terminal_seq);
+  // Callback with expired owner shall be pruned after the first dispatch
+  EXPECT_TRUE(
+    keyboard_handler.wait_for_number_of_registered_callbacks(1U, std::chrono::seconds(5)));
+}
+
+TEST_F(KeyboardHandlerUnixTest, scoped_key_binding) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  auto callback = [](KeyCode, KeyboardHandler::KeyModifiers) {};
+  {
+    ScopedKeyBinding binding(
+      keyboard_handler, keyboard_handler.add_key_press_callback(callback, KeyCode::E));
+    EXPECT_NE(binding.get(), KeyboardHandler::invalid_handle);
+    EXPECT_EQ(keyboard_handler.get_number_of_registered_callbacks(), 1U);
+
+    ScopedKeyBinding moved_binding(std::move(binding));
+    EXPECT_EQ(binding.get(), KeyboardHandler::invalid_handle);
+    EXPECT_EQ(keyboard_handler.get_number_of_registered_callbacks(), 1U);
+
+    ScopedKeyBinding released_binding(
+      keyboard_handler, keyboard_handler.add_key_press_callback(callback, KeyCode::Q));
+    auto released_handle = released_binding.release();
+    EXPECT_EQ(keyboard_handler.get_number_of_registered_callbacks(), 2U);
+    keyboard_handler.delete_key_press_callback(released_handle);
+  }
+  EXPECT_EQ(keyboard_handler.get_number_of_registered_callbacks(), 0U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, owner_released_by_its_callback) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  struct Owner
+  {
+    ScopedKeyBinding binding;
+  };
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  auto owner = std::make_shared<Owner>();
+  std::atomic_bool is_called{false};
+  // Callback drops the last reference to its owner, which deletes the callback on destruction
+  auto callback = [&owner, &is_called](KeyCode, KeyboardHandler::KeyModifiers) {
+      owner.reset();
+      is_called = true;
+    };
+  owner->binding = ScopedKeyBinding(
+    keyboard_handler,
+    keyboard_handler.add_key_press_callback(std::weak_ptr<void>(owner), callback, KeyCode::E));
+  ASSERT_EQ(keyboard_handler.get_number_of_registered_callbacks(), 1U);
+
+  g_system_calls_stub->read_will_return_once("e");
+  EXPECT_TRUE(
+    keyboard_handler.wait_for_number_of_registered_callbacks(0U, std::chrono::seconds(5)));
+  EXPECT_TRUE(is_called.load());
+}
+
+TEST_F(KeyboardHandlerUnixTest, passthrough_all_input) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  testing::MockFunction<void(KeyCode key_code, KeyboardHandler::KeyModifiers key_modifiers)>
+    mock_callback;
+  EXPECT_CALL(mock_callback, Call(_, _)).Times(0);
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  EXPECT_EQ(keyboard_handler.get_passthrough_fd(), -1);
+  keyboard_handler.add_key_press_callback(mock_callback.AsStdFunction(), KeyCode::H);
+  ASSERT_TRUE(keyboard_handler.set_passthrough_mode(KeyboardHandler::PassthroughMode::ALL));
+  EXPECT_EQ(keyboard_handler.get_passthrough_mode(), KeyboardHandler::PassthroughMode::ALL);
+  const int passthrough_fd = keyboard_handler.get_passthrough_fd();
+  ASSERT_NE(passthrough_fd, -1);
+
+  g_system_calls_stub->read_will_return_once("hello\n");
+  char buff[16] = {0};
+  ASSERT_EQ(read(passthrough_fd, buff, sizeof(buff)), 6);
+  EXPECT_STREQ(buff, "hello\n");
+  ASSERT_TRUE(keyboard_handler.set_passthrough_mode(KeyboardHandler::PassthroughMode::OFF));
+}
+
+TEST_F(KeyboardHandlerUnixTest, passthrough_unhandled_input) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  std::atomic<size_t> number_of_calls{0};
+  auto callback = [&number_of_calls](KeyCode, KeyboardHandler::KeyModifiers) {
+      number_of_calls++;
+    };
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::E);
+  ASSERT_TRUE(keyboard_handler.set_passthrough_mode(KeyboardHandler::PassthroughMode::UNHANDLED));
+  const int passthrough_fd = keyboard_handler.get_passthrough_fd();
+  ASSERT_NE(passthrough_fd, -1);
+
+  g_system_calls_stub->read_will_return_once("q");
+  char buff[16] = {0};
+  ASSERT_EQ(read(passthrough_fd, buff, sizeof(buff)), 1);
+  EXPECT_STREQ(buff, "q");
+  EXPECT_EQ(number_of_calls.load(), 0U);
+
+  // Key press pushed to the event queue isn't handled yet and is forwarded as well
+  ASSERT_TRUE(keyboard_handler.enable_event_queue(4));
+  g_system_calls_stub->read_will_return_once("w");
+  ASSERT_EQ(read(passthrough_fd, buff, sizeof(buff)), 1);
+  EXPECT_EQ(buff[0], 'w');
+  KeyboardHandler::KeyEvent event{};
+  ASSERT_TRUE(keyboard_handler.wait_pop_event(event, std::chrono::seconds(5)));
+  EXPECT_EQ(event.key_code, KeyCode::W);
+
+  // Destructor could stop reader before it reads the key, wait for the dispatch
+  g_system_calls_stub->read_will_return_once("e");
+  wait_until([&]() {return number_of_calls.load() != 0;});
+  EXPECT_GT(number_of_calls.load(), 0U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, unknown_sequence_callback) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  testing::MockFunction<void(KeyCode key_code, KeyboardHandler::KeyModifiers key_modifiers)>
+    mock_unknown_key_callback;
+  EXPECT_CALL(mock_unknown_key_callback, Call(_, _)).Times(0);
+
+  const char SHIFT_F1[] = {27, 91, 49, 59, 50, 80, '\0'};
+  std::promise<std::string> unknown_sequence_promise;
+  auto unknown_sequence_future = unknown_sequence_promise.get_future();
+  bool promise_satisfied = false;
+  {
+    MockKeyboardHandler keyboard_handler(read_fn_);
+    keyboard_handler.add_key_press_callback(
+      mock_unknown_key_callback.AsStdFunction(), KeyCode::UNKNOWN);
+    const auto start_time = std::chrono::steady_clock::now();
+    keyboard_handler.set_unknown_sequence_callback(
+      [&](const char * data, size_t length, std::chrono::steady_clock::time_point timestamp) {
+        EXPECT_GE(timestamp, start_time);
+        if (!promise_satisfied) {
+          promise_satisfied = true;
+          unknown_sequence_promise.set_value(std::string(data, length));
+        }
+      });
+    g_system_calls_stub->read_will_return_once(SHIFT_F1);
+    ASSERT_EQ(
+      unknown_sequence_future.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+  }
+  EXPECT_EQ(unknown_sequence_future.get(), std::string(SHIFT_F1));
+}
+
+TEST_F(KeyboardHandlerUnixTest, no_reading_in_background) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  std::atomic_bool in_foreground{false};
+  auto tcgetpgrp_mock = [&in_foreground](int) -> pid_t {
+      return in_foreground ? getpgrp() : getpgrp() + 1;
+    };
+  std::atomic<size_t> number_of_calls{0};
+  auto callback = [&number_of_calls](KeyCode, KeyboardHandler::KeyModifiers) {
+      number_of_calls++;
+    };
+
+  MockKeyboardHandler keyboard_handler(
+    read_fn_, isatty_mock, g_system_calls_stub, false, tcgetpgrp_mock);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::E);
+  g_system_calls_stub->read_will_repeatedly_return("e");
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  EXPECT_EQ(number_of_calls.load(), 0U);
+
+  in_foreground = true;
+  wait_until([&]() {return number_of_calls.load() != 0;});
+  EXPECT_GT(number_of_calls.load(), 0U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, raw_mode_deferred_and_timers_serviced_in_background) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  std::atomic_bool in_foreground{false};
+  auto tcgetpgrp_mock = [&in_foreground](int) -> pid_t {
+      return in_foreground ? getpgrp() : getpgrp() + 1;
+    };
+  std::atomic<size_t> number_of_tcsetattr_calls{0};
+  auto tcsetattr_count = [&number_of_tcsetattr_calls](int, int, const struct termios *) {
+      number_of_tcsetattr_calls++;
+      return 0;
+    };
+  class BackgroundKeyboardHandler : public KeyboardHandlerUnixImpl
+  {
+public:
+    BackgroundKeyboardHandler(
+      const readFunction & read_fn, const tcsetattrFunction & tcsetattr_fn,
+      const tcgetpgrpFunction & tcgetpgrp_fn)
+    : KeyboardHandlerUnixImpl(
+        read_fn, isatty_mock, tcgetattr_mock, tcsetattr_fn, false, tcgetpgrp_fn) {}
+  };
+  std::atomic<size_t> number_of_hold_calls{0};
+  auto hold_callback = [&number_of_hold_calls](KeyCode, KeyboardHandler::KeyModifiers) {
+      number_of_hold_calls++;
+    };
+  KeyboardHandler::HoldSettings hold_settings;
+  hold_settings.hold_duration = std::chrono::milliseconds(10);
+  hold_settings.repeat_interval = std::chrono::milliseconds(10);
+  hold_settings.release_timeout = std::chrono::seconds(5);
+
+  BackgroundKeyboardHandler keyboard_handler(read_fn_, tcsetattr_count, tcgetpgrp_mock);
+  // Terminal settings aren't changed from the background, it would stop process with SIGTTOU
+  EXPECT_EQ(number_of_tcsetattr_calls.load(), 0U);
+  ASSERT_NE(
+    keyboard_handler.add_key_hold_callback(hold_callback, hold_settings, KeyCode::H),
+    KeyboardHandler::invalid_handle);
+  // Injected input and timers are serviced while waiting for the foreground
+  ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::H));
+  wait_until([&]() {return number_of_hold_calls.load() >= 2;});
+  EXPECT_GE(number_of_hold_calls.load(), 2U);
+  EXPECT_EQ(number_of_tcsetattr_calls.load(), 0U);
+
+  in_foreground = true;
+  wait_until([&]() {return number_of_tcsetattr_calls.load() != 0;});
+  EXPECT_GT(number_of_tcsetattr_calls.load(), 0U);
+  g_system_calls_stub->unblock_read();
+}
+
+TEST_F(KeyboardHandlerUnixTest, async_log_sink_keeps_order_and_drops_on_overflow) {
+  auto capture_sink = std::make_shared<CaptureLogSink>();
+  constexpr size_t number_of_messages = 10;
+  uint64_t number_of_dropped_messages = 0;
+  {
+    AsyncLogSink async_sink(capture_sink, 4);
+    {
+      // Block writer thread on the first message to overflow the ring buffer
+      std::lock_guard<std::mutex> lk(capture_sink->mutex_);
+      for (size_t i = 0; i < number_of_messages; i++) {
+        std::string message = "message " + std::to_string(i);
+        async_sink.log(LogSeverity::INFO, message.data(), message.size());
+      }
+    }
+    async_sink.flush();
+    number_of_dropped_messages = async_sink.get_number_of_dropped_messages();
+  }
+  EXPECT_GE(number_of_dropped_messages, number_of_messages - 5);
+  auto messages = capture_sink->get_messages();
+  ASSERT_EQ(messages.size() + number_of_dropped_messages, number_of_messages);
+  for (size_t i = 0; i < messages.size(); i++) {
+    EXPECT_EQ(messages[i].second, "message " + std::to_string(i));
+  }
+}
+
+TEST_F(KeyboardHandlerUnixTest, debug_logging_of_key_presses) {
+  auto capture_sink = std::make_shared<CaptureLogSink>();
+  auto async_sink = std::make_shared<AsyncLogSink>(capture_sink);
+  auto old_log_sink = KeyboardHandler::get_log_sink();
+  KeyboardHandler::set_log_sink(async_sink);
+  KeyboardHandler::set_log_severity(LogSeverity::DEBUG);
+  {
+    MockKeyboardHandler keyboard_handler(read_fn_);
+    g_system_calls_stub->read_will_return_once("E");
+  }
+  KeyboardHandler::set_log_severity(LogSeverity::INFO);
+  KeyboardHandler::set_log_sink(old_log_sink);
+  async_sink->flush();
+
+  auto messages = capture_sink->get_messages();
+  auto it = std::find_if(
+    messages.begin(), messages.end(), [](const std::pair<LogSeverity, std::string> & message) {
+      return message.second == "pressed key: SHIFT + 'e'";
+    });
+  ASSERT_NE(it, messages.end());
+  EXPECT_EQ(it->first, LogSeverity::DEBUG);
+}
+
+TEST_F(KeyboardHandlerUnixTest, bounded_queue_push_pop) {
+  BoundedQueue<int> queue(3);
+  EXPECT_EQ(queue.capacity(), 4U);
+  EXPECT_TRUE(queue.empty());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.try_push(i));
+  }
+  EXPECT_FALSE(queue.try_push(4));
+  EXPECT_EQ(queue.size(), 4U);
+  int value = -1;
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(queue.try_pop(value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_FALSE(queue.try_pop(value));
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST_F(KeyboardHandlerUnixTest, timer_wheel_fires_on_time) {
+  using Clock = TimerWheel::clock;
+  using std::chrono::milliseconds;
+  const auto start = Clock::time_point(std::chrono::hours(1));
+  TimerWheel timer_wheel(milliseconds(1), start);
+  EXPECT_EQ(timer_wheel.get_next_deadline(), Clock::time_point::max());
+
+  // Deadlines in all levels and beyond the range of the wheel, some of them cancelled
+  std::mt19937 random_engine(42);
+  std::uniform_int_distribution<int64_t> deadline_distribution(0, 20000000);
+  struct Timer
+  {
+    Clock::time_point deadline;
+    TimerWheel::timer_id_t timer_id;
+    bool is_cancelled;
+  };
+  std::vector<Timer> timers(500);
+  std::vector<Clock::time_point> fire_times(timers.size());
+  std::vector<size_t> number_of_calls(timers.size(), 0);
+  Clock::time_point now = start;
+  for (size_t i = 0; i < timers.size(); i++) {
+    int64_t deadline_us = deadline_distribution(random_engine);
+    if (i % 10 == 0) {
+      deadline_us %= 1000;
+    } else if (i == 1) {
+      deadline_us = std::chrono::microseconds(std::chrono::hours(6)).count();
+    }
+    timers[i].deadline = start + std::chrono::microseconds(deadline_us);
+    timers[i].timer_id = timer_wheel.schedule(
+      timers[i].deadline, [i, &now, &fire_times, &number_of_calls]() {
+        fire_times[i] = now;
+        number_of_calls[i]++;
+      });
+    timers[i].is_cancelled = (i % 7 == 0);
+  }
+  EXPECT_EQ(timer_wheel.size(), timers.size());
+  for (auto & timer : timers) {
+    if (timer.is_cancelled) {
+      EXPECT_TRUE(timer_wheel.cancel(timer.timer_id));
+      EXPECT_FALSE(timer_wheel.cancel(timer.timer_id));
+    }
+  }
+  EXPECT_FALSE(timer_wheel.cancel(TimerWheel::invalid_timer_id));
+
+  std::vector<TimerWheel::callback_t> expired;
+  while (timer_wheel.size() > 0) {
+    auto next_deadline = timer_wheel.get_next_deadline();
+    ASSERT_GT(next_deadline, now);
+    now = next_deadline;
+    timer_wheel.advance(now, expired);
+    for (auto & callback : expired) {
+      callback();
+    }
+    expired.clear();
+  }
+
+  for (size_t i = 0; i < timers.size(); i++) {
+    if (timers[i].is_cancelled) {
+      EXPECT_EQ(number_of_calls[i], 0U);
+      continue;
+    }
+    ASSERT_EQ(number_of_calls[i], 1U);
+    // Waiting for the next deadline fires timer exactly at its deadline
+    EXPECT_EQ(fire_times[i], timers[i].deadline);
+    EXPECT_FALSE(timer_wheel.cancel(timers[i].timer_id));
+  }
+
+  // Timer which is already due fires on the next advance
+  size_t number_of_late_calls = 0;
+  timer_wheel.schedule(now - milliseconds(5), [&number_of_late_calls]() {number_of_late_calls++;});
+  EXPECT_EQ(timer_wheel.advance(now, expired), 1U);
+  expired.front()();
+  EXPECT_EQ(number_of_late_calls, 1U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, event_queue_pop_key_presses) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  KeyboardHandler::KeyEvent event{};
+  EXPECT_FALSE(keyboard_handler.try_pop_event(event));
+  EXPECT_FALSE(keyboard_handler.wait_pop_event(event, std::chrono::milliseconds(1)));
+
+  ASSERT_TRUE(keyboard_handler.enable_event_queue(4));
+  EXPECT_FALSE(keyboard_handler.enable_event_queue(4));
+  EXPECT_FALSE(keyboard_handler.wait_pop_event(event, std::chrono::milliseconds(10)));
+
+  auto before_read = std::chrono::steady_clock::now();
+  g_system_calls_stub->read_will_return_once("E");
+  ASSERT_TRUE(keyboard_handler.wait_pop_event(event, std::chrono::seconds(5)));
+  EXPECT_EQ(event.key_code, KeyCode::E);
+  EXPECT_EQ(event.key_modifiers, KeyModifiers::SHIFT);
+  EXPECT_GE(event.timestamp, before_read);
+  EXPECT_FALSE(keyboard_handler.try_pop_event(event));
+
+  // Overflow the queue and drain it into the buffer
+  g_system_calls_stub->read_will_repeatedly_return("q");
+  wait_until([&]() {return keyboard_handler.get_number_of_dropped_events() != 0;});
+  g_system_calls_stub->block_read();
+  EXPECT_GT(keyboard_handler.get_number_of_dropped_events(), 0U);
+  KeyboardHandler::KeyEvent events[8];
+  size_t number_of_events = keyboard_handler.pop_events(events, 8);
+  EXPECT_GE(number_of_events, 4U);
+  for (size_t i = 0; i < number_of_events; i++) {
+    EXPECT_EQ(events[i].key_code, KeyCode::Q);
+  }
+}
+
+TEST_F(KeyboardHandlerUnixTest, inject_key_presses_and_bytes) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  std::mutex pressed_keys_mutex;
+  std::vector<KeyCode> pressed_keys;
+  auto callback = [&pressed_keys_mutex, &pressed_keys](KeyCode key_code, KeyModifiers) {
+      std::lock_guard<std::mutex> lk(pressed_keys_mutex);
+      pressed_keys.push_back(key_code);
+    };
+  auto get_number_of_pressed_keys = [&pressed_keys_mutex, &pressed_keys]() {
+      std::lock_guard<std::mutex> lk(pressed_keys_mutex);
+      return pressed_keys.size();
+    };
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::A);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::B, KeyModifiers::CTRL);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::E, KeyModifiers::SHIFT);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::CURSOR_UP);
+
+  // Reader thread is blocked in read(), injected input shall be dispatched in order once it
+  // will be unblocked.
+  const std::string cursor_up_seq = keyboard_handler.get_terminal_sequence(KeyCode::CURSOR_UP);
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+  EXPECT_EQ(keyboard_handler.inject_bytes("E", 1), 1U);
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::B, KeyModifiers::CTRL));
+  EXPECT_EQ(
+    keyboard_handler.inject_bytes(cursor_up_seq.data(), cursor_up_seq.size()),
+    cursor_up_seq.size());
+  EXPECT_EQ(keyboard_handler.inject_bytes(nullptr, 1), 0U);
+  g_system_calls_stub->read_will_repeatedly_return("");
+
+  wait_until([&]() {return get_number_of_pressed_keys() >= 4;});
+  {
+    std::lock_guard<std::mutex> lk(pressed_keys_mutex);
+    EXPECT_THAT(
+      pressed_keys, testing::ElementsAre(KeyCode::A, KeyCode::E, KeyCode::B, KeyCode::CURSOR_UP));
+  }
+
+  constexpr size_t number_of_injected_keys = 1000;
+  for (size_t i = 0; i < number_of_injected_keys; i++) {
+    EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+  }
+  wait_until([&]() {return get_number_of_pressed_keys() >= number_of_injected_keys + 4;});
+  EXPECT_EQ(get_number_of_pressed_keys(), number_of_injected_keys + 4);
+}
+
+TEST_F(KeyboardHandlerUnixTest, macro_playback_and_cancellation) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  using Clock = std::chrono::steady_clock;
+  std::mutex pressed_keys_mutex;
+  std::vector<std::pair<KeyCode, Clock::time_point>> pressed_keys;
+  auto callback = [&pressed_keys_mutex, &pressed_keys](KeyCode key_code, KeyModifiers) {
+      std::lock_guard<std::mutex> lk(pressed_keys_mutex);
+      pressed_keys.emplace_back(key_code, Clock::now());
+    };
+  auto wait_for_pressed_keys = [&pressed_keys_mutex, &pressed_keys](size_t number_of_keys) {
+      return wait_until(
+        [&pressed_keys_mutex, &pressed_keys, number_of_keys]() {
+          std::lock_guard<std::mutex> lk(pressed_keys_mutex);
+          return pressed_keys.size() >= number_of_keys;
+        });
+    };
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::P);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::HOME, KeyModifiers::CTRL);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::CURSOR_UP);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::Q);
+
+  EXPECT_EQ(keyboard_handler.add_macro({}), KeyboardHandler::invalid_handle);
+  EXPECT_FALSE(keyboard_handler.play_macro(KeyboardHandler::invalid_handle));
+  EXPECT_EQ(
+    keyboard_handler.add_macro_binding(KeyboardHandler::invalid_handle, KeyCode::F1),
+    KeyboardHandler::invalid_handle);
+
+  auto macro_handle = keyboard_handler.add_macro(
+  {
+    {KeyCode::P, KeyModifiers::NONE},
+    {KeyCode::HOME, KeyModifiers::CTRL},
+    {KeyCode::CURSOR_UP, KeyModifiers::NONE, std::chrono::milliseconds(50)},
+  });
+  ASSERT_NE(macro_handle, KeyboardHandler::invalid_handle);
+  EXPECT_NE(
+    keyboard_handler.add_macro_binding(macro_handle, KeyCode::F1),
+    KeyboardHandler::invalid_handle);
+
+  g_system_calls_stub->read_will_repeatedly_return("");
+  auto trigger_time = Clock::now();
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::F1));
+  ASSERT_TRUE(wait_for_pressed_keys(3));
+  {
+    std::lock_guard<std::mutex> lk(pressed_keys_mutex);
+    ASSERT_EQ(pressed_keys.size(), 3U);
+    EXPECT_EQ(pressed_keys[0].first, KeyCode::P);
+    EXPECT_EQ(pressed_keys[1].first, KeyCode::HOME);
+    EXPECT_EQ(pressed_keys[2].first, KeyCode::CURSOR_UP);
+    EXPECT_GE(pressed_keys[2].second - trigger_time, std::chrono::milliseconds(50));
+    pressed_keys.clear();
+  }
+
+  auto long_macro_handle = keyboard_handler.add_macro(
+  {
+    {KeyCode::P, KeyModifiers::NONE},
+    {KeyCode::Q, KeyModifiers::NONE, std::chrono::seconds(10)},
+  });
+  ASSERT_TRUE(keyboard_handler.play_macro(long_macro_handle));
+  ASSERT_TRUE(wait_for_pressed_keys(1));
+  EXPECT_EQ(keyboard_handler.get_number_of_playing_macros(), 1U);
+  keyboard_handler.cancel_macro(long_macro_handle);
+  EXPECT_EQ(keyboard_handler.get_number_of_playing_macros(), 0U);
+
+  ASSERT_TRUE(keyboard_handler.play_macro(long_macro_handle));
+  keyboard_handler.delete_macro(long_macro_handle);
+  EXPECT_EQ(keyboard_handler.get_number_of_playing_macros(), 0U);
+  EXPECT_FALSE(keyboard_handler.play_macro(long_macro_handle));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  std::lock_guard<std::mutex> lk(pressed_keys_mutex);
+  for (const auto & pressed_key : pressed_keys) {
+    EXPECT_NE(pressed_key.first, KeyCode::Q);
+  }
+}
+
+TEST_F(KeyboardHandlerUnixTest, sharded_dispatch) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  EXPECT_TRUE(keyboard_handler.get_dispatch_shard_stats().empty());
+  EXPECT_FALSE(keyboard_handler.enable_sharded_dispatch(0));
+  ASSERT_TRUE(keyboard_handler.enable_sharded_dispatch(4, 8));
+  EXPECT_FALSE(keyboard_handler.enable_sharded_dispatch(4));
+  ASSERT_EQ(keyboard_handler.get_dispatch_shard_stats().size(), 4U);
+
+  // Find key which is dispatched by another shard than KeyCode::A
+  const size_t shard_a = keyboard_handler.get_dispatch_shard(KeyCode::A, KeyModifiers::NONE);
+  KeyCode other_key = KeyCode::B;
+  while (keyboard_handler.get_dispatch_shard(other_key, KeyModifiers::NONE) == shard_a) {
+    ++other_key;
+  }
+
+  // Callback for KeyCode::A blocks until callback for other key will be called. It's possible
+  // only if callbacks for different keys run in parallel.
+  std::promise<void> other_key_pressed;
+  auto other_key_future = other_key_pressed.get_future().share();
+  std::atomic<size_t> number_of_a_presses{0};
+  std::atomic_bool a_callback_running{false};
+  std::atomic_bool a_callbacks_overlapped{false};
+  std::atomic_bool other_key_waited{false};
+  keyboard_handler.add_key_press_callback(
+    [&](KeyCode, KeyModifiers) {
+      if (a_callback_running.exchange(true)) {
+        a_callbacks_overlapped = true;
+      }
+      if (number_of_a_presses.fetch_add(1) == 0) {
+        other_key_waited =
+        other_key_future.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+      }
+      a_callback_running = false;
+    }, KeyCode::A);
+  std::atomic_bool other_key_set{false};
+  keyboard_handler.add_key_press_callback(
+    [&](KeyCode, KeyModifiers) {
+      if (!other_key_set.exchange(true)) {
+        // Give reader thread time to overflow shard's queue for KeyCode::A
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        other_key_pressed.set_value();
+      }
+    }, other_key);
+
+  // Remaining key presses for KeyCode::A will overflow shard's queue and stall the reader
+  // thread until the first callback returns.
+  constexpr size_t number_of_a_keys = 100;
+  ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+  ASSERT_TRUE(keyboard_handler.inject_key(other_key));
+  for (size_t i = 1; i < number_of_a_keys; i++) {
+    ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+  }
+  g_system_calls_stub->read_will_repeatedly_return("");
+
+  wait_until([&]() {return number_of_a_presses.load() >= number_of_a_keys;});
+  EXPECT_EQ(number_of_a_presses.load(), number_of_a_keys);
+  EXPECT_TRUE(other_key_waited.load());
+  EXPECT_FALSE(a_callbacks_overlapped.load());
+
+  auto stats = keyboard_handler.get_dispatch_shard_stats();
+  EXPECT_EQ(stats[shard_a].number_of_dispatched_key_presses, number_of_a_keys);
+  EXPECT_GE(stats[shard_a].max_queue_depth, 8U);
+  EXPECT_GT(stats[shard_a].number_of_stalls, 0U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, slow_callback_watchdog) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  std::atomic<size_t> number_of_fast_callbacks{0};
+  std::promise<void> slow_callback_done;
+  auto slow_callback_done_future = slow_callback_done.get_future();
+  std::promise<KeyboardHandler::SlowCallbackInfo> report;
+  auto report_future = report.get_future();
+  std::atomic<size_t> number_of_reports{0};
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  keyboard_handler.set_slow_callback_handler(
+    [&report, &number_of_reports](const KeyboardHandler::SlowCallbackInfo & info) {
+      if (number_of_reports++ == 0) {
+        report.set_value(info);
+      }
+    });
+  auto fast_handle = keyboard_handler.add_key_press_callback(
+    [&number_of_fast_callbacks](KeyCode, KeyModifiers) {number_of_fast_callbacks++;},
+    KeyCode::A);
+  auto slow_handle = keyboard_handler.add_key_press_callback(
+    [&slow_callback_done](KeyCode, KeyModifiers) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      slow_callback_done.set_value();
+    }, KeyCode::B, KeyModifiers::CTRL);
+  EXPECT_FALSE(
+    keyboard_handler.set_callback_deadline(
+      KeyboardHandler::invalid_handle, std::chrono::milliseconds(1)));
+  keyboard_handler.set_default_callback_deadline(std::chrono::seconds(10));
+  EXPECT_TRUE(keyboard_handler.set_callback_deadline(slow_handle, std::chrono::milliseconds(20)));
+
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::B, KeyModifiers::CTRL));
+  g_system_calls_stub->read_will_repeatedly_return("");
+
+  // Overrun is reported while slow callback is still running
+  ASSERT_EQ(report_future.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+  EXPECT_NE(
+    slow_callback_done_future.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+  auto info = report_future.get();
+  EXPECT_EQ(info.handle, slow_handle);
+  EXPECT_EQ(info.key_code, KeyCode::B);
+  EXPECT_EQ(info.key_modifiers, KeyModifiers::CTRL);
+  EXPECT_EQ(info.deadline, std::chrono::milliseconds(20));
+  EXPECT_GT(info.elapsed, std::chrono::milliseconds(20));
+
+  ASSERT_EQ(slow_callback_done_future.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+  EXPECT_EQ(number_of_fast_callbacks.load(), 1U);
+  // Give watchdog a chance to report the same call twice
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(number_of_reports.load(), 1U);
+  EXPECT_EQ(keyboard_handler.get_number_of_slow_callbacks(), 1U);
+  EXPECT_EQ(keyboard_handler.get_number_of_slow_callbacks(slow_handle), 1U);
+  EXPECT_EQ(keyboard_handler.get_number_of_slow_callbacks(fast_handle), 0U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, binding_stats) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  std::atomic<size_t> number_of_calls{0};
+  auto busy_callback = [&number_of_calls](KeyCode, KeyModifiers) {
+      auto start = std::chrono::steady_clock::now();
+      while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(20)) {}
+      number_of_calls++;
+    };
+  auto sleeping_callback = [&number_of_calls](KeyCode, KeyModifiers) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      number_of_calls++;
+    };
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  auto sleeping_handle = keyboard_handler.add_key_press_callback(sleeping_callback, KeyCode::A);
+  EXPECT_TRUE(keyboard_handler.get_binding_stats().empty());
+  keyboard_handler.enable_binding_stats();
+  auto busy_handle =
+    keyboard_handler.add_key_press_callback(busy_callback, KeyCode::B, KeyModifiers::CTRL);
+  auto unused_handle = keyboard_handler.add_key_press_callback(sleeping_callback, KeyCode::C);
+
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::B, KeyModifiers::CTRL));
+  g_system_calls_stub->read_will_repeatedly_return("");
+  wait_until([&]() {return number_of_calls.load() >= 3;});
+
+  auto stats = keyboard_handler.get_binding_stats();
+  ASSERT_EQ(stats.size(), 3U);
+  EXPECT_EQ(stats[0].handle, busy_handle);
+  EXPECT_EQ(stats[0].key_code, KeyCode::B);
+  EXPECT_EQ(stats[0].key_modifiers, KeyModifiers::CTRL);
+  EXPECT_EQ(stats[0].number_of_calls, 1U);
+  EXPECT_GE(stats[0].total_wall_time, std::chrono::milliseconds(20));
+  EXPECT_GT(stats[0].total_cpu_time, std::chrono::milliseconds(10));
+  EXPECT_EQ(stats[0].max_cpu_time, stats[0].total_cpu_time);
+
+  EXPECT_EQ(stats[1].handle, sleeping_handle);
+  EXPECT_EQ(stats[1].number_of_calls, 2U);
+  EXPECT_GE(stats[1].total_wall_time, std::chrono::milliseconds(40));
+  EXPECT_GE(stats[1].max_wall_time, std::chrono::milliseconds(20));
+  EXPECT_LT(stats[1].max_wall_time, stats[1].total_wall_time);
+  EXPECT_LT(stats[1].total_cpu_time, std::chrono::milliseconds(10));
+
+  EXPECT_EQ(stats[2].handle, unused_handle);
+  EXPECT_EQ(stats[2].number_of_calls, 0U);
+  EXPECT_EQ(stats[2].total_wall_time, std::chrono::nanoseconds(0));
+}
+
+TEST_F(KeyboardHandlerUnixTest, busy_poll_reader) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  using BusyPollSettings = KeyboardHandlerUnixImpl::BusyPollSettings;
+  class BusyPollKeyboardHandler : public KeyboardHandlerUnixImpl
+  {
+public:
+    BusyPollKeyboardHandler(const readFunction & read_fn, const BusyPollSettings & settings)
+    : KeyboardHandlerUnixImpl(read_fn, isatty_mock, tcgetattr_mock, tcsetattr_capture_vtime,
+        false, tcgetpgrp, ReaderBackend::BUSY_POLL, settings) {}
+  };
+
+  std::atomic<size_t> number_of_reads{0};
+  std::atomic_bool has_input{false};
+  auto read_fn = [&number_of_reads, &has_input](int, void * buff, size_t n_bytes) -> ssize_t {
+      number_of_reads++;
+      if (has_input.exchange(false)) {
+        strncpy(static_cast<char *>(buff), "a", n_bytes);
+        return 1;
+      }
+      return 0;
+    };
+  auto count_reads_during = [&number_of_reads](std::chrono::milliseconds duration) {
+      size_t reads_before = number_of_reads.load();
+      std::this_thread::sleep_for(duration);
+      return number_of_reads.load() - reads_before;
+    };
+
+  {
+    BusyPollSettings settings;
+    settings.cpu = sched_getcpu();
+    BusyPollKeyboardHandler keyboard_handler(read_fn, settings);
+    EXPECT_EQ(
+      keyboard_handler.get_reader_backend(), KeyboardHandlerUnixImpl::ReaderBackend::BUSY_POLL);
+    // read() shall not wait for input
+    EXPECT_EQ(g_applied_vtime.load(), 0);
+    std::promise<void> key_pressed;
+    auto key_pressed_future = key_pressed.get_future();
+    keyboard_handler.add_key_press_callback(
+      [&key_pressed](KeyCode, KeyModifiers) {key_pressed.set_value();}, KeyCode::A);
+    has_input = true;
+    EXPECT_EQ(key_pressed_future.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    // Reader spins without sleeping between empty polls
+    EXPECT_GT(count_reads_during(std::chrono::milliseconds(50)), 1000U);
+  }
+
+  BusyPollSettings settings;
+  settings.polls_before_backoff = 10;
+  settings.max_backoff = std::chrono::milliseconds(10);
+  BusyPollKeyboardHandler keyboard_handler(read_fn, settings);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  // Reader sleeps up to 10 ms between empty polls after backoff started
+  EXPECT_LT(count_reads_during(std::chrono::milliseconds(100)), 100U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, poll_reader) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  using steady_clock = std::chrono::steady_clock;
+  class PollKeyboardHandler : public KeyboardHandlerUnixImpl
+  {
+public:
+    explicit PollKeyboardHandler(const readFunction & read_fn)
+    : KeyboardHandlerUnixImpl(read_fn, isatty_mock, tcgetattr_mock, tcsetattr_mock,
+        false, tcgetpgrp, ReaderBackend::POLL) {}
+  };
+  // Reader polls stdin, substitute it with the pipe to control when input is available
+  int input_pipe_fds[2] = {-1, -1};
+  ASSERT_EQ(pipe(input_pipe_fds), 0);
+  int saved_stdin_fd = dup(fileno(stdin));
+  ASSERT_NE(saved_stdin_fd, -1);
+  ASSERT_NE(dup2(input_pipe_fds[0], fileno(stdin)), -1);
+
+  std::atomic<size_t> number_of_presses{0};
+  std::atomic<size_t> number_of_hold_calls{0};
+  {
+    PollKeyboardHandler keyboard_handler(read);
+    EXPECT_EQ(keyboard_handler.get_reader_backend(), KeyboardHandlerUnixImpl::ReaderBackend::POLL);
+    keyboard_handler.add_key_press_callback(
+      [&number_of_presses](KeyCode, KeyModifiers) {number_of_presses++;}, KeyCode::A);
+
+    // Input from stdin
+    ASSERT_EQ(write(input_pipe_fds[1], "a", 1), 1);
+    wait_until([&]() {return number_of_presses.load() == 1;});
+    EXPECT_EQ(number_of_presses.load(), 1U);
+
+    // Injected keys wake up reader instead of waiting for 100 ms poll() timeout
+    constexpr size_t number_of_injected_keys = 20;
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < number_of_injected_keys; i++) {
+      ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+      wait_until([&]() {return number_of_presses.load() == i + 2;});
+    }
+    EXPECT_EQ(number_of_presses.load(), number_of_injected_keys + 1);
+    EXPECT_LT(steady_clock::now() - start, std::chrono::seconds(1));
+
+    // poll() timeout is shortened to the next timer deadline
+    KeyboardHandler::HoldSettings hold_settings;
+    hold_settings.hold_duration = std::chrono::milliseconds(10);
+    hold_settings.repeat_interval = std::chrono::milliseconds(10);
+    hold_settings.release_timeout = std::chrono::seconds(5);
+    keyboard_handler.add_key_hold_callback(
+      [&number_of_hold_calls](KeyCode, KeyModifiers) {number_of_hold_calls++;},
+      hold_settings, KeyCode::H);
+    start = steady_clock::now();
+    ASSERT_EQ(write(input_pipe_fds[1], "h", 1), 1);
+    wait_until([&]() {return number_of_hold_calls.load() >= 10;});
+    EXPECT_GE(number_of_hold_calls.load(), 10U);
+    EXPECT_LT(steady_clock::now() - start, std::chrono::seconds(1));
+  }
+
+  dup2(saved_stdin_fd, fileno(stdin));
+  close(saved_stdin_fd);
+  close(input_pipe_fds[0]);
+  close(input_pipe_fds[1]);
+}
+
+TEST_F(KeyboardHandlerUnixTest, kitty_keyboard_protocol) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  using KeyEventType = KeyboardHandler::KeyEventType;
+  std::mutex events_mutex;
+  std::vector<KeyEventType> a_events;
+  std::vector<std::pair<KeyCode, KeyModifiers>> pressed_keys;
+  auto get_number_of_events = [&events_mutex, &a_events, &pressed_keys]() {
+      std::lock_guard<std::mutex> lk(events_mutex);
+      return a_events.size() + pressed_keys.size();
+    };
+  auto press_callback = [&events_mutex, &pressed_keys](KeyCode key_code,
+      KeyModifiers key_modifiers) {
+      std::lock_guard<std::mutex> lk(events_mutex);
+      pressed_keys.emplace_back(key_code, key_modifiers);
+    };
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  EXPECT_FALSE(keyboard_handler.disable_kitty_keyboard_protocol());
+  EXPECT_FALSE(keyboard_handler.enable_kitty_keyboard_protocol(0));
+  EXPECT_TRUE(keyboard_handler.enable_kitty_keyboard_protocol());
+  EXPECT_EQ(keyboard_handler.get_written_to_terminal(), "\x1b[>3u\x1b[?u");
+  EXPECT_EQ(keyboard_handler.get_kitty_keyboard_flags(), -1);
+
+  keyboard_handler.add_key_event_callback(
+    [&events_mutex, &a_events](KeyCode, KeyModifiers, KeyEventType event_type) {
+      std::lock_guard<std::mutex> lk(events_mutex);
+      a_events.push_back(event_type);
+    }, KeyCode::A);
+  // Press callbacks receive press and repeat events only
+  keyboard_handler.add_key_press_callback(press_callback, KeyCode::A);
+  keyboard_handler.add_key_press_callback(press_callback, KeyCode::TAB);
+  keyboard_handler.add_key_press_callback(press_callback, KeyCode::I, KeyModifiers::CTRL);
+  keyboard_handler.add_key_press_callback(press_callback, KeyCode::ESCAPE);
+  keyboard_handler.add_key_press_callback(press_callback, KeyCode::B, KeyModifiers::SHIFT);
+  keyboard_handler.add_key_press_callback(
+    press_callback, KeyCode::CURSOR_UP, KeyModifiers::CTRL);
+  keyboard_handler.add_key_press_callback(press_callback, KeyCode::F5, KeyModifiers::ALT);
+
+  const std::vector<std::string> input = {
+    "\x1b[?3u",            // reply to the query
+    "\x1b[97u",            // a press
+    "\x1b[97;1:2u",        // a repeat
+    "\x1b[97;", "1:3u",    // a release split between reads
+    "\t",                  // tab
+    "\x1b[105;5u",         // ctrl + i
+    "\x1b[27u",            // escape
+    "\x1b[98;2u\x1b[1;5A",  // shift + b and ctrl + up in the single read
+    "\x1b[1;5:3A",         // ctrl + up release without event callback
+    "\x1b[15;3~",          // alt + f5
+  };
+  for (const auto & sequence : input) {
+    EXPECT_EQ(keyboard_handler.inject_bytes(sequence.data(), sequence.size()), sequence.size());
+  }
+  g_system_calls_stub->read_will_repeatedly_return("");
+
+  wait_until([&]() {return get_number_of_events() >= 11;});
+  {
+    std::lock_guard<std::mutex> lk(events_mutex);
+    EXPECT_THAT(
+      a_events,
+      testing::ElementsAre(KeyEventType::PRESS, KeyEventType::REPEAT, KeyEventType::RELEASE));
+    EXPECT_THAT(
+      pressed_keys, testing::ElementsAre(
+        std::make_pair(KeyCode::A, KeyModifiers::NONE),
+        std::make_pair(KeyCode::A, KeyModifiers::NONE),
+        std::make_pair(KeyCode::TAB, KeyModifiers::NONE),
+        std::make_pair(KeyCode::I, KeyModifiers::CTRL),
+        std::make_pair(KeyCode::ESCAPE, KeyModifiers::NONE),
+        std::make_pair(KeyCode::B, KeyModifiers::SHIFT),
+        std::make_pair(KeyCode::CURSOR_UP, KeyModifiers::CTRL),
+        std::make_pair(KeyCode::F5, KeyModifiers::ALT)));
+  }
+  EXPECT_EQ(keyboard_handler.get_kitty_keyboard_flags(), 3);
+
+  EXPECT_TRUE(keyboard_handler.disable_kitty_keyboard_protocol());
+  EXPECT_EQ(keyboard_handler.get_written_to_terminal(), "\x1b[>3u\x1b[?u\x1b[<u");
+  EXPECT_EQ(keyboard_handler.get_kitty_keyboard_flags(), -1);
+}
+
+TEST_F(KeyboardHandlerUnixTest, simulated_clock) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  using std::chrono::milliseconds;
+  class SimulatedClockKeyboardHandler : public KeyboardHandlerUnixImpl
+  {
+public:
+    SimulatedClockKeyboardHandler(const readFunction & read_fn, std::shared_ptr<Clock> clock)
+    : KeyboardHandlerUnixImpl(read_fn, isatty_mock, tcgetattr_mock, tcsetattr_mock,
+        false, tcgetpgrp, ReaderBackend::BLOCKING_READ, BusyPollSettings(), std::move(clock)) {}
+  };
+
+  auto clock = std::make_shared<SimulatedClock>();
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+  EXPECT_THROW(clock->advance(milliseconds(-1)), std::invalid_argument);
+  EXPECT_THROW(clock->set_time(clock->now() - milliseconds(1)), std::invalid_argument);
+#endif
+  // Read times out without input as with VTIME
+  auto read_fn = [](int, void *, size_t) -> ssize_t {
+      std::this_thread::sleep_for(milliseconds(1));
+      return 0;
+    };
+  std::mutex pressed_keys_mutex;
+  std::condition_variable pressed_keys_cv;
+  std::vector<KeyCode> pressed_keys;
+  auto callback = [&](KeyCode key_code, KeyModifiers) {
+      std::lock_guard<std::mutex> lk(pressed_keys_mutex);
+      pressed_keys.push_back(key_code);
+      pressed_keys_cv.notify_all();
+    };
+  auto wait_for_pressed_keys = [&](size_t number_of_keys) {
+      std::unique_lock<std::mutex> lk(pressed_keys_mutex);
+      pressed_keys_cv.wait_for(
+        lk, std::chrono::seconds(5), [&]() {return pressed_keys.size() >= number_of_keys;});
+      return pressed_keys.size();
+    };
+
+  SimulatedClockKeyboardHandler keyboard_handler(read_fn, clock);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::P);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::Q);
+
+  // Macro step is played when simulated time reaches its offset regardless of the real time
+  auto macro_handle = keyboard_handler.add_macro(
+  {
+    {KeyCode::P, KeyModifiers::NONE},
+    {KeyCode::Q, KeyModifiers::NONE, std::chrono::seconds(10)},
+  });
+  ASSERT_TRUE(keyboard_handler.play_macro(macro_handle));
+  ASSERT_EQ(wait_for_pressed_keys(1), 1U);
+  clock->advance(milliseconds(9999));
+  std::this_thread::sleep_for(milliseconds(20));
+  EXPECT_EQ(wait_for_pressed_keys(0), 1U);
+  EXPECT_EQ(keyboard_handler.get_number_of_playing_macros(), 1U);
+  clock->advance(milliseconds(1));
+  ASSERT_EQ(wait_for_pressed_keys(2), 2U);
+  EXPECT_EQ(pressed_keys[1], KeyCode::Q);
+  EXPECT_EQ(keyboard_handler.get_number_of_playing_macros(), 0U);
+
+  // Hold calls follow simulated time
+  KeyboardHandler::HoldSettings hold_settings;
+  hold_settings.hold_duration = milliseconds(100);
+  hold_settings.repeat_interval = milliseconds(50);
+  hold_settings.release_timeout = std::chrono::seconds(1);
+  keyboard_handler.add_key_hold_callback(callback, hold_settings, KeyCode::H);
+  ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::H));
+  // Injected key press is dispatched from the reader thread at the current simulated time
+  std::this_thread::sleep_for(milliseconds(20));
+  clock->advance(milliseconds(99));
+  std::this_thread::sleep_for(milliseconds(20));
+  EXPECT_EQ(wait_for_pressed_keys(0), 2U);
+  clock->advance(milliseconds(1));
+  ASSERT_EQ(wait_for_pressed_keys(3), 3U);
+  clock->advance(milliseconds(50));
+  ASSERT_EQ(wait_for_pressed_keys(4), 4U);
+  EXPECT_EQ(pressed_keys[3], KeyCode::H);
+
+  // Event timestamps are taken from the clock
+  ASSERT_TRUE(keyboard_handler.enable_event_queue(4));
+  clock->set_time(clock->now() + std::chrono::hours(1));
+  ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::E));
+  KeyboardHandler::KeyEvent event{};
+  ASSERT_TRUE(keyboard_handler.wait_pop_event(event, std::chrono::seconds(5)));
+  EXPECT_EQ(event.key_code, KeyCode::E);
+  EXPECT_EQ(event.timestamp, clock->now());
+}
+
+TEST_F(KeyboardHandlerUnixTest, callback_priority_and_consumption) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  std::mutex calls_mutex;
+  std::condition_variable calls_cv;
+  std::vector<std::string> calls;
+  auto make_callback = [&calls_mutex, &calls_cv, &calls](const std::string & name) {
+      return [&calls_mutex, &calls_cv, &calls, name](KeyCode, KeyModifiers) {
+               std::lock_guard<std::mutex> lk(calls_mutex);
+               calls.push_back(name);
+               calls_cv.notify_all();
+             };
+    };
+  std::atomic_bool is_dialog_open{true};
+  auto dialog_callback = [&calls_mutex, &calls, &is_dialog_open](KeyCode, KeyModifiers) {
+      std::lock_guard<std::mutex> lk(calls_mutex);
+      calls.push_back("dialog");
+      return is_dialog_open.load();
+    };
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  // Injected key presses are dispatched in order, calls for R are done once S is dispatched
+  keyboard_handler.add_key_press_callback(make_callback("sentinel"), KeyCode::S);
+  auto press_r = [&]() {
+      EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::R));
+      EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::S));
+      std::unique_lock<std::mutex> lk(calls_mutex);
+      calls_cv.wait_for(
+        lk, std::chrono::seconds(5), [&calls]() {
+          return !calls.empty() && calls.back() == "sentinel";
+        });
+      std::vector<std::string> taken_calls;
+      taken_calls.swap(calls);
+      if (!taken_calls.empty()) {
+        taken_calls.pop_back();
+      }
+      return taken_calls;
+    };
+  g_system_calls_stub->read_will_repeatedly_return("");
+
+  EXPECT_EQ(
+    keyboard_handler.add_consuming_key_press_callback(nullptr, KeyCode::R),
+    KeyboardHandler::invalid_handle);
+  EXPECT_FALSE(keyboard_handler.set_callback_priority(KeyboardHandler::invalid_handle, 1));
+  auto first_handle = keyboard_handler.add_key_press_callback(make_callback("first"), KeyCode::R);
+  auto dialog_handle =
+    keyboard_handler.add_consuming_key_press_callback(dialog_callback, KeyCode::R);
+  auto second_handle = keyboard_handler.add_key_press_callback(make_callback("second"), KeyCode::R);
+  ASSERT_NE(dialog_handle, KeyboardHandler::invalid_handle);
+  EXPECT_EQ(keyboard_handler.get_number_of_registered_callbacks(), 4U);
+
+  // Same priority in order of registration, consumed key press skips the rest
+  EXPECT_THAT(press_r(), ::testing::ElementsAre("first", "dialog"));
+
+  EXPECT_TRUE(keyboard_handler.set_callback_priority(dialog_handle, 10));
+  EXPECT_TRUE(keyboard_handler.set_callback_priority(second_handle, 5));
+  EXPECT_THAT(press_r(), ::testing::ElementsAre("dialog"));
+
+  is_dialog_open = false;
+  EXPECT_THAT(press_r(), ::testing::ElementsAre("dialog", "second", "first"));
+
+  keyboard_handler.delete_key_press_callback(dialog_handle);
+  EXPECT_FALSE(keyboard_handler.set_callback_priority(dialog_handle, 1));
+  EXPECT_TRUE(keyboard_handler.set_callback_priority(first_handle, -1));
+  EXPECT_THAT(press_r(), ::testing::ElementsAre("second", "first"));
+  EXPECT_EQ(keyboard_handler.get_number_of_registered_callbacks(), 3U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, static_bindings) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  std::mutex calls_mutex;
+  std::condition_variable calls_cv;
+  std::vector<std::string> calls;
+  auto record = [&calls_mutex, &calls_cv, &calls](const std::string & name) {
+      std::lock_guard<std::mutex> lk(calls_mutex);
+      calls.push_back(name);
+      calls_cv.notify_all();
+    };
+  auto make_handler = [&record](const std::string & name) {
+      return [&record, name](KeyCode, KeyModifiers) {record(name);};
+    };
+
+  MockKeyboardHandler * handler_ptr = nullptr;
+  auto static_bindings = make_static_bindings(
+    make_static_binding<KeyCode::Q>(make_handler("quit")),
+    make_static_binding<KeyCode::P, KeyModifiers::CTRL>(make_handler("pause")),
+    make_static_binding<KeyCode::F5>(make_handler("refresh")),
+    // Table is called without callbacks mutex and could add callbacks
+    make_static_binding<KeyCode::R>(
+      [&handler_ptr, &record, &make_handler](KeyCode, KeyModifiers) {
+        handler_ptr->add_key_press_callback(make_handler("added"), KeyCode::R);
+        record("register");
+      }));
+  static_assert(decltype(static_bindings)::size == 4, "All bindings shall be in the table");
+  EXPECT_TRUE(static_bindings(KeyCode::P, KeyModifiers::CTRL));
+  EXPECT_FALSE(static_bindings(KeyCode::P, KeyModifiers::NONE));
+  EXPECT_FALSE(make_static_bindings()(KeyCode::Q, KeyModifiers::NONE));
+  {
+    std::lock_guard<std::mutex> lk(calls_mutex);
+    EXPECT_THAT(calls, ::testing::ElementsAre("pause"));
+    calls.clear();
+  }
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  handler_ptr = &keyboard_handler;
+  ASSERT_TRUE(keyboard_handler.set_static_bindings(std::move(static_bindings)));
+  // Dynamic callbacks coexist with the static table
+  keyboard_handler.add_key_press_callback(make_handler("dynamic"), KeyCode::Q);
+  keyboard_handler.add_key_press_callback(make_handler("sentinel"), KeyCode::S);
+  auto press = [&](KeyCode key_code, KeyModifiers key_modifiers) {
+      EXPECT_TRUE(keyboard_handler.inject_key(key_code, key_modifiers));
+      EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::S));
+      std::unique_lock<std::mutex> lk(calls_mutex);
+      calls_cv.wait_for(
+        lk, std::chrono::seconds(5), [&calls]() {
+          return !calls.empty() && calls.back() == "sentinel";
+        });
+      std::vector<std::string> taken_calls;
+      taken_calls.swap(calls);
+      if (!taken_calls.empty()) {
+        taken_calls.pop_back();
+      }
+      return taken_calls;
+    };
+  g_system_calls_stub->read_will_repeatedly_return("");
+
+  EXPECT_THAT(press(KeyCode::Q, KeyModifiers::NONE), ::testing::ElementsAre("quit", "dynamic"));
+  EXPECT_THAT(press(KeyCode::P, KeyModifiers::CTRL), ::testing::ElementsAre("pause"));
+  EXPECT_THAT(press(KeyCode::F5, KeyModifiers::SHIFT), ::testing::ElementsAre());
+  // Table runs first, so callback added by it is called for the same key press
+  EXPECT_THAT(
+    press(KeyCode::R, KeyModifiers::NONE), ::testing::ElementsAre("register", "added"));
+  keyboard_handler.clear_static_bindings();
+  EXPECT_THAT(press(KeyCode::Q, KeyModifiers::NONE), ::testing::ElementsAre("dynamic"));
+}
+
+TEST_F(KeyboardHandlerUnixTest, key_chord_parsing) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  constexpr KeyChord ctrl_shift_f5 = "ctrl+shift+f5"_chord;
+  static_assert(ctrl_shift_f5.key_code == KeyCode::F5, "Key shall be parsed at compile time");
+  static_assert(
+    ctrl_shift_f5.key_modifiers == static_cast<KeyModifiers>(
+      static_cast<uint32_t>(KeyModifiers::CTRL) | static_cast<uint32_t>(KeyModifiers::SHIFT)),
+    "Modifiers shall be parsed at compile time");
+  static_assert(
+    "ALT+X"_chord == KeyChord(KeyCode::X, KeyModifiers::ALT), "Names are case insensitive");
+  static_assert(
+    "ctrl++"_chord == KeyChord(KeyCode::PLUS, KeyModifiers::CTRL), "'+' could be the key");
+  EXPECT_EQ(KEYBOARD_HANDLER_KEY_CHORD("up"), KeyChord(KeyCode::CURSOR_UP, KeyModifiers::NONE));
+
+  // Every key code is reachable by name and every name maps back to its key code
+  for (KeyCode key_code = KeyCode::EXCLAMATION_MARK; key_code != KeyCode::END_OF_KEY_CODE_ENUM;
+    ++key_code)
+  {
+    EXPECT_TRUE(
+      std::any_of(
+        std::begin(KEY_CHORD_NAMES), std::end(KEY_CHORD_NAMES),
+        [key_code](const KeyChordName & name) {return name.key_code == key_code;})) <<
+      enum_key_code_to_str(key_code);
+  }
+  for (const auto & name : KEY_CHORD_NAMES) {
+    EXPECT_EQ(parse_key_chord(name.name).key_code, name.key_code) << name.name;
+    EXPECT_EQ(parse_key_chord(std::string("Shift+") + name.name).key_code, name.key_code);
+  }
+
+  for (const std::string & invalid_spec :
+    {"", "ctrl+", "ctl+x", "ctrl+ctrl+x", "ctrl+foo", "x+ctrl", "++", "ctrl+shift+f13"})
+  {
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+    EXPECT_THROW(parse_key_chord(invalid_spec), std::invalid_argument) << invalid_spec;
+#endif
+    KeyChord key_chord("q"_chord);
+    EXPECT_FALSE(try_parse_key_chord(invalid_spec, key_chord)) << invalid_spec;
+    EXPECT_EQ(key_chord, "q"_chord);
+  }
+
+  // Bulk parsing of the configuration
+  const std::vector<std::string> specs{
+    "ctrl+shift+f5", "alt+x", "Control+Alt+Delete", "shift+tab", "pageup", "ctrl+["};
+  const std::vector<KeyChord> expected{
+    ctrl_shift_f5, "alt+x"_chord,
+    KeyChord(KeyCode::DELETE_KEY, KeyModifiers::CTRL | KeyModifiers::ALT),
+    KeyChord(KeyCode::TAB, KeyModifiers::SHIFT), KeyChord(KeyCode::PG_UP, KeyModifiers::NONE),
+    KeyChord(KeyCode::LEFT_SQUARE_BRACKET, KeyModifiers::CTRL)};
+  for (size_t i = 0; i < 10000; i++) {
+    KeyChord key_chord;
+    ASSERT_TRUE(try_parse_key_chord(specs[i % specs.size()], key_chord));
+    ASSERT_EQ(key_chord, expected[i % specs.size()]);
+  }
+}
+
+TEST_F(KeyboardHandlerUnixTest, errors_reported_without_exceptions) {
+  class ErrorCodeKeyboardHandler : public KeyboardHandlerUnixImpl
+  {
+public:
+    ErrorCodeKeyboardHandler(
+      std::error_code & error, const readFunction & read_fn,
+      const tcgetattrFunction & tcgetattr_fn)
+    : KeyboardHandlerUnixImpl(error, read_fn, isatty_mock, tcgetattr_fn, tcsetattr_mock, false) {}
+  };
+  auto capture_sink = std::make_shared<CaptureLogSink>();
+  auto old_log_sink = KeyboardHandler::get_log_sink();
+  KeyboardHandler::set_log_sink(capture_sink);
+  auto has_message = [&capture_sink](const std::string & text) {
+      auto messages = capture_sink->get_messages();
+      return std::any_of(
+        messages.begin(), messages.end(),
+        [&text](const std::pair<LogSeverity, std::string> & message) {
+          return message.first == LogSeverity::ERR && message.second == text;
+        });
+    };
+
+  std::error_code error;
+  {
+    ErrorCodeKeyboardHandler keyboard_handler(error, nullptr, tcgetattr_mock);
+    EXPECT_EQ(error, std::errc::invalid_argument);
+    EXPECT_TRUE(has_message("KeyboardHandlerUnixImpl read_fn must be non-empty."));
+  }
+  auto tcgetattr_fail = [](int, struct termios *) -> int {
+      errno = ENOTTY;
+      return -1;
+    };
+  {
+    ErrorCodeKeyboardHandler keyboard_handler(error, read_fn_, tcgetattr_fail);
+    EXPECT_EQ(error, std::error_code(ENOTTY, std::system_category()));
+    EXPECT_EQ(
+      keyboard_handler.add_key_press_callback(
+        [](KeyboardHandler::KeyCode, KeyboardHandler::KeyModifiers) {},
+        KeyboardHandler::KeyCode::E),
+      KeyboardHandler::invalid_handle);
+  }
+#if KEYBOARD_HANDLER_HAS_EXCEPTIONS
+  EXPECT_NO_THROW(ErrorCodeKeyboardHandler(error, read_fn_, nullptr));
+  EXPECT_EQ(error, std::errc::invalid_argument);
+  EXPECT_THROW(MockKeyboardHandler{nullptr}, std::invalid_argument);
+#endif
+
+  // Reader thread stops on error and reports it without throwing
+  auto read_fail = [](int, void *, size_t) -> ssize_t {
+      errno = EBADF;
+      return -1;
+    };
+  {
+    ErrorCodeKeyboardHandler keyboard_handler(error, read_fail, tcgetattr_mock);
+    ASSERT_FALSE(error);
+    wait_until([&]() {return static_cast<bool>(keyboard_handler.get_reader_error());});
+    EXPECT_EQ(keyboard_handler.get_reader_error(), std::error_code(EBADF, std::system_category()));
+  }
+  EXPECT_TRUE(has_message("Error in read(). errno = " + std::to_string(EBADF)));
+  KeyboardHandler::set_log_sink(old_log_sink);
+}
+
+TEST_F(KeyboardHandlerUnixTest, input_flood_protection) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  using FloodMode = KeyboardHandler::FloodMode;
+  std::mutex calls_mutex;
+  std::condition_variable calls_cv;
+  std::vector<std::string> calls;
+  auto make_callback = [&calls_mutex, &calls_cv, &calls](const std::string & name) {
+      return [&calls_mutex, &calls_cv, &calls, name](KeyCode, KeyModifiers) {
+               std::lock_guard<std::mutex> lk(calls_mutex);
+               calls.push_back(name);
+               calls_cv.notify_all();
+             };
+    };
+  auto wait_for_sentinel = [&calls_mutex, &calls_cv, &calls]() {
+      std::unique_lock<std::mutex> lk(calls_mutex);
+      calls_cv.wait_for(
+        lk, std::chrono::seconds(5), [&calls]() {
+          return !calls.empty() && calls.back() == "sentinel";
+        });
+      std::vector<std::string> taken_calls;
+      taken_calls.swap(calls);
+      if (!taken_calls.empty()) {
+        taken_calls.pop_back();
+      }
+      return taken_calls;
+    };
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  keyboard_handler.add_key_press_callback(make_callback("sentinel"), KeyCode::S);
+  keyboard_handler.add_key_press_callback(make_callback("a"), KeyCode::A);
+  keyboard_handler.add_key_press_callback(make_callback("b"), KeyCode::B);
+  // Holds the reader thread until the rest of the input is queued
+  std::atomic_bool is_input_queued{false};
+  keyboard_handler.add_key_press_callback(
+    [&is_input_queued](KeyCode, KeyModifiers) {
+      wait_until([&]() {return is_input_queued.load();});
+    }, KeyCode::Q);
+  g_system_calls_stub->read_will_repeatedly_return("");
+
+  KeyboardHandler::FloodProtectionSettings settings;
+  EXPECT_EQ(settings.flood_threshold, 0U);
+  EXPECT_EQ(settings.flood_mode, FloodMode::OFF);
+  settings.flood_threshold = 1;
+  settings.flood_window = std::chrono::milliseconds(0);
+  EXPECT_FALSE(keyboard_handler.set_flood_protection(settings));
+
+  // Budget delays the rest of the input to the next iterations without losing or reordering it
+  settings = KeyboardHandler::FloodProtectionSettings();
+  settings.max_events_per_iteration = 4;
+  EXPECT_TRUE(keyboard_handler.set_flood_protection(settings));
+  EXPECT_EQ(keyboard_handler.get_flood_protection().max_events_per_iteration, 4U);
+  std::vector<std::string> expected_calls;
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::Q));
+  for (size_t i = 0; i < 50; i++) {
+    EXPECT_TRUE(keyboard_handler.inject_key(i % 2 ? KeyCode::A : KeyCode::B));
+    expected_calls.push_back(i % 2 ? "a" : "b");
+  }
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::S));
+  is_input_queued = true;
+  EXPECT_EQ(wait_for_sentinel(), expected_calls);
+  EXPECT_GT(keyboard_handler.get_flood_stats().number_of_budget_yields, 0U);
+
+  // Events above the threshold within the window are dropped, injected keys bypass detector
+  settings.flood_threshold = 10;
+  settings.flood_window = std::chrono::seconds(10);
+  settings.flood_mode = FloodMode::DROP;
+  EXPECT_TRUE(keyboard_handler.set_flood_protection(settings));
+  for (size_t i = 0; i < 50; i++) {
+    EXPECT_EQ(keyboard_handler.inject_bytes("a", 1), 1U);
+  }
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::S));
+  EXPECT_EQ(wait_for_sentinel(), std::vector<std::string>(10, "a"));
+  auto stats = keyboard_handler.get_flood_stats();
+  EXPECT_EQ(stats.number_of_floods, 1U);
+  EXPECT_EQ(stats.number_of_dropped_events, 40U);
+  EXPECT_TRUE(stats.is_flooding);
+
+  // Repeats of the same key are coalesced, other keys pass through
+  settings.flood_threshold = 5;
+  settings.flood_mode = FloodMode::COALESCE;
+  EXPECT_TRUE(keyboard_handler.set_flood_protection(settings));
+  std::string input = std::string(20, 'a') + std::string(20, 'b') + "a";
+  for (char c : input) {
+    EXPECT_EQ(keyboard_handler.inject_bytes(&c, 1), 1U);
+  }
+  EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::S));
+  EXPECT_THAT(wait_for_sentinel(), ::testing::ElementsAre("a", "a", "a", "a", "a", "b", "a"));
+  stats = keyboard_handler.get_flood_stats();
+  EXPECT_EQ(stats.number_of_floods, 2U);
+  EXPECT_EQ(stats.number_of_coalesced_events, 34U);
+  EXPECT_EQ(stats.number_of_dropped_events, 40U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, terminal_capability_probe) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  using TerminalProbeState = KeyboardHandler::TerminalProbeState;
+  using TerminalCapabilities = KeyboardHandler::TerminalCapabilities;
+  std::mutex events_mutex;
+  std::condition_variable events_cv;
+  std::vector<KeyCode> pressed_keys;
+  std::vector<TerminalCapabilities> probe_results;
+  auto press_callback = [&events_mutex, &pressed_keys](KeyCode key_code, KeyModifiers) {
+      std::lock_guard<std::mutex> lk(events_mutex);
+      pressed_keys.push_back(key_code);
+    };
+  auto wait_for_written = [](MockKeyboardHandler & handler, const std::string & expected) {
+      wait_until([&]() {return handler.get_written_to_terminal() == expected;});
+      return handler.get_written_to_terminal();
+    };
+  const std::string queries = "\x1b[?u\x1b[>0q\x1b[c";
+
+  KeyboardHandler::TerminalProbeSettings settings;
+  settings.kitty_keyboard_flags = KeyboardHandler::KITTY_DISAMBIGUATE_ESCAPE_CODES;
+  settings.callback = [&events_mutex, &events_cv, &probe_results](
+    const TerminalCapabilities & capabilities) {
+      std::lock_guard<std::mutex> lk(events_mutex);
+      probe_results.push_back(capabilities);
+      events_cv.notify_all();
+    };
+  auto wait_for_probe_result = [&events_mutex, &events_cv, &probe_results]() {
+      std::unique_lock<std::mutex> lk(events_mutex);
+      events_cv.wait_for(
+        lk, std::chrono::seconds(5), [&probe_results]() {return !probe_results.empty();});
+      TerminalCapabilities capabilities;
+      if (!probe_results.empty()) {
+        capabilities = probe_results.back();
+        probe_results.clear();
+      }
+      return capabilities;
+    };
+
+  {
+    MockKeyboardHandler keyboard_handler(read_fn_);
+    keyboard_handler.add_key_press_callback(press_callback, KeyCode::A);
+    keyboard_handler.add_key_press_callback(press_callback, KeyCode::B);
+    keyboard_handler.add_key_press_callback(press_callback, KeyCode::CURSOR_UP);
+    keyboard_handler.add_key_press_callback(press_callback, KeyCode::P, KeyModifiers::ALT);
+    keyboard_handler.add_key_press_callback(press_callback, KeyCode::I, KeyModifiers::CTRL);
+    g_system_calls_stub->read_will_repeatedly_return("");
+    EXPECT_EQ(
+      keyboard_handler.get_terminal_capabilities().state, TerminalProbeState::NOT_STARTED);
+
+    auto invalid_settings = settings;
+    invalid_settings.timeout = std::chrono::milliseconds(0);
+    EXPECT_FALSE(keyboard_handler.probe_terminal_capabilities(invalid_settings));
+    ASSERT_TRUE(keyboard_handler.probe_terminal_capabilities(settings));
+    EXPECT_FALSE(keyboard_handler.probe_terminal_capabilities(settings));
+    EXPECT_EQ(keyboard_handler.get_terminal_capabilities().state, TerminalProbeState::PENDING);
+    ASSERT_EQ(wait_for_written(keyboard_handler, queries), queries);
+
+    // Replies interleaved with the key presses typed meanwhile
+    const std::vector<std::string> input = {
+      "a",
+      "\t",                     // CTRL + I in legacy encoding
+      "\x1b[?0u",               // kitty keyboard protocol flags
+      "\x1b[A",                 // cursor up
+      "\x1bP>|kitty(", "0.26)",  // XTVERSION reply split between reads
+      "\x1b\\b",
+      "\x1bp",                  // alt + p
+      "\x1b[?62;4;22c",         // primary device attributes
+    };
+    for (const auto & sequence : input) {
+      EXPECT_EQ(keyboard_handler.inject_bytes(sequence.data(), sequence.size()), sequence.size());
+    }
+
+    auto capabilities = wait_for_probe_result();
+    EXPECT_EQ(capabilities.state, TerminalProbeState::COMPLETED);
+    EXPECT_TRUE(capabilities.supports_kitty_keyboard_protocol);
+    EXPECT_EQ(capabilities.kitty_keyboard_flags, 0);
+    EXPECT_EQ(capabilities.terminal_version, "kitty(0.26)");
+    EXPECT_THAT(capabilities.device_attributes, testing::ElementsAre(62U, 4U, 22U));
+    EXPECT_EQ(keyboard_handler.get_terminal_capabilities().state, TerminalProbeState::COMPLETED);
+    {
+      std::lock_guard<std::mutex> lk(events_mutex);
+      EXPECT_THAT(
+        pressed_keys,
+        testing::ElementsAre(
+          KeyCode::A, KeyCode::I, KeyCode::CURSOR_UP, KeyCode::B, KeyCode::P));
+      pressed_keys.clear();
+    }
+    // Decoder is upgraded to the requested flags
+    EXPECT_EQ(keyboard_handler.get_written_to_terminal(), queries + "\x1b[>1u\x1b[?u");
+    EXPECT_TRUE(keyboard_handler.disable_kitty_keyboard_protocol());
+  }
+
+  {
+    // Terminal without replies
+    MockKeyboardHandler keyboard_handler(read_fn_);
+    keyboard_handler.add_key_press_callback(press_callback, KeyCode::A);
+    g_system_calls_stub->read_will_repeatedly_return("");
+    settings.timeout = std::chrono::milliseconds(50);
+    ASSERT_TRUE(keyboard_handler.probe_terminal_capabilities(settings));
+    ASSERT_EQ(wait_for_written(keyboard_handler, queries), queries);
+    EXPECT_EQ(keyboard_handler.inject_bytes("a", 1), 1U);
+
+    auto capabilities = wait_for_probe_result();
+    EXPECT_EQ(capabilities.state, TerminalProbeState::TIMED_OUT);
+    EXPECT_FALSE(capabilities.supports_kitty_keyboard_protocol);
+    EXPECT_EQ(capabilities.kitty_keyboard_flags, -1);
+    EXPECT_TRUE(capabilities.device_attributes.empty());
+    EXPECT_EQ(keyboard_handler.get_written_to_terminal(), queries);
+    EXPECT_EQ(keyboard_handler.get_kitty_keyboard_flags(), -1);
+    std::lock_guard<std::mutex> lk(events_mutex);
+    EXPECT_THAT(pressed_keys, testing::ElementsAre(KeyCode::A));
+  }
+}
+
+TEST_F(KeyboardHandlerUnixTest, injection_flood_does_not_starve_stdin) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  std::mutex calls_mutex;
+  std::condition_variable calls_cv;
+  std::vector<KeyCode> calls;
+  std::atomic_bool is_stdin_key_sent{false};
+  auto callback = [&](KeyCode key_code, KeyModifiers) {
+      if (key_code == KeyCode::A && !is_stdin_key_sent.exchange(true)) {
+        // Key arrives on stdin while injected key presses are still queued
+        g_system_calls_stub->read_will_return_once("b");
+      }
+      std::lock_guard<std::mutex> lk(calls_mutex);
+      calls.push_back(key_code);
+      calls_cv.notify_all();
+    };
+
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::A);
+  keyboard_handler.add_key_press_callback(callback, KeyCode::B);
+  KeyboardHandler::FloodProtectionSettings settings;
+  settings.max_events_per_iteration = 1;
+  ASSERT_TRUE(keyboard_handler.set_flood_protection(settings));
+  constexpr size_t number_of_injected_keys = 500;
+  for (size_t i = 0; i < number_of_injected_keys; i++) {
+    EXPECT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+  }
+  g_system_calls_stub->read_will_repeatedly_return("");
+
+  std::unique_lock<std::mutex> lk(calls_mutex);
+  calls_cv.wait_for(
+    lk, std::chrono::seconds(5), [&calls]() {
+      return std::find(calls.begin(), calls.end(), KeyCode::B) != calls.end();
+    });
+  auto b_it = std::find(calls.begin(), calls.end(), KeyCode::B);
+  ASSERT_NE(b_it, calls.end());
+  // Dispatched within a few iterations instead of after all injected key presses
+  EXPECT_LT(static_cast<size_t>(b_it - calls.begin()), 10U);
+  EXPECT_GT(keyboard_handler.get_flood_stats().number_of_budget_yields, 0U);
+}
+
+TEST_F(KeyboardHandlerUnixTest, delete_callback_during_sharded_dispatch) {
+  using KeyCode = KeyboardHandler::KeyCode;
+  using KeyModifiers = KeyboardHandler::KeyModifiers;
+  MockKeyboardHandler keyboard_handler(read_fn_);
+  ASSERT_TRUE(keyboard_handler.enable_sharded_dispatch(2));
+  g_system_calls_stub->read_will_repeatedly_return("");
+
+  std::atomic_bool is_callback_started{false};
+  std::atomic_bool is_callback_finished{false};
+  std::atomic<size_t> number_of_calls{0};
+  auto slow_handle = keyboard_handler.add_key_press_callback(
+    [&](KeyCode, KeyModifiers) {
+      number_of_calls++;
+      is_callback_started = true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      is_callback_finished = true;
+    }, KeyCode::A);
+  ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+  wait_until([&]() {return is_callback_started.load();});
+  ASSERT_TRUE(is_callback_started.load());
+  // Callback is running on the worker, delete waits for it to return
+  keyboard_handler.delete_key_press_callback(slow_handle);
+  EXPECT_TRUE(is_callback_finished.load());
+
+  // Callback could delete itself without waiting for its own call, ScopedKeyBinding alike
+  std::promise<void> self_deleted;
+  auto self_deleted_future = self_deleted.get_future();
+  KeyboardHandler::callback_handle_t self_handle = KeyboardHandler::invalid_handle;
+  std::atomic<size_t> number_of_self_calls{0};
+  std::mutex self_handle_mutex;
+  {
+    std::lock_guard<std::mutex> lk(self_handle_mutex);
+    self_handle = keyboard_handler.add_key_press_callback(
+      [&](KeyCode, KeyModifiers) {
+        number_of_self_calls++;
+        std::lock_guard<std::mutex> lk(self_handle_mutex);
+        keyboard_handler.delete_key_press_callback(self_handle);
+        self_deleted.set_value();
+      }, KeyCode::B);
+  }
+  ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::B));
+  ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::B));
+  ASSERT_EQ(
+    self_deleted_future.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+
+  // Deleted callbacks aren't called anymore, key presses of the same shard are dispatched in
+  // order, so they are done once the sentinel is called
+  std::promise<void> sentinel_called;
+  auto sentinel_future = sentinel_called.get_future();
+  keyboard_handler.add_key_press_callback(
+    [&sentinel_called](KeyCode, KeyModifiers) {sentinel_called.set_value();}, KeyCode::A,
+    KeyModifiers::CTRL);
+  ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::A));
+  ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::B));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_TRUE(keyboard_handler.inject_key(KeyCode::A, KeyModifiers::CTRL));
+  ASSERT_EQ(sentinel_future.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+  EXPECT_EQ(number_of_calls.load(), 1U);
+  EXPECT_EQ(number_of_self_calls.load(), 1U);
+}
+
 #endif  // #ifndef _WIN32